@@ -0,0 +1,520 @@
+/*
+    bench.c
+
+    renders a fixed camera sweep without a window and reports frame time statistics, run
+    from the v4 folder so the texture and font files are found:
+
+        ./raycaster-bench [-n frames] [-r WxH] [-t threads] [-e scalar|packet|fixed] [-i] [-z]
+                          [-p depth] [-c file] [-s] [-k] [-d steps|overdraw] [-w] [-g]
+                          [-b count] [-m file|WxH] [-a none|pyramid|distance]
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "vecmat.h"
+#include "threads.h"
+#include "raycast.h"
+#include "map.h"
+#include "sprite.h"
+#include "profile.h"
+#include "counters.h"
+#include "trace.h"
+
+//==================================================================
+//  DEFINES AND CONSTANTS
+//==================================================================
+
+#define RES_W               640
+#define RES_H               400
+
+#define TEXTURE_FILE        "textures/walls.tr8"
+#define SPRITE_TEXTURE      3           // scattered by -b
+
+#define BENCH_FRAMES        600         // frames timed by default
+#define BENCH_WARMUP        30          // frames rendered before timing starts
+#define BENCH_EDITS         100         // walls set and cleared once the frames are timed
+#define BENCH_SKIP_FRAMES   60          // frames rendered for each skipping compared
+
+// the camera turns one full circle on the spot over the timed frames
+#define BENCH_POS_X         7.5f
+#define BENCH_POS_Y         7.5f
+#define CIRCLE_RADIANS      6.2831853f
+
+//==================================================================
+//  GLOBAL VARIABLES
+//==================================================================
+
+// options
+int                             frames       = BENCH_FRAMES;
+int                             res_w        = RES_W;
+int                             res_h        = RES_H;
+int                             thread_count = 0;       // 0 uses one per cpu core
+int                             print_stats  = 0;       // print thread stats at the end
+int                             ray_engine   = RAY_ENGINE_PACKET;
+int                             skip         = RAY_SKIP_NONE;       // how rays skip empty space
+int                             indexed      = 0;       // draw to the 8 bit framebuffer
+int                             present      = GRA_PRESENT_COPY;
+int                             present_depth = 0;      // frames queued for the present thread
+char                            *csv_file    = NULL;    // per frame stage times
+int                             counters     = 0;       // hardware counters per stage
+int                             step_view    = 0;       // colour columns by dda steps
+int                             overdraw     = 0;       // colour pixels by writes
+int                             coverage     = 0;       // clear around the walls only
+int                             floors       = 0;       // textured floors and ceilings
+int                             sprite_count = 0;       // billboard sprites scattered in the map
+char                            *map_name    = NULL;    // map file or WxH, NULL for the built in map
+
+// the camera turns on the spot here, or in the start cell of a loaded or generated map
+vector2d_type                   camera_pos   = { BENCH_POS_X, BENCH_POS_Y };
+
+//==================================================================
+//  FUNCTION PROTOTYPES
+//==================================================================
+
+// reads the command line options
+void Read_Options( int argc, char *argv[] );
+
+// renders one frame of the sweep, the clear, scene, sprites and refresh of a frame of the
+// main loop without its screen fill and text, which aren't part of the renderer
+void Render_Frame( int frame );
+
+// compares two doubles for qsort
+int Compare_Times( const void *a, const void *b );
+
+// renders frames around the sweep with the given skipping and prints the cells stepped
+// through, the map reads and the time per frame
+void Print_Skip( int mode );
+
+//==================================================================
+//  MAIN FUNCTION
+//==================================================================
+
+int main( int argc, char *argv[] )
+{
+    Read_Options( argc, argv );
+
+    TRC_THREAD_NAME( "main" );
+
+    if( GRA_Create_Headless_Display( res_w, res_h ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to create headless display" );
+    }
+
+    if( GRA_Set_Indexed_Mode( indexed ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set indexed mode" );
+    }
+
+    if( GRA_Set_Present_Mode( present ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set present mode" );
+    }
+
+    if( GRA_Set_Coverage_Clear( coverage ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set coverage clear mode" );
+    }
+
+    if( present_depth > 0 && GRA_Start_Present_Thread( present_depth ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to start present thread" );
+    }
+
+    if( GRA_Generate_Palette() == 0 )
+    {
+        UTI_Fatal_Error( "Unable to load palette" );
+    }
+
+    if( GRA_Load_Textures( TEXTURE_FILE ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to load textures" );
+    }
+
+    if( RAY_Init( res_w, res_h ) == 0 || RAY_Set_Engine( ray_engine ) == 0 ||
+        RAY_Set_Skip( skip ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set up ray caster" );
+    }
+
+    // load or generate the map, the camera starts in the middle of its start cell
+    if( map_name != NULL )
+    {
+        int map_w, map_h, length = 0;
+        int made;
+
+        if( sscanf( map_name, "%dx%d%n", &map_w, &map_h, &length ) == 2 && map_name[length] == '\0' )
+        {
+            made = MAP_Generate( map_w, map_h );
+        }
+        else
+        {
+            made = MAP_Load( map_name );
+        }
+
+        if( made == 0 )
+        {
+            UTI_Fatal_Error( "Unable to set up map" );
+        }
+
+        camera_pos.x = MAP_Get_Map()->start_x + 0.5f;
+        camera_pos.y = MAP_Get_Map()->start_y + 0.5f;
+    }
+
+    // scatter the sprites over the empty cells
+    if( SPR_Init( res_w, res_h ) == 0 ||
+        ( sprite_count > 0 && SPR_Scatter( sprite_count, SPRITE_TEXTURE ) == 0 ) )
+    {
+        UTI_Fatal_Error( "Unable to set up sprites" );
+    }
+
+    if( THR_Create_Pool( thread_count ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to start render threads" );
+    }
+
+    // debug views
+    RAY_Set_Step_View( step_view );
+    RAY_Set_Floors( floors );
+
+    if( overdraw == 1 && GRA_Set_Overdraw_View( 1 ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to show overdraw" );
+    }
+
+    int i;
+    for( i = 0; i < BENCH_WARMUP; i++ )
+    {
+        Render_Frame( i );
+    }
+
+    // stages are timed for -s and -c, from the first timed frame
+    if( print_stats == 1 || csv_file != NULL )
+    {
+        PRF_Enable( 1 );
+    }
+
+    if( csv_file != NULL && PRF_Open_CSV( csv_file ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to open csv file" );
+    }
+
+    // the bench still runs without counters, it just can't print them
+    if( counters == 1 && CNT_Enable( 1 ) == 0 )
+    {
+        printf( "hardware counters are unavailable, check kernel.perf_event_paranoid\n" );
+    }
+
+    // time each frame
+    double *times = UTI_EC_Malloc( sizeof( double ) * frames );
+    double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    double total = 0.0;
+
+    for( i = 0; i < frames; i++ )
+    {
+        uint64_t start = SDL_GetPerformanceCounter();
+
+        Render_Frame( i );
+
+        times[i] = ( SDL_GetPerformanceCounter() - start ) * ms_per_tick;
+
+        PRF_End_Frame();
+        CNT_End_Frame();
+        total += times[i];
+    }
+
+    GRA_Flush_Present();
+
+    qsort( times, frames, sizeof( double ), Compare_Times );
+
+    // a wall set in the camera's cell and cleared again, as a door would be, which only
+    // updates the map around the cell
+    int         edit_x      = (int)camera_pos.x;
+    int         edit_y      = (int)camera_pos.y;
+    uint64_t    edit_start  = SDL_GetPerformanceCounter();
+
+    for( i = 0; i < BENCH_EDITS; i++ )
+    {
+        if( MAP_Set_Wall( edit_x, edit_y, 1 ) == 0 || MAP_Set_Wall( edit_x, edit_y, 0 ) == 0 )
+        {
+            UTI_Fatal_Error( "Unable to edit map" );
+        }
+    }
+
+    double edit_us = ( SDL_GetPerformanceCounter() - edit_start ) * ms_per_tick * 1000.0 /
+                     ( BENCH_EDITS * 2 );
+
+    printf( "raycaster-bench: %dx%d, %d frames, %d threads, %s engine (%d rays), %s\n",
+            res_w, res_h, frames, THR_Get_Thread_Count(),
+            RAY_Get_Engine_Name( RAY_Get_Engine() ),
+            ( RAY_Get_Engine() == RAY_ENGINE_PACKET ) ? RAY_Get_Packet_Size() : 1,
+            ( GRA_Get_Indexed_Mode() == 1 ) ? "8 bit indexed" : "32 bit RGBA" );
+    printf( "frame time: mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+            total / frames, times[frames / 2], times[( frames * 99 ) / 100],
+            times[frames - 1] );
+    printf( "throughput: %.1f Mpixels/s\n",
+            (double)res_w * res_h * frames / ( total / 1000.0 ) / 1000000.0 );
+    printf( "present: %s, %llu bytes copied per frame, %s\n",
+            ( GRA_Get_Present_Mode() == GRA_PRESENT_DIRECT ) ? "direct" : "copy",
+            (unsigned long long)GRA_Get_Bytes_Copied(),
+            ( GRA_Get_Present_Depth() > 0 ) ? "present thread" : "presented inline" );
+    printf( "clear: %s\n", ( GRA_Get_Coverage_Clear() == 1 ) ? "around walls" : "whole frame" );
+    printf( "map: %dx%d cells, camera at (%.1f, %.1f)\n", MAP_Get_Map()->width,
+            MAP_Get_Map()->height, camera_pos.x, camera_pos.y );
+    printf( "floors and ceilings: %s\n", ( RAY_Get_Floors() == 1 ) ? "textured" : "none" );
+
+    printf( "map edits: %.1f us to set or clear a wall\n", edit_us );
+
+    if( SPR_Get_Count() > 0 )
+    {
+        spr_stats_type stats;
+        SPR_Get_Stats( &stats );
+        printf( "sprites: %d in the map, %d culled, %d behind walls, %d drawn in %d columns in the last frame\n",
+                stats.sprites, stats.culled, stats.hidden, stats.drawn, stats.columns );
+    }
+
+    // the debug views cost time of their own, so their frame times aren't comparable
+    if( overdraw == 1 )
+    {
+        printf( "overdraw: %.2f writes per pixel in the last frame\n", GRA_Get_Overdraw() );
+    }
+
+    if( print_stats == 1 )
+    {
+        THR_Print_Stats();
+        PRF_Print_Averages();
+    }
+
+    if( CNT_Is_Enabled() )
+    {
+        CNT_Print_Averages();
+    }
+
+    PRF_Close_CSV();
+
+    // stepping cell by cell every cell stepped through is read from the map, skipping is
+    // compared against it on the same frames. the frames are rendered once everything
+    // above is printed, so they don't add to the stats of the timed frames
+    Print_Skip( RAY_SKIP_NONE );
+    if( skip != RAY_SKIP_NONE )
+    {
+        Print_Skip( skip );
+    }
+
+    UTI_EC_Free( times );
+
+    THR_Destroy_Pool();
+
+    SPR_Close();
+
+    MAP_Close();
+
+    GRA_Free_Palette();
+
+    GRA_Free_Textures();
+
+    GRA_Close();
+
+    CNT_Close();
+
+    // only written when built with make TRACE=1
+    TRC_WRITE( "bench-trace.json" );
+
+    return 0;
+}
+
+//==================================================================
+//  FUNCTION BODIES
+//==================================================================
+
+// reads the command line options
+void Read_Options( int argc, char *argv[] )
+{
+    int i;
+
+    for( i = 1; i < argc; i++ )
+    {
+        // -n N sets the number of timed frames
+        if( strcmp( argv[i], "-n" ) == 0 && i + 1 < argc )
+        {
+            frames = atoi( argv[++i] );
+            if( frames < 1 )
+            {
+                UTI_Fatal_Error( "Frame count must be at least 1" );
+            }
+        }
+        // -r WxH sets the render resolution
+        else if( strcmp( argv[i], "-r" ) == 0 && i + 1 < argc )
+        {
+            if( sscanf( argv[++i], "%dx%d", &res_w, &res_h ) != 2 || res_w < 1 || res_h < 1 )
+            {
+                UTI_Fatal_Error( "Resolution must be given as WxH" );
+            }
+        }
+        // -t N sets the number of render threads
+        else if( strcmp( argv[i], "-t" ) == 0 && i + 1 < argc )
+        {
+            thread_count = atoi( argv[++i] );
+        }
+        // -s prints render thread statistics for the last frame
+        else if( strcmp( argv[i], "-s" ) == 0 )
+        {
+            print_stats = 1;
+        }
+        // -e scalar|packet|fixed selects the ray casting engine
+        else if( strcmp( argv[i], "-e" ) == 0 && i + 1 < argc )
+        {
+            ray_engine = RAY_Get_Engine_By_Name( argv[++i] );
+            if( ray_engine < 0 )
+            {
+                UTI_Fatal_Error( "Unknown engine, use scalar, packet or fixed" );
+            }
+        }
+        // -a none|pyramid|distance selects how rays skip empty space
+        else if( strcmp( argv[i], "-a" ) == 0 && i + 1 < argc )
+        {
+            skip = RAY_Get_Skip_By_Name( argv[++i] );
+            if( skip < 0 )
+            {
+                UTI_Fatal_Error( "Unknown skipping, use none, pyramid or distance" );
+            }
+        }
+        // -i draws palette indices and expands them to RGBA once per frame
+        else if( strcmp( argv[i], "-i" ) == 0 )
+        {
+            indexed = 1;
+        }
+        // -z draws straight into the render surface, without copying each frame
+        else if( strcmp( argv[i], "-z" ) == 0 )
+        {
+            present = GRA_PRESENT_DIRECT;
+        }
+        // -c file writes the time of each stage of every frame to a csv file
+        else if( strcmp( argv[i], "-c" ) == 0 && i + 1 < argc )
+        {
+            csv_file = argv[++i];
+        }
+        // -k counts instructions, cycles, cache and branch misses of each stage
+        else if( strcmp( argv[i], "-k" ) == 0 )
+        {
+            counters = 1;
+        }
+        // -d steps|overdraw shows the dda steps of each column or the writes to each pixel
+        else if( strcmp( argv[i], "-d" ) == 0 && i + 1 < argc )
+        {
+            i++;
+            if( strcmp( argv[i], "steps" ) == 0 )
+            {
+                step_view = 1;
+            }
+            else if( strcmp( argv[i], "overdraw" ) == 0 )
+            {
+                overdraw = 1;
+            }
+            else
+            {
+                UTI_Fatal_Error( "Unknown debug view, use steps or overdraw" );
+            }
+        }
+        // -w clears only the pixels the walls don't cover instead of the whole frame
+        else if( strcmp( argv[i], "-w" ) == 0 )
+        {
+            coverage = 1;
+        }
+        // -g draws textured floors and ceilings
+        else if( strcmp( argv[i], "-g" ) == 0 )
+        {
+            floors = 1;
+        }
+        // -m file|WxH loads a map file or generates a map of WxH cells
+        else if( strcmp( argv[i], "-m" ) == 0 && i + 1 < argc )
+        {
+            map_name = argv[++i];
+        }
+        // -b N scatters N billboard sprites over the map
+        else if( strcmp( argv[i], "-b" ) == 0 && i + 1 < argc )
+        {
+            sprite_count = atoi( argv[++i] );
+            if( sprite_count < 0 || sprite_count > SPR_MAX_SPRITES )
+            {
+                UTI_Fatal_Error( "Sprite count must be from 0 to 4096" );
+            }
+        }
+        // -p N presents frames on their own thread with up to N frames queued
+        else if( strcmp( argv[i], "-p" ) == 0 && i + 1 < argc )
+        {
+            present_depth = atoi( argv[++i] );
+        }
+    }
+
+    return;
+}
+
+
+// renders one frame of the sweep, the clear, scene, sprites and refresh of a frame of the
+// main loop without its screen fill and text, which aren't part of the renderer
+void Render_Frame( int frame )
+{
+    float angle = CIRCLE_RADIANS * frame / frames;
+
+    GRA_Clear_Screen();
+
+    RAY_Draw_Scene( camera_pos, angle );
+
+    SPR_Draw_Sprites();
+
+    GRA_Refresh_Window();
+
+    return;
+}
+
+
+// renders frames around the sweep with the given skipping and prints the cells stepped
+// through, the map reads and the time per frame
+void Print_Skip( int mode )
+{
+    double steps = 0.0;
+    double reads = 0.0;
+    double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    uint64_t ticks = 0;
+
+    RAY_Set_Skip( mode );
+
+    int i;
+    for( i = 0; i < BENCH_SKIP_FRAMES; i++ )
+    {
+        uint64_t start = SDL_GetPerformanceCounter();
+
+        Render_Frame( i * frames / BENCH_SKIP_FRAMES );
+
+        ticks += SDL_GetPerformanceCounter() - start;
+        steps += RAY_Get_Average_Steps();
+        reads += RAY_Get_Average_Reads();
+    }
+
+    GRA_Flush_Present();
+
+    printf( "dda: %-8s skipping, %.2f cells stepped through and %.2f map reads per column, "
+            "%.3f ms per frame over %d frames\n", RAY_Get_Skip_Name( mode ),
+            steps / BENCH_SKIP_FRAMES, reads / BENCH_SKIP_FRAMES,
+            ticks * ms_per_tick / BENCH_SKIP_FRAMES, BENCH_SKIP_FRAMES );
+
+    return;
+}
+
+
+// compares two doubles for qsort
+int Compare_Times( const void *a, const void *b )
+{
+    double ta = *(const double *)a;
+    double tb = *(const double *)b;
+
+    return ( ta > tb ) - ( ta < tb );
+}
@@ -0,0 +1,413 @@
+/*
+    counters.c
+    hardware performance counters per frame stage. each thread opens a group of counters
+    the first time it reads them, and the group is read with one system call so all the
+    counters of a sample are taken at the same moment. the only shared state is the list of
+    groups, locked when a thread adds its group, and the stage totals, locked when counts
+    are added to them
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#ifdef __linux__
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/perf_event.h>
+#endif
+
+#include "utility.h"
+#include "profile.h"
+#include "counters.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+const char *COUNTER_NAMES[CNT_COUNT] =
+{
+    "instructions",
+    "cycles",
+    "cache misses",
+    "branch misses",
+};
+
+// the counters opened by one thread
+struct cnt_group_s              {
+                                    int     fd[CNT_COUNT];      // -1 when not opened
+                                    int     slot[CNT_COUNT];    // place in a group read
+                                    int     opened;             // counters in the group
+                                    int     leader;             // fd read for the group
+                                };
+typedef struct cnt_group_s cnt_group_type;
+
+static int                  cnt_enabled         = 0;
+static int                  cnt_available[CNT_COUNT];
+
+static cnt_group_type       *cnt_groups[CNT_MAX_THREADS];
+static int                  cnt_group_count     = 0;
+static int                  cnt_failed_threads  = 0;        // threads that couldn't open
+static SDL_SpinLock         cnt_lock            = 0;
+
+// counts of each stage since the counters were enabled
+static uint64_t             cnt_totals[PRF_STAGE_COUNT][CNT_COUNT];
+static int                  cnt_frames          = 0;
+
+// the group of the calling thread, and whether it has already failed to open one
+static __thread cnt_group_type  *cnt_local      = NULL;
+static __thread int             cnt_local_failed = 0;
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// opens the group of counters for the calling thread, NULL if not even the first counter
+// could be opened
+cnt_group_type *Open_Group()
+{
+#ifdef __linux__
+    const uint64_t CONFIGS[CNT_COUNT] =
+    {
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+    };
+
+    cnt_group_type *group = UTI_EC_Malloc( sizeof( cnt_group_type ) );
+    group->opened = 0;
+    group->leader = -1;
+
+    int i;
+
+    for( i = 0; i < CNT_COUNT; i++ )
+    {
+        struct perf_event_attr attr;
+        memset( &attr, 0, sizeof( attr ) );
+        attr.size           = sizeof( attr );
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.config         = CONFIGS[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                              PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // this thread, on any cpu, counting from now
+        group->fd[i] = syscall( SYS_perf_event_open, &attr, 0, -1, group->leader, 0 );
+        group->slot[i] = -1;
+
+        if( group->fd[i] >= 0 )
+        {
+            group->slot[i] = group->opened++;
+            if( group->leader < 0 )
+            {
+                group->leader = group->fd[i];
+            }
+        }
+    }
+
+    if( group->opened == 0 )
+    {
+        UTI_EC_Free( group );
+        return NULL;
+    }
+
+    return group;
+#else
+    return NULL;
+#endif
+}
+
+
+// closes a group of counters
+void Close_Group( cnt_group_type *group )
+{
+#ifdef __linux__
+    int i;
+    for( i = CNT_COUNT - 1; i >= 0; i-- )
+    {
+        if( group->fd[i] >= 0 )
+        {
+            close( group->fd[i] );
+        }
+    }
+#endif
+
+    UTI_EC_Free( group );
+
+    return;
+}
+
+
+// returns the calling threads group, opening it on first use, NULL if it can't be opened
+cnt_group_type *Get_Group()
+{
+    if( cnt_local != NULL || cnt_local_failed == 1 )
+    {
+        return cnt_local;
+    }
+
+    cnt_group_type *group = Open_Group();
+
+    SDL_AtomicLock( &cnt_lock );
+    if( group != NULL && cnt_group_count < CNT_MAX_THREADS )
+    {
+        cnt_groups[cnt_group_count++] = group;
+        cnt_local = group;
+    }
+    else
+    {
+        cnt_failed_threads++;
+    }
+    SDL_AtomicUnlock( &cnt_lock );
+
+    if( cnt_local == NULL )
+    {
+        if( group != NULL )
+        {
+            Close_Group( group );
+        }
+        cnt_local_failed = 1;
+    }
+
+    return cnt_local;
+}
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// starts (1) or stops (0) counting stages, fails if the counters can't be opened
+int CNT_Enable( int enabled )
+{
+    if( enabled == 0 )
+    {
+        cnt_enabled = 0;
+        return 1;
+    }
+
+    cnt_group_type *group = Get_Group();
+    if( group == NULL )
+    {
+        UTI_Print_Error( "Unable to open hardware counters" );
+        return 0;
+    }
+
+    int i;
+    for( i = 0; i < CNT_COUNT; i++ )
+    {
+        cnt_available[i] = ( group->fd[i] >= 0 ) ? 1 : 0;
+    }
+
+    memset( cnt_totals, 0, sizeof( cnt_totals ) );
+    cnt_frames = 0;
+    cnt_enabled = 1;
+
+    return 1;
+}
+
+
+// returns 1 if stages are being counted
+int CNT_Is_Enabled()
+{
+    return cnt_enabled;
+}
+
+
+// reads the counters of the calling thread
+void CNT_Read( cnt_sample_type *sample )
+{
+    memset( sample, 0, sizeof( cnt_sample_type ) );
+
+    if( cnt_enabled == 0 )
+    {
+        return;
+    }
+
+#ifdef __linux__
+    cnt_group_type *group = Get_Group();
+    if( group == NULL )
+    {
+        return;
+    }
+
+    // number of counters, time enabled, time running, then a value per counter
+    uint64_t data[3 + CNT_COUNT];
+    int i;
+
+    if( read( group->leader, data, sizeof( data ) ) < (ssize_t)( sizeof( uint64_t ) * 3 ) ||
+        data[2] == 0 )
+    {
+        return;
+    }
+
+    // counters that had to share the hardware with others are scaled up to the whole time
+    double scale = (double)data[1] / (double)data[2];
+
+    for( i = 0; i < CNT_COUNT; i++ )
+    {
+        if( group->slot[i] >= 0 && group->slot[i] < (int)data[0] )
+        {
+            sample->value[i] = (uint64_t)( data[3 + group->slot[i]] * scale );
+        }
+    }
+#endif
+
+    return;
+}
+
+
+// adds the counts between two samples of the calling thread to a stage
+void CNT_Add( int stage, const cnt_sample_type *start, const cnt_sample_type *end )
+{
+    if( cnt_enabled == 0 || stage < 0 || stage >= PRF_STAGE_COUNT )
+    {
+        return;
+    }
+
+    int i;
+
+    SDL_AtomicLock( &cnt_lock );
+    for( i = 0; i < CNT_COUNT; i++ )
+    {
+        // scaled counts can step backwards by a little
+        if( end->value[i] > start->value[i] )
+        {
+            cnt_totals[stage][i] += end->value[i] - start->value[i];
+        }
+    }
+    SDL_AtomicUnlock( &cnt_lock );
+
+    return;
+}
+
+
+// adds the counts since start to a stage
+void CNT_Stop( int stage, const cnt_sample_type *start )
+{
+    if( cnt_enabled == 0 )
+    {
+        return;
+    }
+
+    cnt_sample_type end;
+    CNT_Read( &end );
+    CNT_Add( stage, start, &end );
+
+    return;
+}
+
+
+// ends a frame, the averages are per frame
+void CNT_End_Frame()
+{
+    if( cnt_enabled == 1 )
+    {
+        cnt_frames++;
+    }
+
+    return;
+}
+
+
+// returns 1 if a counter could be opened
+int CNT_Is_Available( int counter )
+{
+    if( counter < 0 || counter >= CNT_COUNT )
+    {
+        return 0;
+    }
+
+    return cnt_available[counter];
+}
+
+
+// returns the average count of a stage per frame
+double CNT_Get_Average( int stage, int counter )
+{
+    if( cnt_frames == 0 || stage < 0 || stage >= PRF_STAGE_COUNT ||
+        counter < 0 || counter >= CNT_COUNT )
+    {
+        return 0.0;
+    }
+
+    return (double)cnt_totals[stage][counter] / cnt_frames;
+}
+
+
+// prints the average counts of every stage per frame
+void CNT_Print_Averages()
+{
+    int stage, i;
+
+    printf( "hardware counters (average per frame over %d frames, cast, draw and floors "
+            "summed over threads):\n", cnt_frames );
+
+    printf( "    %-7s", "stage" );
+    for( i = 0; i < CNT_COUNT; i++ )
+    {
+        printf( " %14s", COUNTER_NAMES[i] );
+    }
+    printf( " %6s\n", "ipc" );
+
+    for( stage = 0; stage < PRF_STAGE_COUNT; stage++ )
+    {
+        printf( "    %-7s", PRF_Get_Stage_Name( stage ) );
+        for( i = 0; i < CNT_COUNT; i++ )
+        {
+            if( cnt_available[i] == 1 )
+            {
+                printf( " %14.0f", CNT_Get_Average( stage, i ) );
+            }
+            else
+            {
+                printf( " %14s", "n/a" );
+            }
+        }
+
+        double cycles = CNT_Get_Average( stage, CNT_CYCLES );
+        if( cycles > 0.0 )
+        {
+            printf( " %6.2f\n", CNT_Get_Average( stage, CNT_INSTRUCTIONS ) / cycles );
+        }
+        else
+        {
+            printf( " %6s\n", "n/a" );
+        }
+    }
+
+    if( cnt_failed_threads > 0 )
+    {
+        printf( "    %d threads couldn't open counters and aren't counted\n",
+                cnt_failed_threads );
+    }
+
+    return;
+}
+
+
+// closes the counters of every thread, every thread that read counters must have finished
+void CNT_Close()
+{
+    int i;
+
+    cnt_enabled = 0;
+
+    for( i = 0; i < cnt_group_count; i++ )
+    {
+        Close_Group( cnt_groups[i] );
+        cnt_groups[i] = NULL;
+    }
+
+    // the threads groups are gone, only the calling thread can still be reading
+    cnt_group_count = 0;
+    cnt_failed_threads = 0;
+    cnt_local = NULL;
+    cnt_local_failed = 0;
+
+    return;
+}
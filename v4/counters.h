@@ -0,0 +1,88 @@
+/*
+    counters.h
+    hardware performance counters per frame stage, read with the linux perf_event_open()
+    interface. each thread that reads the counters opens its own group of counters the
+    first time, which counts only that thread, so the stages are the same as the profiler
+    stages in profile.h: cast and draw are summed over the render threads, the others count
+    only the thread that runs them.
+
+    a read is a system call, so timing with the counters on is a little slower than without
+    them. when the counters can't be opened (not linux, no hardware counters in a virtual
+    machine, or kernel.perf_event_paranoid too high) CNT_Enable() fails and every other
+    function does nothing
+*/
+
+#ifndef __counters_h__
+#define __counters_h__
+
+#include <stdint.h>
+
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+// counters read for each stage
+#define CNT_INSTRUCTIONS            0
+#define CNT_CYCLES                  1
+#define CNT_CACHE_MISSES            2       // last level cache misses
+#define CNT_BRANCH_MISSES           3
+#define CNT_COUNT                   4
+
+// most threads that can read counters
+#define CNT_MAX_THREADS             80
+
+// the counters of one thread at one moment
+struct cnt_sample_s             {
+                                    uint64_t    value[CNT_COUNT];
+                                };
+typedef struct cnt_sample_s cnt_sample_type;
+
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// starts (1) or stops (0) counting stages, fails if the counters can't be opened
+int CNT_Enable( int enabled );
+
+
+// returns 1 if stages are being counted
+int CNT_Is_Enabled();
+
+
+// reads the counters of the calling thread
+void CNT_Read( cnt_sample_type *sample );
+
+
+// adds the counts between two samples of the calling thread to a stage
+void CNT_Add( int stage, const cnt_sample_type *start, const cnt_sample_type *end );
+
+
+// adds the counts since start to a stage
+void CNT_Stop( int stage, const cnt_sample_type *start );
+
+
+// ends a frame, the averages are per frame
+void CNT_End_Frame();
+
+
+// returns 1 if a counter could be opened
+int CNT_Is_Available( int counter );
+
+
+// returns the average count of a stage per frame
+double CNT_Get_Average( int stage, int counter );
+
+
+// prints the average counts of every stage per frame
+void CNT_Print_Averages();
+
+
+// closes the counters of every thread, every thread that read counters must have finished
+void CNT_Close();
+
+
+#endif  // __counters_h__
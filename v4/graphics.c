@@ -10,11 +10,27 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <SDL2/SDL.h>
 
 #include "utility.h"
 #include "graphics.h"
+#include "threads.h"
+#include "profile.h"
+#include "counters.h"
+#include "trace.h"
+
+// sse2 is part of every x86-64 cpu, avx2 is compiled per function and checked at runtime
+#if defined( __SSE2__ )
+    #include <emmintrin.h>
+    #define GRA_SSE2
+#endif
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+    #include <immintrin.h>
+    #define GRA_AVX2
+#endif
 
 
 //===============================================================
@@ -23,6 +39,9 @@
 
 #define PALETTE_SIZE            256
 
+// largest window to render size ratio the integer upscaler handles
+#define MAX_UPSCALE             4
+
 //====================
 //  DISPLAY
 //====================
@@ -42,21 +61,147 @@ static int                  scr_height          = 0;
 static int                  res_width           = 0;            // render dimensions
 static int                  res_height          = 0;
 
+static int                  scr_headless        = 0;            // 1 if there is no window
+
+// in indexed mode drawing writes palette indices to w_index and GRA_Refresh_Window()
+// expands them to RGBA in one pass
+static int                  scr_indexed         = 0;
+static int                  scr_has_avx2        = 0;
+
+static uint8_t              *w_index            = NULL;         // index buffer to write to
+static uint8_t              *r_index            = NULL;         // index buffer to display
+
+// in direct present mode w_buffer is the render surface itself, so a frame is drawn where
+// it is shown from and Draw_Buffer() has nothing to copy
+static int                  scr_present         = GRA_PRESENT_COPY;
+
+// bytes written by the present path during the last GRA_Refresh_Window(). only the main
+// thread writes it, the present thread passes the bytes back in each frame's ring slot
+static uint64_t             scr_bytes_copied    = 0;
+
+// in coverage clear mode GRA_Clear_Screen() leaves the draw buffer alone, and the scene
+// clears only the pixels its walls won't cover with GRA_Clear_Uncovered()
+static int                  scr_coverage        = 0;
+static int                  *scr_cover          = NULL;         // 2 ints per column
+
+// the render surface is stretched to the window by duplicating pixels when the window is
+// an exact multiple of the render size, otherwise SDL_BlitScaled() is used
+static int                  scr_fast_upscale    = 1;
+static int                  scr_upscale_threads = 0;        // 1 to split it across threads
+
+// a frame being upscaled to the window surface
+struct scr_upscale_s            {
+                                    const uint32_t  *src;       // render surface pixels
+                                    uint8_t         *dst;       // window surface pixels
+                                    int             dst_pitch;  // bytes per window row
+                                    int             factor;     // window pixels per pixel
+                                    int             swap;       // 1 to swap red and blue
+                                };
+typedef struct scr_upscale_s scr_upscale_type;
+
+//====================
+//  PRESENT THREAD
+//====================
+
+// frames finished by the main thread are handed to the present thread through a ring of
+// present_depth + 1 buffers without a lock. both threads step through the slots in order,
+// the main thread only ever adds to present_submitted and the present thread only to
+// present_shown, so either side can tell from the two counts whether it may take the next
+// slot. a side that has to wait parks on the semaphore of its waiter, the semaphores are
+// only touched when a thread actually sleeps or has to be woken
+//
+// SDL only allows the window to be updated from the thread that created it, so the present
+// thread stops at drawing the frame to the render surface and upscaling it into the window
+// surface. the main thread updates the window with each frame it finishes and adds to
+// present_updated, and the present thread doesn't touch either surface again until then
+#define PRESENT_SLOTS           ( GRA_MAX_PRESENT_DEPTH + 1 )
+
+// a frame in the present ring
+struct scr_frame_s              {
+                                    uint32_t    *pixels;
+                                    uint8_t     *indices;       // used in indexed mode
+                                    uint64_t    bytes;          // written presenting it
+                                    int         upscaled;       // 1 if in the window surface
+                                };
+typedef struct scr_frame_s scr_frame_type;
+
+// a thread that may have to wait for the other side of the present ring
+struct scr_waiter_s             {
+                                    SDL_atomic_t    parked;     // 1 while it may sleep
+                                    SDL_sem         *wake;
+                                };
+typedef struct scr_waiter_s scr_waiter_type;
+
+static SDL_Thread           *present_thread     = NULL;
+static scr_frame_type       present_ring[PRESENT_SLOTS];
+static int                  present_depth       = 0;            // frames queued at most
+static int                  present_slot        = 0;            // slot being drawn
+
+static SDL_atomic_t         present_submitted;                  // frames handed over
+static SDL_atomic_t         present_shown;                      // frames presented
+static SDL_atomic_t         present_updated;                    // frames shown in the window
+static int                  present_update_slot = 0;            // slot shown in the window next
+
+static scr_waiter_type      present_reader;                     // waiting for a frame or
+                                                                // the window update
+static scr_waiter_type      present_writer;                     // waiting for a buffer
+static SDL_atomic_t         present_quit;
+
 // double buffer to write to
-static scr_buffer_type      scr_buffer          = { 0, 0, NULL, NULL };
+static scr_buffer_type      scr_buffer          = { 0, 0, NULL, NULL, NULL, NULL };
 
 static uint32_t             *palette            = NULL;
 
+//====================
+//  FRAME SCHEDULER
+//====================
+
+// the last SPIN_MS of a wait are spun out rather than slept, as SDL_Delay() can wake a
+// millisecond or more late
+#define SPIN_MS                 2
+
+// longest time step handed to the simulation, so a stall doesn't make the game jump
+#define MAX_DELTA               0.25
+
+static uint64_t             frm_period          = 0;            // ticks per frame, 0 uncapped
+static uint64_t             frm_deadline        = 0;            // when the next frame starts
+static uint64_t             frm_last            = 0;            // when the last frame started
+static int                  frm_missed          = 0;            // deadlines missed in total
+static int                  frm_count           = 0;            // frames timed in total
+
+// the last GRA_FRAME_HISTORY frame times and whether each missed its deadline
+static float                frm_times[GRA_FRAME_HISTORY];
+static uint8_t              frm_late[GRA_FRAME_HISTORY];
+
+//====================
+//  DEBUG VIEWS
+//====================
+
+// in the overdraw view every write to a render pixel is counted through the frame, and
+// GRA_Refresh_Window() shows the counts as a heatmap in place of the frame. clears and
+// fills of the window surface count once for each render pixel they cover
+#define OVERDRAW_MAX            5           // writes shown in the hottest colour
+
+static int                  scr_overdraw_view   = 0;
+static uint8_t              *scr_overdraw       = NULL;         // writes to each pixel
+static double               scr_overdraw_mean   = 0.0;          // of the last frame
+
 //===========================
 //  TEXTURE VARIABLES
 //===========================
 
 
-uint32_t            *texture_buffer = NULL;
+// palette indices of every texel, one byte each
+uint8_t             *texture_buffer = NULL;
 
 int                 TEX_SIZE = 0;               // size of each texture in texels
 int                 NO_OF_TEXTURES = 0;
 
+// the RGBA colour of every texel, laid out as texture_buffer, for the floor spans
+static uint32_t             *tex_colors         = NULL;
+static int                  tex_shift           = -1;           // log2 of TEX_SIZE, -1 if not
+                                                                // a power of two
+
 
 // font data is loaded here
 static uint8_t             *font_buffer        = NULL;
@@ -67,9 +212,281 @@ static uint8_t             *font_buffer        = NULL;
 
 // All int returning functions return 1 on success or 0 on failure unless otherwise stated
 
-// draws the w_buffer to the render surface
-void Draw_Buffer()
+// expands count palette indices to RGBA values with the avx2 gather, returns the number of
+// pixels done, the rest are left for the scalar loop
+#ifdef GRA_AVX2
+__attribute__(( target( "avx2" ) ))
+int Expand_Indices_AVX2( const uint8_t *indices, uint32_t *pixels, int count )
+{
+    int i;
+    for( i = 0; i + 8 <= count; i += 8 )
+    {
+        __m128i bytes   = _mm_loadl_epi64( (const __m128i *)( indices + i ) );
+        __m256i index   = _mm256_cvtepu8_epi32( bytes );
+        __m256i color   = _mm256_i32gather_epi32( (const int *)palette, index, 4 );
+        _mm256_storeu_si256( (__m256i *)( pixels + i ), color );
+    }
+
+    return i;
+}
+#endif
+
+
+// expands a buffer of palette indices to RGBA values in the render surface
+void Expand_Index_Buffer( const uint8_t *indices )
+{
+    uint32_t *bufp = scr_render->pixels;
+    int count = res_width * res_height;
+    int i = 0;
+
+#ifdef GRA_AVX2
+    if( scr_has_avx2 == 1 )
+    {
+        i = Expand_Indices_AVX2( indices, bufp, count );
+    }
+#endif
+
+    for( ; i < count; i++ )
+    {
+        bufp[i] = palette[indices[i]];
+    }
+
+    return;
+}
+
+
+// returns the palette index nearest an RGBA colour, the palette is 3 bits of red, 3 of
+// green and 2 of blue so the top bits of each channel give the index
+uint8_t Color_To_Index( uint32_t color )
+{
+    uint32_t r = ( color & R_MASK ) / R_ADJUST;
+    uint32_t g = ( color & G_MASK ) / G_ADJUST;
+    uint32_t b = ( color & B_MASK ) / B_ADJUST;
+
+    return ( ( r >> 5 ) << 5 ) | ( ( g >> 5 ) << 2 ) | ( b >> 6 );
+}
+
+
+// looks every texel up in the palette into tex_colors, once both are loaded
+void Build_Texture_Colors()
+{
+    UTI_EC_Free( tex_colors );
+    tex_colors = NULL;
+
+    if( texture_buffer == NULL || palette == NULL )
+    {
+        return;
+    }
+
+    size_t texel_count = (size_t)NO_OF_TEXTURES * TEX_SIZE * TEX_SIZE;
+    tex_colors = UTI_EC_Malloc( sizeof( uint32_t ) * texel_count );
+
+    size_t i;
+    for( i = 0; i < texel_count; i++ )
+    {
+        tex_colors[i] = palette[texture_buffer[i]];
+    }
+
+    return;
+}
+
+
+// draws count pixels of a floor or ceiling span with the avx2 gathers, into pixels as RGBA
+// values or into indices when pixels is NULL, see GRA_Draw_Horizontal_Texture_Line().
+// gives exactly the texels of the scalar loop, returns the number of pixels done
+#ifdef GRA_AVX2
+__attribute__(( target( "avx2" ) ))
+int Draw_Span_AVX2( uint32_t *pixels, uint8_t *indices, int count, int32_t u, int32_t v,
+                    int32_t u_step, int32_t v_step, const uint8_t *cells, int map_w, int map_h )
+{
+    __m256i lane        = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+    __m256i us          = _mm256_add_epi32( _mm256_set1_epi32( u ),
+                                            _mm256_mullo_epi32( lane, _mm256_set1_epi32( u_step ) ) );
+    __m256i vs          = _mm256_add_epi32( _mm256_set1_epi32( v ),
+                                            _mm256_mullo_epi32( lane, _mm256_set1_epi32( v_step ) ) );
+    __m256i u_step8     = _mm256_set1_epi32( u_step * 8 );
+    __m256i v_step8     = _mm256_set1_epi32( v_step * 8 );
+
+    __m256i zero        = _mm256_setzero_si256();
+    __m256i last_x      = _mm256_set1_epi32( map_w - 1 );
+    __m256i last_y      = _mm256_set1_epi32( map_h - 1 );
+    __m256i width       = _mm256_set1_epi32( map_w );
+    __m256i fraction    = _mm256_set1_epi32( 0xffff );
+    __m256i low_bits    = _mm256_set1_epi32( 3 );
+    __m256i low_byte    = _mm256_set1_epi32( 0xff );
+
+    // TEX_SIZE is a power of two, so scaling a fraction to a texel is a shift
+    __m128i to_texel    = _mm_cvtsi32_si128( 16 - tex_shift );
+    __m128i to_column   = _mm_cvtsi32_si128( tex_shift );
+    __m128i to_texture  = _mm_cvtsi32_si128( tex_shift * 2 );
+
+    // byte 0 of every pixel to the bottom of its lane, then both lanes together
+    __m256i first_bytes = _mm256_setr_epi8( 0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                            0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 );
+    __m256i join        = _mm256_setr_epi32( 0, 4, 1, 1, 1, 1, 1, 1 );
+
+    int i;
+    for( i = 0; i + 8 <= count; i += 8 )
+    {
+        // the map cell under each pixel, kept on the map
+        __m256i cell_x  = _mm256_min_epi32( _mm256_max_epi32( _mm256_srai_epi32( us, 16 ), zero ), last_x );
+        __m256i cell_y  = _mm256_min_epi32( _mm256_max_epi32( _mm256_srai_epi32( vs, 16 ), zero ), last_y );
+        __m256i cell    = _mm256_add_epi32( _mm256_mullo_epi32( cell_y, width ), cell_x );
+
+        // most groups of 8 pixels lie in one cell, which needs no gather
+        __m256i first   = _mm256_broadcastd_epi32( _mm256_castsi256_si128( cell ) );
+        __m256i texture;
+        if( _mm256_movemask_epi8( _mm256_cmpeq_epi32( cell, first ) ) == -1 )
+        {
+            texture = _mm256_set1_epi32( cells[_mm256_cvtsi256_si32( cell )] );
+        }
+        else
+        {
+            texture = _mm256_and_si256( _mm256_i32gather_epi32( (const int *)cells, cell, 1 ), low_byte );
+        }
+
+        __m256i tex_x   = _mm256_srl_epi32( _mm256_and_si256( us, fraction ), to_texel );
+        __m256i tex_y   = _mm256_srl_epi32( _mm256_and_si256( vs, fraction ), to_texel );
+
+        // textures are stored column by column
+        __m256i offset  = _mm256_or_si256( _mm256_or_si256( _mm256_sll_epi32( texture, to_texture ),
+                                                            _mm256_sll_epi32( tex_x, to_column ) ),
+                                           tex_y );
+
+        if( pixels != NULL )
+        {
+            __m256i color = _mm256_i32gather_epi32( (const int *)tex_colors, offset, 4 );
+            _mm256_storeu_si256( (__m256i *)( pixels + i ), color );
+        }
+        else
+        {
+            // texels are single bytes, gather the aligned 4 bytes holding each and shift it down
+            __m256i word  = _mm256_i32gather_epi32( (const int *)texture_buffer,
+                                                    _mm256_andnot_si256( low_bits, offset ), 1 );
+            __m256i shift = _mm256_slli_epi32( _mm256_and_si256( offset, low_bits ), 3 );
+            __m256i texel = _mm256_and_si256( _mm256_srlv_epi32( word, shift ), low_byte );
+
+            __m256i bytes = _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8( texel, first_bytes ), join );
+            _mm_storel_epi64( (__m128i *)( indices + i ), _mm256_castsi256_si128( bytes ) );
+        }
+
+        us = _mm256_add_epi32( us, u_step8 );
+        vs = _mm256_add_epi32( vs, v_step8 );
+    }
+
+    return i;
+}
+#endif
+
+
+// counts a write to every pixel of the frame for the overdraw view
+void Count_Frame_Writes()
+{
+    int i;
+    for( i = 0; i < res_width * res_height; i++ )
+    {
+        if( scr_overdraw[i] < 255 )
+        {
+            scr_overdraw[i]++;
+        }
+    }
+
+    return;
+}
+
+
+// counts a write to the pixels of column x from row first up to (but not including) last
+// for the overdraw view
+void Count_Column_Writes( int x, int first, int last )
+{
+    uint8_t *count = scr_overdraw + first * res_width + x;
+
+    for( ; first < last; first++ )
+    {
+        if( *count < 255 )
+        {
+            (*count)++;
+        }
+        count += res_width;
+    }
+
+    return;
+}
+
+
+// counts a write to the pixels of row y from column first up to (but not including) last
+// for the overdraw view
+void Count_Row_Writes( int y, int first, int last )
+{
+    uint8_t *count = scr_overdraw + y * res_width;
+
+    for( ; first < last; first++ )
+    {
+        if( count[first] < 255 )
+        {
+            count[first]++;
+        }
+    }
+
+    return;
+}
+
+
+// replaces the frame being drawn with the heatmap of the writes to each pixel and starts
+// counting the next frame
+void Draw_Overdraw()
+{
+    uint64_t total = 0;
+    int i;
+
+    for( i = 0; i < res_width * res_height; i++ )
+    {
+        uint32_t color = GRA_Heat_Color( scr_overdraw[i], OVERDRAW_MAX );
+
+        if( scr_indexed == 1 )
+        {
+            w_index[i] = Color_To_Index( color );
+        }
+        else
+        {
+            w_buffer[i] = color;
+        }
+
+        total += scr_overdraw[i];
+    }
+
+    scr_overdraw_mean = (double)total / ( res_width * res_height );
+    memset( scr_overdraw, 0, res_width * res_height );
+
+    return;
+}
+
+
+// returns 1 if the frame blitted to the window covers the whole window surface, so
+// anything filled in beforehand is overwritten
+int Blit_Covers_Window()
+{
+    return ( scr_rect.x <= 0 && scr_rect.y <= 0 &&
+             scr_rect.x + scr_rect.w >= scr_surface->w &&
+             scr_rect.y + scr_rect.h >= scr_surface->h ) ? 1 : 0;
+}
+
+
+// draws a finished frame to the render surface, returns the number of bytes written
+uint64_t Draw_Buffer( const uint32_t *pixels, const uint8_t *indices )
 {
+    if( scr_indexed == 1 )
+    {
+        Expand_Index_Buffer( indices );
+        return sizeof( uint32_t ) * res_width * res_height;
+    }
+
+    // the frame was drawn straight into the render surface
+    if( scr_present == GRA_PRESENT_DIRECT )
+    {
+        return 0;
+    }
+
     uint32_t *bufp;
     bufp = scr_render->pixels;              // get pointer to surface pixel data
     int x, y;
@@ -78,147 +495,1106 @@ void Draw_Buffer()
     {
         for( x = 0; x < scr_render->w; x++ )
         {
-            *bufp = w_buffer[y * scr_render->w + x];
+            *bufp = pixels[y * scr_render->w + x];
             bufp++;
         }
     }
 
-    return;
+    return sizeof( uint32_t ) * scr_render->w * scr_render->h;
 }
 
 
 // swaps the pointers to w_buffer and r_buffer
 void Swap_Buffer()
 {
-    uint32_t *temp;
-    temp = w_buffer;
-    w_buffer = r_buffer;
-    r_buffer = temp;
+    // there is only the render surface to draw to
+    if( scr_present == GRA_PRESENT_COPY )
+    {
+        uint32_t *temp;
+        temp = w_buffer;
+        w_buffer = r_buffer;
+        r_buffer = temp;
+    }
+
+    uint8_t *temp_index;
+    temp_index = w_index;
+    w_index = r_index;
+    r_index = temp_index;
 
     return;
 }
 
 
 
-//===============================================================
-//  FUNCTION BODIES
-//===============================================================
+// returns a pixel with its red and blue channels swapped
+uint32_t Swap_Red_Blue( uint32_t pixel )
+{
+    uint32_t r = ( pixel & R_MASK ) / R_ADJUST;
+    uint32_t b = ( pixel & B_MASK ) / B_ADJUST;
 
-// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+    return ( pixel & ~( R_MASK | B_MASK ) ) | ( r * B_ADJUST ) | ( b * R_ADJUST );
+}
 
-//=======================
-//  INITIALIZATION
-//=======================
 
-// starts SDL Video and opens a window. Also creates a screen_buffer_type object for 
-// writing to and initializes 2 SDL_Surfaces - one w_res x h_res which is stretched onto the
-// second which is width x height, which is rendered to the window.
-int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res )
+// duplicates the pixels of a row factor times across with the avx2 permute, returns the
+// number of source pixels done
+#ifdef GRA_AVX2
+__attribute__(( target( "avx2" ) ))
+int Upscale_Row_AVX2( const uint32_t *src, uint32_t *dst, int width, int factor, int swap )
 {
- 
-    // initialize SDL
-    if( SDL_Init( SDL_INIT_VIDEO ) != 0 )
+    // lane j of output vector k repeats source pixel ( 8k + j ) / factor
+    __m256i lanes[MAX_UPSCALE];
+    int k;
+    for( k = 0; k < factor; k++ )
     {
-        UTI_Print_Error( "Unable to initialize SDL" );
-        GRA_Print_SDL_Error();
-        return 0;
+        lanes[k] = _mm256_setr_epi32( ( 8*k + 0 ) / factor, ( 8*k + 1 ) / factor,
+                                      ( 8*k + 2 ) / factor, ( 8*k + 3 ) / factor,
+                                      ( 8*k + 4 ) / factor, ( 8*k + 5 ) / factor,
+                                      ( 8*k + 6 ) / factor, ( 8*k + 7 ) / factor );
     }
 
-    
-    // set screen globals
-    scr_width = width;
-    scr_height = height;
-
-    res_width = w_res;
-    res_height = h_res;
+    // exchanges bytes 0 and 2 of every pixel
+    __m256i swap_bytes = _mm256_setr_epi8( 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+                                           2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15 );
 
-
-    // create display window
-    scr_window = SDL_CreateWindow(  title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-                                    width, height, SDL_WINDOW_SHOWN );
-    if( scr_window == NULL )
+    int i;
+    for( i = 0; i + 8 <= width; i += 8 )
     {
-        UTI_Print_Error( "Unable to create display window" );
-        GRA_Print_SDL_Error();
-        return 0;
-    }
+        __m256i pixels = _mm256_loadu_si256( (const __m256i *)( src + i ) );
+        if( swap == 1 )
+        {
+            pixels = _mm256_shuffle_epi8( pixels, swap_bytes );
+        }
 
-    // create display surface
-    scr_surface = SDL_GetWindowSurface( scr_window );
-    if( scr_surface == NULL )
-    {
-        UTI_Print_Error( "Unable to get window surface" );
-        GRA_Print_SDL_Error();
-        return 0;
+        for( k = 0; k < factor; k++ )
+        {
+            _mm256_storeu_si256( (__m256i *)( dst + i * factor + 8 * k ),
+                                 _mm256_permutevar8x32_epi32( pixels, lanes[k] ) );
+        }
     }
 
+    return i;
+}
+#endif
 
-    // create render surface
-    scr_render = SDL_CreateRGBSurface(  SDL_SWSURFACE, w_res, h_res, 32,
-                                        R_MASK, G_MASK, B_MASK, A_MASK );
-    if( scr_render == NULL )
+
+// duplicates the pixels of a row factor times across with sse2 shuffles, returns the number
+// of source pixels done
+#ifdef GRA_SSE2
+int Upscale_Row_SSE2( const uint32_t *src, uint32_t *dst, int width, int factor, int swap )
+{
+    __m128i keep    = _mm_set1_epi32( 0xff00ff00 );
+    __m128i low     = _mm_set1_epi32( 0x000000ff );
+
+    int i;
+    for( i = 0; i + 4 <= width; i += 4 )
     {
-        UTI_Print_Error( "Unable to create render surface" );
-        GRA_Print_SDL_Error();
-        return 0;
+        __m128i p = _mm_loadu_si128( (const __m128i *)( src + i ) );
+        if( swap == 1 )
+        {
+            p = _mm_or_si128( _mm_and_si128( p, keep ),
+                _mm_or_si128( _mm_and_si128( _mm_srli_epi32( p, 16 ), low ),
+                              _mm_slli_epi32( _mm_and_si128( p, low ), 16 ) ) );
+        }
+
+        __m128i *out = (__m128i *)( dst + i * factor );
+        switch( factor )
+        {
+            case 1:
+                _mm_storeu_si128( out, p );
+                break;
+
+            case 2:
+                _mm_storeu_si128( out,     _mm_unpacklo_epi32( p, p ) );
+                _mm_storeu_si128( out + 1, _mm_unpackhi_epi32( p, p ) );
+                break;
+
+            case 3:
+                _mm_storeu_si128( out,     _mm_shuffle_epi32( p, _MM_SHUFFLE( 1, 0, 0, 0 ) ) );
+                _mm_storeu_si128( out + 1, _mm_shuffle_epi32( p, _MM_SHUFFLE( 2, 2, 1, 1 ) ) );
+                _mm_storeu_si128( out + 2, _mm_shuffle_epi32( p, _MM_SHUFFLE( 3, 3, 3, 2 ) ) );
+                break;
+
+            case 4:
+                _mm_storeu_si128( out,     _mm_shuffle_epi32( p, _MM_SHUFFLE( 0, 0, 0, 0 ) ) );
+                _mm_storeu_si128( out + 1, _mm_shuffle_epi32( p, _MM_SHUFFLE( 1, 1, 1, 1 ) ) );
+                _mm_storeu_si128( out + 2, _mm_shuffle_epi32( p, _MM_SHUFFLE( 2, 2, 2, 2 ) ) );
+                _mm_storeu_si128( out + 3, _mm_shuffle_epi32( p, _MM_SHUFFLE( 3, 3, 3, 3 ) ) );
+                break;
+        }
     }
 
-    // create rect for blitting render to screen
-    scr_rect.x = 0;
-    scr_rect.y = 0;
-    scr_rect.w = width;
-    scr_rect.h = height;
+    return i;
+}
+#endif
 
-    // create double buffer
-    scr_buffer.w = w_res;
-    scr_buffer.h = h_res;
-    scr_buffer.buffer1 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
-    scr_buffer.buffer2 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
 
-    // set write and read buffer pointers
-    w_buffer = scr_buffer.buffer1;
-    r_buffer = scr_buffer.buffer2;
+// upscales render rows first to last-1 into the window surface, each source row is widened
+// once and the result copied to the factor-1 window rows below it. matches the THR job
+// type so the rows can be split across the render threads
+void Upscale_Rows( int first, int last, void *data )
+{
+    scr_upscale_type *up = data;
+    int width = res_width;
+    int y, r;
+
+    for( y = first; y < last; y++ )
+    {
+        const uint32_t *src = up->src + y * width;
+        uint8_t *row = up->dst + y * up->factor * up->dst_pitch;
+        uint32_t *dst = (uint32_t *)row;
 
+        int x = 0;
+#ifdef GRA_AVX2
+        if( scr_has_avx2 == 1 )
+        {
+            x = Upscale_Row_AVX2( src, dst, width, up->factor, up->swap );
+        }
+#endif
+#ifdef GRA_SSE2
+        x += Upscale_Row_SSE2( src + x, dst + x * up->factor, width - x, up->factor,
+                               up->swap );
+#endif
 
-    return 1;
+        for( ; x < width; x++ )
+        {
+            uint32_t pixel = ( up->swap == 1 ) ? Swap_Red_Blue( src[x] ) : src[x];
+            for( r = 0; r < up->factor; r++ )
+            {
+                dst[x * up->factor + r] = pixel;
+            }
+        }
+
+        for( r = 1; r < up->factor; r++ )
+        {
+            memcpy( row + r * up->dst_pitch, row, sizeof( uint32_t ) * width * up->factor );
+        }
+    }
+
+    return;
 }
 
 
-// frees the SDL types, such as the window and surfaces and the 
-void GRA_Close()
+// stretches the render surface over rect of the window surface by a whole number of
+// pixels, returns 0 if the sizes or pixel formats don't allow it
+int Upscale_Frame( SDL_Surface *window, const SDL_Rect *rect )
 {
-    // free SDL_ Structs
-    SDL_DestroyWindow( scr_window );
-    scr_window = NULL;
+    SDL_PixelFormat *format = window->format;
+    scr_upscale_type up;
+
+    // the window has to be an exact multiple of the render size in both directions
+    if( rect->w % res_width != 0 || rect->h % res_height != 0 ||
+        rect->w / res_width != rect->h / res_height ||
+        rect->x + rect->w > window->w || rect->y + rect->h > window->h )
+    {
+        return 0;
+    }
+
+    up.factor = rect->w / res_width;
+    if( up.factor > MAX_UPSCALE )
+    {
+        return 0;
+    }
+
+    // the window surface is usually BGRA where the render surface is RGBA
+    if( format->BytesPerPixel != 4 || format->Gmask != G_MASK )
+    {
+        return 0;
+    }
+    else if( format->Rmask == R_MASK && format->Bmask == B_MASK )
+    {
+        up.swap = 0;
+    }
+    else if( format->Rmask == B_MASK && format->Bmask == R_MASK )
+    {
+        up.swap = 1;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if( SDL_MUSTLOCK( window ) && SDL_LockSurface( window ) != 0 )
+    {
+        return 0;
+    }
+
+    up.src          = scr_render->pixels;
+    up.dst_pitch    = window->pitch;
+    up.dst          = (uint8_t *)window->pixels + rect->y * up.dst_pitch +
+                      rect->x * sizeof( uint32_t );
+
+    // the render threads belong to the main thread while a present thread is running
+    if( scr_upscale_threads == 1 && present_thread == NULL )
+    {
+        THR_Run_Quiet( res_height, Upscale_Rows, &up );
+    }
+    else
+    {
+        Upscale_Rows( 0, res_height, &up );
+    }
+
+    if( SDL_MUSTLOCK( window ) )
+    {
+        SDL_UnlockSurface( window );
+    }
+
+    return 1;
+}
+
+
+// draws a finished frame to the render surface and, when the integer upscaler can be used,
+// upscales it into the window surface and sets *upscaled to 1. returns the number of bytes
+// written on the way, counting the blit Show_Frame() does otherwise
+uint64_t Draw_Frame( const uint32_t *pixels, const uint8_t *indices, int *upscaled )
+{
+    TRC_BEGIN( "present" );
+
+    cnt_sample_type counts;
+    CNT_Read( &counts );
+    uint64_t start = PRF_Start();
+
+    uint64_t bytes = Draw_Buffer( pixels, indices );
+
+    PRF_Stop( PRF_STAGE_BUFFER, start );
+    CNT_Stop( PRF_STAGE_BUFFER, &counts );
+
+    *upscaled = 0;
+
+    // without a window the frame stays in the render surface
+    if( scr_headless == 1 )
+    {
+        TRC_END( "present" );
+        return bytes;
+    }
+
+    CNT_Read( &counts );
+    start = PRF_Start();
+
+    // exact multiples of the render size are upscaled by duplicating pixels
+    if( scr_fast_upscale == 1 && Upscale_Frame( scr_surface, &scr_rect ) == 1 )
+    {
+        *upscaled = 1;
+    }
+    bytes += sizeof( uint32_t ) * scr_rect.w * scr_rect.h;
+
+    PRF_Stop( PRF_STAGE_SCALE, start );
+    CNT_Stop( PRF_STAGE_SCALE, &counts );
+
+    TRC_END( "present" );
+
+    return bytes;
+}
+
+
+// stretches the frame drawn by Draw_Frame() over the window surface with SDL_BlitScaled()
+// unless it was upscaled already, and updates the window. only the main thread calls it
+void Show_Frame( int upscaled )
+{
+    if( scr_headless == 1 )
+    {
+        return;
+    }
+
+    TRC_BEGIN( "update window" );
+
+    cnt_sample_type counts;
+    CNT_Read( &counts );
+    uint64_t start = PRF_Start();
+
+    if( upscaled == 0 )
+    {
+        SDL_BlitScaled( scr_render, NULL, scr_surface, &scr_rect );
+
+        PRF_Stop( PRF_STAGE_SCALE, start );
+        CNT_Stop( PRF_STAGE_SCALE, &counts );
+        CNT_Read( &counts );
+        start = PRF_Start();
+    }
+
+    SDL_UpdateWindowSurface( scr_window );
+
+    PRF_Stop( PRF_STAGE_UPDATE, start );
+    CNT_Stop( PRF_STAGE_UPDATE, &counts );
+
+    TRC_END( "update window" );
+
+    return;
+}
+
+
+// draws a finished frame to the render surface and shows it in the window, returns the
+// number of bytes written on the way
+uint64_t Present_Frame( const uint32_t *pixels, const uint8_t *indices )
+{
+    int upscaled;
+    uint64_t bytes = Draw_Frame( pixels, indices, &upscaled );
+
+    Show_Frame( upscaled );
+
+    return bytes;
+}
+
+
+// returns how far a frame count has got past target, the counts are only ever compared
+// with each other so this stays right when they wrap
+int Count_Past( SDL_atomic_t *count, int target )
+{
+    return (int)( (unsigned int)SDL_AtomicGet( count ) - (unsigned int)target );
+}
+
+
+// waits until count reaches target. the waiter is marked parked before the count is
+// checked again, so the other side either sees the mark and wakes it, or the count has
+// already moved and it doesn't sleep
+void Wait_For_Count( SDL_atomic_t *count, int target, scr_waiter_type *waiter )
+{
+    while( Count_Past( count, target ) < 0 )
+    {
+        SDL_AtomicCAS( &waiter->parked, 0, 1 );
+
+        if( Count_Past( count, target ) >= 0 )
+        {
+            // the other side unparked the waiter and will post, take the wake up so it
+            // isn't left over for the next wait
+            if( SDL_AtomicCAS( &waiter->parked, 1, 0 ) == SDL_FALSE )
+            {
+                SDL_SemWait( waiter->wake );
+            }
+            break;
+        }
+
+        SDL_SemWait( waiter->wake );
+    }
+
+    // see the other threads writes to the frames before using them
+    SDL_MemoryBarrierAcquire();
+
+    return;
+}
+
+
+// adds one to a frame count and wakes the waiter if it is parked on it
+void Advance_Count( SDL_atomic_t *count, scr_waiter_type *waiter )
+{
+    // make the writes to the frame visible before the count that hands it over
+    SDL_MemoryBarrierRelease();
+
+    SDL_AtomicAdd( count, 1 );
+
+    if( SDL_AtomicCAS( &waiter->parked, 1, 0 ) == SDL_TRUE )
+    {
+        SDL_SemPost( waiter->wake );
+    }
+
+    return;
+}
+
+
+// main function of the present thread, presents each frame handed over by
+// GRA_Refresh_Window() and gives its buffer back
+int Present_Main( void *arg )
+{
+    TRC_THREAD_NAME( "present" );
+
+    int shown = 0;
+    int slot = 0;
+
+    while( 1 )
+    {
+        Wait_For_Count( &present_submitted, shown + 1, &present_reader );
+
+        // a frame handed over after the quit flag is the signal to stop
+        if( SDL_AtomicGet( &present_quit ) == 1 )
+        {
+            break;
+        }
+
+        // the surfaces are free once the main thread has shown the last frame in the window
+        Wait_For_Count( &present_updated, shown, &present_reader );
+
+        // the bytes go back to the main thread with the buffer
+        scr_frame_type *frame = &present_ring[slot];
+        frame->bytes = Draw_Frame( frame->pixels, frame->indices, &frame->upscaled );
+
+        shown++;
+        slot = ( slot + 1 ) % ( present_depth + 1 );
+        Advance_Count( &present_shown, &present_writer );
+    }
+
+    return 0;
+}
+
+
+// shows the frame the present thread finished last in the window if it hasn't been, which
+// lets the present thread go on to the next. only the main thread calls it
+void Update_Window()
+{
+    int updated = SDL_AtomicGet( &present_updated );
+
+    if( Count_Past( &present_shown, updated + 1 ) < 0 )
+    {
+        return;
+    }
+
+    // see the present thread's writes to the surfaces and the frame
+    SDL_MemoryBarrierAcquire();
+
+    Show_Frame( present_ring[present_update_slot].upscaled );
+
+    present_update_slot = ( present_update_slot + 1 ) % ( present_depth + 1 );
+    Advance_Count( &present_updated, &present_reader );
+
+    return;
+}
+
+
+// waits until the present thread has finished target frames, showing each in the window
+// as it is finished. only the main thread calls it
+void Wait_For_Shown( int target )
+{
+    Update_Window();
+
+    while( Count_Past( &present_shown, target ) < 0 )
+    {
+        Wait_For_Count( &present_shown, SDL_AtomicGet( &present_updated ) + 1, &present_writer );
+        Update_Window();
+    }
+
+    // see the present thread's writes to the buffers it gave back
+    SDL_MemoryBarrierAcquire();
+
+    return;
+}
+
+
+// hands the frame drawn by the main thread to the present thread and waits for a free
+// buffer to draw the next one in
+void Submit_Frame()
+{
+    Advance_Count( &present_submitted, &present_reader );
+
+    // the next buffer is free once at most present_depth frames are waiting or being
+    // shown, the frame last drawn in it has been shown by then
+    int submitted = SDL_AtomicGet( &present_submitted );
+    Wait_For_Shown( submitted - present_depth );
+
+    present_slot = ( present_slot + 1 ) % ( present_depth + 1 );
+    w_buffer    = present_ring[present_slot].pixels;
+    w_index     = present_ring[present_slot].indices;
+
+    scr_bytes_copied = present_ring[present_slot].bytes;
+
+    return;
+}
+
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+//=======================
+//  INITIALIZATION
+//=======================
+
+// starts SDL Video and opens a window. Also creates a screen_buffer_type object for 
+// writing to and initializes 2 SDL_Surfaces - one w_res x h_res which is stretched onto the
+// second which is width x height, which is rendered to the window.
+int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res )
+{
+ 
+    // initialize SDL
+    if( SDL_Init( SDL_INIT_VIDEO ) != 0 )
+    {
+        UTI_Print_Error( "Unable to initialize SDL" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+    
+    // set screen globals
+    scr_width = width;
+    scr_height = height;
+
+    res_width = w_res;
+    res_height = h_res;
+
+
+    // create display window
+    scr_window = SDL_CreateWindow(  title, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+                                    width, height, SDL_WINDOW_SHOWN );
+    if( scr_window == NULL )
+    {
+        UTI_Print_Error( "Unable to create display window" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+    // create display surface
+    scr_surface = SDL_GetWindowSurface( scr_window );
+    if( scr_surface == NULL )
+    {
+        UTI_Print_Error( "Unable to get window surface" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+
+    // create render surface
+    scr_render = SDL_CreateRGBSurface(  SDL_SWSURFACE, w_res, h_res, 32,
+                                        R_MASK, G_MASK, B_MASK, A_MASK );
+    if( scr_render == NULL )
+    {
+        UTI_Print_Error( "Unable to create render surface" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+#ifdef GRA_AVX2
+    scr_has_avx2 = ( SDL_HasAVX2() ) ? 1 : 0;
+#endif
+
+    // create rect for blitting render to screen
+    scr_rect.x = 0;
+    scr_rect.y = 0;
+    scr_rect.w = width;
+    scr_rect.h = height;
+
+    // create double buffer
+    scr_buffer.w = w_res;
+    scr_buffer.h = h_res;
+    scr_buffer.buffer1 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
+    scr_buffer.buffer2 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
+
+    // set write and read buffer pointers
+    w_buffer = scr_buffer.buffer1;
+    r_buffer = scr_buffer.buffer2;
+
+
+    return 1;
+}
+
+
+// sets up the screen buffers and render surface without starting SDL video or opening a
+// window, GRA_Refresh_Window() then only copies each frame to the render surface. used
+// for benchmarking and testing on machines without a display
+int GRA_Create_Headless_Display( int w_res, int h_res )
+{
+    scr_headless = 1;
+
+    // there is no window, so the window size is the render size
+    scr_width = w_res;
+    scr_height = h_res;
+
+    res_width = w_res;
+    res_height = h_res;
+
+#ifdef GRA_AVX2
+    scr_has_avx2 = ( SDL_HasAVX2() ) ? 1 : 0;
+#endif
+
+    // a software surface doesn't need SDL video to be started
+    scr_render = SDL_CreateRGBSurface(  SDL_SWSURFACE, w_res, h_res, 32,
+                                        R_MASK, G_MASK, B_MASK, A_MASK );
+    if( scr_render == NULL )
+    {
+        UTI_Print_Error( "Unable to create render surface" );
+        GRA_Print_SDL_Error();
+        return 0;
+    }
+
+    // create double buffer
+    scr_buffer.w = w_res;
+    scr_buffer.h = h_res;
+    scr_buffer.buffer1 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
+    scr_buffer.buffer2 = UTI_EC_Malloc( sizeof( uint32_t ) * w_res * h_res );
+
+    // set write and read buffer pointers
+    w_buffer = scr_buffer.buffer1;
+    r_buffer = scr_buffer.buffer2;
+
+    return 1;
+}
+
+
+// frees the SDL types, such as the window and surfaces and the 
+void GRA_Close()
+{
+    GRA_Stop_Present_Thread();
+
+    // free SDL_ Structs
+    if( scr_window != NULL )
+    {
+        SDL_DestroyWindow( scr_window );
+        scr_window = NULL;
+    }
+
+    SDL_FreeSurface( scr_render );
+    scr_render = NULL;
+
+    // free screen buffers
+    UTI_EC_Free( scr_buffer.buffer1 );
+    scr_buffer.buffer1 = NULL;
+
+    UTI_EC_Free( scr_buffer.buffer2 );
+    scr_buffer.buffer2 = NULL;
+
+    UTI_EC_Free( scr_buffer.index1 );
+    scr_buffer.index1 = NULL;
+
+    UTI_EC_Free( scr_buffer.index2 );
+    scr_buffer.index2 = NULL;
+
+    UTI_EC_Free( scr_overdraw );
+    scr_overdraw = NULL;
+    scr_overdraw_view = 0;
+
+    UTI_EC_Free( scr_cover );
+    scr_cover = NULL;
+    scr_coverage = 0;
+
+    w_index = NULL;
+    r_index = NULL;
+    scr_indexed = 0;
+
+    w_buffer = NULL;
+    r_buffer = NULL;
+    scr_present = GRA_PRESENT_COPY;
+
+    // free font data
+    UTI_EC_Free( font_buffer );
+    
+    // TODO - free texture data
+    
+
+    return;
+}
+
+
+// switches indexed rendering on (1) or off (0). in indexed mode every pixel is written as a
+// one byte palette index, RGBA colours are drawn as the nearest palette colour, and the
+// whole frame is expanded to RGBA by GRA_Refresh_Window(). needs a display to be created
+int GRA_Set_Indexed_Mode( int indexed )
+{
+    if( scr_buffer.buffer1 == NULL )
+    {
+        UTI_Print_Error( "Indexed mode needs a display" );
+        return 0;
+    }
+
+    if( present_thread != NULL )
+    {
+        UTI_Print_Error( "Can't change indexed mode while the present thread runs" );
+        return 0;
+    }
+
+    if( indexed == 1 && scr_buffer.index1 == NULL )
+    {
+        scr_buffer.index1 = UTI_EC_Malloc( sizeof( uint8_t ) * res_width * res_height );
+        scr_buffer.index2 = UTI_EC_Malloc( sizeof( uint8_t ) * res_width * res_height );
+        memset( scr_buffer.index1, 0, res_width * res_height );
+        memset( scr_buffer.index2, 0, res_width * res_height );
+
+        w_index = scr_buffer.index1;
+        r_index = scr_buffer.index2;
+    }
+
+    scr_indexed = ( indexed == 1 ) ? 1 : 0;
+
+    return 1;
+}
+
+
+// returns 1 if indexed rendering is on
+int GRA_Get_Indexed_Mode()
+{
+    return scr_indexed;
+}
+
+
+// selects how frames reach the render surface:
+//      GRA_PRESENT_COPY    - drawn to a separate buffer and copied over by GRA_Refresh_Window()
+//      GRA_PRESENT_DIRECT  - drawn straight into the render surface, nothing is copied
+// needs a display to be created
+int GRA_Set_Present_Mode( int mode )
+{
+    if( scr_render == NULL )
+    {
+        UTI_Print_Error( "Present mode needs a display" );
+        return 0;
+    }
+
+    if( present_thread != NULL )
+    {
+        UTI_Print_Error( "Can't change present mode while the present thread runs" );
+        return 0;
+    }
+
+    if( mode == GRA_PRESENT_DIRECT )
+    {
+        // the renderer writes rows of res_width pixels one after another, and can't keep
+        // a surface locked for the whole frame
+        if( SDL_MUSTLOCK( scr_render ) ||
+            scr_render->pitch != (int)sizeof( uint32_t ) * res_width )
+        {
+            UTI_Print_Error( "Render surface can't be drawn to directly" );
+            return 0;
+        }
+
+        w_buffer = scr_render->pixels;
+    }
+    else if( mode == GRA_PRESENT_COPY )
+    {
+        w_buffer = scr_buffer.buffer1;
+        r_buffer = scr_buffer.buffer2;
+    }
+    else
+    {
+        UTI_Print_Error( "Unknown present mode" );
+        return 0;
+    }
+
+    scr_present = mode;
+
+    return 1;
+}
+
+
+// returns the current present mode
+int GRA_Get_Present_Mode()
+{
+    return scr_present;
+}
+
+
+// starts a thread that presents each frame while the main thread draws the next, depth
+// is the number of finished frames that may wait to be shown (1 or 2). a deeper queue
+// smooths out uneven frames at the cost of a frame more latency. can't be used with the
+// direct present mode, and the window surface is only touched by the present thread
+int GRA_Start_Present_Thread( int depth )
+{
+    if( scr_render == NULL )
+    {
+        UTI_Print_Error( "Present thread needs a display" );
+        return 0;
+    }
+
+    if( present_thread != NULL || scr_present == GRA_PRESENT_DIRECT )
+    {
+        UTI_Print_Error( "Present thread can't be started in this mode" );
+        return 0;
+    }
+
+    if( depth < 1 || depth > GRA_MAX_PRESENT_DEPTH )
+    {
+        UTI_Print_Error( "Present queue depth must be 1 or 2" );
+        return 0;
+    }
+
+    present_depth   = depth;
+    present_slot    = 0;
+    SDL_AtomicSet( &present_submitted, 0 );
+    SDL_AtomicSet( &present_shown, 0 );
+    SDL_AtomicSet( &present_updated, 0 );
+    SDL_AtomicSet( &present_quit, 0 );
+    present_update_slot = 0;
+
+    int i;
+    for( i = 0; i <= present_depth; i++ )
+    {
+        present_ring[i].pixels   = UTI_EC_Malloc( sizeof( uint32_t ) * res_width * res_height );
+        present_ring[i].indices  = UTI_EC_Malloc( sizeof( uint8_t ) * res_width * res_height );
+        present_ring[i].bytes    = 0;
+        present_ring[i].upscaled = 0;
+        memset( present_ring[i].pixels, 0, sizeof( uint32_t ) * res_width * res_height );
+        memset( present_ring[i].indices, 0, sizeof( uint8_t ) * res_width * res_height );
+    }
+
+    // neither thread is asleep to begin with
+    SDL_AtomicSet( &present_reader.parked, 0 );
+    SDL_AtomicSet( &present_writer.parked, 0 );
+    present_reader.wake = SDL_CreateSemaphore( 0 );
+    present_writer.wake = SDL_CreateSemaphore( 0 );
+
+    if( present_reader.wake == NULL || present_writer.wake == NULL )
+    {
+        UTI_Print_Error( "Unable to create present semaphores" );
+        GRA_Stop_Present_Thread();
+        return 0;
+    }
+
+    w_buffer    = present_ring[0].pixels;
+    w_index     = present_ring[0].indices;
+
+    present_thread = SDL_CreateThread( Present_Main, "present", NULL );
+    if( present_thread == NULL )
+    {
+        UTI_Print_Error( "Unable to create present thread" );
+        GRA_Stop_Present_Thread();
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// waits until every frame handed to the present thread has been shown in the window
+void GRA_Flush_Present()
+{
+    if( present_thread == NULL )
+    {
+        return;
+    }
+
+    // the queue is empty once every frame handed over has been counted as shown
+    Wait_For_Shown( SDL_AtomicGet( &present_submitted ) );
+
+    // the last frame shown is the one in the slot before the one being drawn
+    int last = ( present_slot + present_depth ) % ( present_depth + 1 );
+    scr_bytes_copied = present_ring[last].bytes;
+
+    return;
+}
+
+
+// shows any frames still queued, stops the present thread and goes back to presenting
+// from GRA_Refresh_Window()
+void GRA_Stop_Present_Thread()
+{
+    // nothing was started
+    if( present_depth == 0 )
+    {
+        return;
+    }
+
+    if( present_thread != NULL )
+    {
+        GRA_Flush_Present();
+
+        SDL_AtomicSet( &present_quit, 1 );
+        Advance_Count( &present_submitted, &present_reader );
+        SDL_WaitThread( present_thread, NULL );
+        present_thread = NULL;
+    }
+
+    SDL_DestroySemaphore( present_reader.wake );
+    present_reader.wake = NULL;
+
+    SDL_DestroySemaphore( present_writer.wake );
+    present_writer.wake = NULL;
+
+    int i;
+    for( i = 0; i < PRESENT_SLOTS; i++ )
+    {
+        UTI_EC_Free( present_ring[i].pixels );
+        present_ring[i].pixels = NULL;
+
+        UTI_EC_Free( present_ring[i].indices );
+        present_ring[i].indices = NULL;
+    }
+
+    present_depth = 0;
+
+    // draw to the display buffers again
+    w_buffer    = scr_buffer.buffer1;
+    r_buffer    = scr_buffer.buffer2;
+    w_index     = scr_buffer.index1;
+    r_index     = scr_buffer.index2;
+
+    return;
+}
+
+
+// returns the depth of the present queue, 0 if there is no present thread
+int GRA_Get_Present_Depth()
+{
+    return ( present_thread != NULL ) ? present_depth : 0;
+}
+
+
+// switches the integer upscaler on (1) or off (0), when it is off or the window isn't a
+// 1x to 4x multiple of the render size frames are stretched with SDL_BlitScaled()
+void GRA_Set_Fast_Upscale( int enabled )
+{
+    scr_fast_upscale = ( enabled == 1 ) ? 1 : 0;
+
+    return;
+}
+
+
+// splits the integer upscale across the render threads (1) or runs it on the calling
+// thread (0), the render thread pool must be started first
+void GRA_Set_Upscale_Threads( int enabled )
+{
+    scr_upscale_threads = ( enabled == 1 ) ? 1 : 0;
+
+    return;
+}
+
+
+//=======================
+//  CONTROL
+//=======================
+
+// wrapper for SDL_Delay, stalls program for milli milliseconds
+void GRA_Delay( int milli )
+{
+    SDL_Delay( milli );
+    return;
+}
+
+
+// sets the frame rate GRA_Wait_Frame() paces frames to, 0 or less runs uncapped
+void GRA_Set_Target_FPS( int fps )
+{
+    frm_period      = ( fps > 0 ) ? SDL_GetPerformanceFrequency() / fps : 0;
+    frm_deadline    = 0;
+    frm_last        = 0;
+
+    return;
+}
+
+
+// waits until the next frame is due, sleeping for most of the wait and spinning for the
+// end of it, then returns the time since the last call in seconds for moving the
+// simulation on. a frame that starts after its deadline is counted as missed and the
+// schedule restarts from it rather than rushing the following frames
+float GRA_Wait_Frame()
+{
+    uint64_t freq   = SDL_GetPerformanceFrequency();
+    uint64_t now    = SDL_GetPerformanceCounter();
+
+    // the first frame only starts the clock
+    if( frm_last == 0 )
+    {
+        frm_last        = now;
+        frm_deadline    = now + frm_period;
+        return 0.0f;
+    }
+
+    int late = 0;
+    if( frm_period > 0 )
+    {
+        if( now > frm_deadline )
+        {
+            late = 1;
+            frm_deadline = now;
+        }
+
+        TRC_BEGIN( "wait" );
+
+        while( now < frm_deadline )
+        {
+            uint64_t remaining_ms = ( ( frm_deadline - now ) * 1000 ) / freq;
+            if( remaining_ms > SPIN_MS )
+            {
+                SDL_Delay( remaining_ms - SPIN_MS );
+            }
+
+            now = SDL_GetPerformanceCounter();
+        }
+
+        TRC_END( "wait" );
+
+        frm_deadline += frm_period;
+    }
+
+    double delta = (double)( now - frm_last ) / (double)freq;
+    frm_last = now;
+
+    // keep the history of frame times
+    int slot = frm_count % GRA_FRAME_HISTORY;
+    frm_times[slot] = delta * 1000.0;
+    frm_late[slot]  = late;
+    frm_missed      += late;
+    frm_count++;
+
+    if( delta > MAX_DELTA )
+    {
+        delta = MAX_DELTA;
+    }
+
+    return delta;
+}
+
+
+// fills stats with the frame times of the last GRA_FRAME_HISTORY frames
+void GRA_Get_Frame_Stats( gra_frame_stats_type *stats )
+{
+    int frames = ( frm_count < GRA_FRAME_HISTORY ) ? frm_count : GRA_FRAME_HISTORY;
+    int i;
+
+    memset( stats, 0, sizeof( gra_frame_stats_type ) );
+
+    stats->frames       = frames;
+    stats->total_missed = frm_missed;
+    stats->target_ms    = ( frm_period > 0 ) ?
+                          frm_period * 1000.0 / (double)SDL_GetPerformanceFrequency() : 0.0;
+
+    if( frames == 0 )
+    {
+        return;
+    }
+
+    stats->min_ms = frm_times[0];
+    stats->max_ms = frm_times[0];
+
+    for( i = 0; i < frames; i++ )
+    {
+        double ms = frm_times[i];
 
-    SDL_FreeSurface( scr_render );
-    scr_render = NULL;
+        stats->mean_ms  += ms;
+        stats->missed   += frm_late[i];
 
-    // free screen buffers
-    UTI_EC_Free( scr_buffer.buffer1 );
-    scr_buffer.buffer1 = NULL;
+        if( ms < stats->min_ms )    stats->min_ms = ms;
+        if( ms > stats->max_ms )    stats->max_ms = ms;
 
-    UTI_EC_Free( scr_buffer.buffer2 );
-    scr_buffer.buffer2 = NULL;
+        int bucket = (int)ms;
+        if( bucket >= GRA_HISTOGRAM_BUCKETS )
+        {
+            bucket = GRA_HISTOGRAM_BUCKETS - 1;
+        }
+        stats->histogram[bucket]++;
+    }
 
-    // free font data
-    UTI_EC_Free( font_buffer );
-    
-    // TODO - free texture data
-    
+    stats->mean_ms /= frames;
 
     return;
 }
 
 
-//=======================
-//  CONTROL
-//=======================
-
-// wrapper for SDL_Delay, stalls program for milli milliseconds
-void GRA_Delay( int milli )
+// prints the frame pacing statistics and the histogram of recent frame times
+void GRA_Print_Frame_Stats()
 {
-    SDL_Delay( milli );
+    gra_frame_stats_type stats;
+    int i;
+
+    GRA_Get_Frame_Stats( &stats );
+
+    printf( "frames: last %d, target %.3f ms, mean %.3f ms, min %.3f ms, max %.3f ms, "
+            "missed %d (%d in total)\n", stats.frames, stats.target_ms, stats.mean_ms,
+            stats.min_ms, stats.max_ms, stats.missed, stats.total_missed );
+
+    for( i = 0; i < GRA_HISTOGRAM_BUCKETS; i++ )
+    {
+        if( stats.histogram[i] == 0 )
+        {
+            continue;
+        }
+
+        if( i == GRA_HISTOGRAM_BUCKETS - 1 )
+        {
+            printf( "    %2d+    ms: %4d\n", i, stats.histogram[i] );
+        }
+        else
+        {
+            printf( "    %2d-%-2d  ms: %4d\n", i, i + 1, stats.histogram[i] );
+        }
+    }
+
     return;
 }
 
@@ -226,13 +1602,16 @@ void GRA_Delay( int milli )
 int GRA_Check_Quit()
 {
     SDL_Event e;
+    int running = 1;
 
-    while( SDL_PollEvent( &e ) != 0 )
+    TRC_BEGIN( "input" );
+
+    while( running == 1 && SDL_PollEvent( &e ) != 0 )
     {
         // check for user closing window
         if( e.type == SDL_QUIT )
         {
-            return 0;
+            running = 0;
         }
         else if( e.type == SDL_KEYDOWN )
         {
@@ -240,7 +1619,7 @@ int GRA_Check_Quit()
             switch( e.key.keysym.sym )
             {
                 case SDLK_ESCAPE:
-                    return 0;
+                    running = 0;
                     break;
 
                 default:
@@ -249,7 +1628,9 @@ int GRA_Check_Quit()
         }
     }
 
-    return 1;
+    TRC_END( "input" );
+
+    return running;
 }
 
 
@@ -261,13 +1642,36 @@ int GRA_Check_Quit()
 // clears the current buffer for writing
 void GRA_Clear_Screen()
 {
-    int i;
-    for( i = 0; i < res_width * res_height; i++ )
+    // the scene clears what its walls don't cover
+    if( scr_coverage == 0 )
     {
-        w_buffer[i] = 0;        // black
+        if( scr_indexed == 1 )
+        {
+            // index 0 is black
+            memset( w_index, 0, res_width * res_height );
+        }
+        else
+        {
+            memset( w_buffer, 0, sizeof( uint32_t ) * res_width * res_height );
+        }
+
+        if( scr_overdraw_view == 1 )
+        {
+            Count_Frame_Writes();
+        }
     }
 
-    SDL_FillRect( scr_surface, NULL, 0x00000000 );
+    // the window surface belongs to the present thread while it runs, and there is no
+    // point clearing it when the frame is blitted over all of it
+    if( scr_headless == 0 && present_thread == NULL && Blit_Covers_Window() == 0 )
+    {
+        SDL_FillRect( scr_surface, NULL, 0x00000000 );
+
+        if( scr_overdraw_view == 1 )
+        {
+            Count_Frame_Writes();
+        }
+    }
     
     return;
 }
@@ -275,7 +1679,16 @@ void GRA_Clear_Screen()
 // fill screen with color
 void GRA_Fill_Screen( uint32_t color )
 {
-    SDL_FillRect( scr_surface, NULL, color );
+    if( scr_headless == 0 && present_thread == NULL && Blit_Covers_Window() == 0 )
+    {
+        SDL_FillRect( scr_surface, NULL, color );
+
+        if( scr_overdraw_view == 1 )
+        {
+            Count_Frame_Writes();
+        }
+    }
+
     return;
 }
 
@@ -285,17 +1698,210 @@ void GRA_Fill_Screen( uint32_t color )
 // switches buffers for the next write
 void GRA_Refresh_Window()
 {
-    Draw_Buffer();
+    if( scr_overdraw_view == 1 )
+    {
+        Draw_Overdraw();
+    }
+
+    // the present thread shows the frame while the next one is drawn
+    if( present_thread != NULL )
+    {
+        Submit_Frame();
+        return;
+    }
+
+    scr_bytes_copied = Present_Frame( w_buffer, w_index );
     Swap_Buffer();
 
-    SDL_BlitScaled( scr_render, NULL, scr_surface, &scr_rect );
+    return;
+}
+
 
-    SDL_UpdateWindowSurface( scr_window );
+// switches coverage clear mode on (1) or off (0). in coverage clear mode
+// GRA_Clear_Screen() doesn't clear the draw buffer, every frame must be cleared with
+// GRA_Clear_Uncovered() around what is drawn. the display must be created first
+int GRA_Set_Coverage_Clear( int enabled )
+{
+    if( enabled == 0 )
+    {
+        scr_coverage = 0;
+        return 1;
+    }
+
+    if( res_width == 0 || res_height == 0 )
+    {
+        UTI_Print_Error( "Display must be created before coverage clear mode is set" );
+        return 0;
+    }
+
+    if( scr_cover == NULL )
+    {
+        scr_cover = UTI_EC_Malloc( sizeof( int ) * res_width * 2 );
+    }
+
+    scr_coverage = 1;
+
+    return 1;
+}
+
+
+// returns 1 in coverage clear mode
+int GRA_Get_Coverage_Clear()
+{
+    return scr_coverage;
+}
+
+
+// in coverage clear mode, clears the pixels of the frame outside the rows top[x] to
+// bottom[x] (inclusive) of every column x, which the caller draws over before the frame is
+// shown. top[x] > bottom[x] clears the whole column. each uncovered run of a row is cleared
+// with one store, so no pixel is cleared that is drawn over. does nothing outside coverage
+// clear mode
+void GRA_Clear_Uncovered( const int *top, const int *bottom )
+{
+    if( scr_coverage == 0 )
+    {
+        return;
+    }
+
+    // for each column the rows from 0 up to above are cleared, and from below to the bottom
+    // of the frame
+    int *above          = scr_cover;
+    int *below          = scr_cover + res_width;
+    int x, y;
+
+    // the rows left open or covered in every column don't need to be searched
+    int open_above      = res_height;
+    int open_below      = 0;
+    int covered_above   = 0;
+    int covered_below   = res_height;
+
+    for( x = 0; x < res_width; x++ )
+    {
+        if( top[x] > bottom[x] || bottom[x] < 0 || top[x] >= res_height )
+        {
+            above[x] = res_height;
+            below[x] = res_height;
+        }
+        else
+        {
+            above[x] = ( top[x] < 0 ) ? 0 : top[x];
+            below[x] = ( bottom[x] >= res_height ) ? res_height : bottom[x] + 1;
+        }
+
+        if( above[x] < open_above )         open_above = above[x];
+        if( below[x] > open_below )         open_below = below[x];
+        if( above[x] > covered_above )      covered_above = above[x];
+        if( below[x] < covered_below )      covered_below = below[x];
+    }
+
+    for( y = 0; y < res_height; y++ )
+    {
+        x = 0;
+
+        if( y >= covered_above && y < covered_below )
+        {
+            continue;
+        }
+
+        while( x < res_width )
+        {
+            int run;
+
+            if( y < open_above || y >= open_below )
+            {
+                run = res_width;
+            }
+            else
+            {
+                // skip the columns that cover this row, then find the next one that does
+                while( x < res_width && y >= above[x] && y < below[x] )         x++;
+                for( run = x; run < res_width && ( y < above[run] || y >= below[run] ); run++ );
+            }
+
+            if( run > x )
+            {
+                int offset = y * res_width + x;
+
+                if( scr_indexed == 1 )
+                {
+                    memset( w_index + offset, 0, run - x );
+                }
+                else
+                {
+                    memset( w_buffer + offset, 0, sizeof( uint32_t ) * ( run - x ) );
+                }
+
+                if( scr_overdraw_view == 1 )
+                {
+                    Count_Row_Writes( y, x, run );
+                }
+            }
+
+            x = run;
+        }
+    }
 
     return;
 }
 
 
+// returns the number of bytes the last GRA_Refresh_Window() wrote while moving the frame
+// from the draw buffer to the window
+uint64_t GRA_Get_Bytes_Copied()
+{
+    return scr_bytes_copied;
+}
+
+
+// returns the pixels of the last frame shown by GRA_Refresh_Window(), res_width x
+// res_height RGBA values
+const uint32_t *GRA_Get_Frame()
+{
+    return scr_render->pixels;
+}
+
+
+// shows (1) or stops showing (0) the overdraw heatmap, each pixel is coloured by how many
+// times it was written in the frame, from black for none through blue, cyan, green and
+// yellow to red for OVERDRAW_MAX or more. the display must be created first
+int GRA_Set_Overdraw_View( int enabled )
+{
+    if( enabled == 0 )
+    {
+        scr_overdraw_view = 0;
+        UTI_EC_Free( scr_overdraw );
+        scr_overdraw = NULL;
+        return 1;
+    }
+
+    if( res_width == 0 || res_height == 0 )
+    {
+        UTI_Print_Error( "Display must be created before the overdraw view is shown" );
+        return 0;
+    }
+
+    if( scr_overdraw == NULL )
+    {
+        scr_overdraw = UTI_EC_Malloc( res_width * res_height );
+        memset( scr_overdraw, 0, res_width * res_height );
+    }
+
+    scr_overdraw_mean = 0.0;
+    scr_overdraw_view = 1;
+
+    return 1;
+}
+
+
+// returns the average number of writes to each pixel in the last frame shown in the
+// overdraw view
+double GRA_Get_Overdraw()
+{
+    return scr_overdraw_mean;
+}
+
+
 
 // generates a 256 colour palette
 int GRA_Generate_Palette()
@@ -315,6 +1921,8 @@ int GRA_Generate_Palette()
         }
     }
 
+    Build_Texture_Colors();
+
     return 1;
 }
 
@@ -346,6 +1954,44 @@ uint32_t GRA_Create_Color( uint8_t r, uint8_t g, uint8_t b, uint8_t a )
 
 
 
+// returns a colour from a heat scale for value between 0 and max, running from black
+// through blue, cyan, green and yellow to red, values outside the range are clamped
+uint32_t GRA_Heat_Color( int value, int max )
+{
+    static const uint8_t RAMP[6][3] =
+    {
+        {   0,   0,   0 },
+        {   0,   0, 255 },
+        {   0, 255, 255 },
+        {   0, 255,   0 },
+        { 255, 255,   0 },
+        { 255,   0,   0 },
+    };
+
+    if( max < 1 )           max = 1;
+    if( value < 0 )         value = 0;
+    if( value > max )       value = max;
+
+    // position along the 5 steps of the ramp in 1/256ths
+    int pos = ( value * 5 * 256 ) / max;
+    int step = pos >> 8;
+    int frac = pos & 255;
+
+    if( step >= 5 )
+    {
+        step = 4;
+        frac = 256;
+    }
+
+    uint8_t r = RAMP[step][0] + ( ( RAMP[step+1][0] - RAMP[step][0] ) * frac ) / 256;
+    uint8_t g = RAMP[step][1] + ( ( RAMP[step+1][1] - RAMP[step][1] ) * frac ) / 256;
+    uint8_t b = RAMP[step][2] + ( ( RAMP[step+1][2] - RAMP[step][2] ) * frac ) / 256;
+
+    return GRA_Create_Color( r, g, b, 0xff );
+}
+
+
+
 // returns color at given palette index
 uint32_t GRA_Get_Palette_Color( int index )
 {
@@ -361,6 +2007,23 @@ uint32_t GRA_Get_Palette_Color( int index )
 // not as a RGBA value to draw
 void GRA_Set_Palette_Pixel( int x, int y, int color )
 { 
+    if( scr_indexed == 1 )
+    {
+        if( x < 0 || x >= res_width || y < 0 || y >= res_height )
+        {
+            return;
+        }
+
+        w_index[y*res_width + x] = color;
+
+        if( scr_overdraw_view == 1 )
+        {
+            Count_Column_Writes( x, y, y + 1 );
+        }
+
+        return;
+    }
+
     GRA_Set_RGBA_Pixel( x, y, palette[color] );
 
     return;
@@ -371,8 +2034,19 @@ void GRA_Set_Palette_Pixel( int x, int y, int color )
 void GRA_Set_RGBA_Pixel( int x, int y, uint32_t color )
 {
     // check if pixel is within screen bounds
-    if( x < 0 || x > res_width || y < 0 || y > res_height )
+    if( x < 0 || x >= res_width || y < 0 || y >= res_height )
+    {
+        return;
+    }
+
+    if( scr_overdraw_view == 1 )
+    {
+        Count_Column_Writes( x, y, y + 1 );
+    }
+
+    if( scr_indexed == 1 )
     {
+        w_index[y*res_width + x] = Color_To_Index( color );
         return;
     }
 
@@ -405,26 +2079,119 @@ void GRA_Draw_Vertical_Line( int x, int y1, int y2, uint32_t color )
         return;
     }
 
-    // if line is on screen but extremes are off, set extremes within screen limits
-    if( y1 < 0 )            y1 = 0;
-    if( y2 > res_height-1)  y2 = res_height-1;
-
-    // draw the line
-    for( ; y1 <= y2; y1++ )
+    // if line is on screen but extremes are off, set extremes within screen limits
+    if( y1 < 0 )            y1 = 0;
+    if( y2 > res_height-1)  y2 = res_height-1;
+
+    // draw the line
+    for( ; y1 <= y2; y1++ )
+    {
+        GRA_Set_RGBA_Pixel( x, y1, color );
+    }
+
+    return;
+}
+
+
+// draws column tex_x (0 - TEX_SIZE-1) of a texture stretched from row col_start to col_end
+// of the screen column col_x
+void GRA_Draw_Vertical_Texture_Line( int tex_x, int col_x, int col_start, int col_end, int texture )
+{ 
+    
+    // check column is horizontally on screen
+    if( col_x < 0 || col_x >= res_width )
+    {
+        return;
+    }
+
+    // check that col_start is less than col_end
+    if( col_start > col_end )
+    {
+        int temp = col_start;
+        col_start = col_end;
+        col_end = temp;
+    }
+
+    // make sure line is vertically on screen
+    if( col_start >= res_height || col_end < 0 )
+    {
+        return;
+    }
+
+    int top = 0, bottom = res_height - 1;
+    int col_height = col_end - col_start;
+
+    // walls far enough away are less than a pixel high
+    if( col_height < 1 )
+    {
+        col_height = 1;
+    }
+
+    // restrict line to screen limits
+    if( col_start < 0 )
+    {
+        top -= col_start;
+        col_start = 0;
+    }
+    if( col_end > res_height-1 )
+    {
+        bottom = col_end;
+        col_end = res_height - 1;
+    }
+
+
+    // number of texels used to represent 1 pixel on screen:
+    float tex_per_pix       = (float)TEX_SIZE / (float) col_height;
+    float tex_counter       = top * tex_per_pix;
+    float tex_max           = bottom * tex_per_pix;
+    int   tex_y             = 0;
+    int   color_index       = 0;
+    // beginning of the desired texture in the buffer
+    int   texture_offset    = texture * TEX_SIZE * TEX_SIZE;       
+    // textures are stored column by column, so the texels of this column are in one run
+    const uint8_t *texel_column = texture_buffer + texture_offset + tex_x * TEX_SIZE;
+
+    // in indexed mode the texels are copied straight down the index buffer
+    if( scr_indexed == 1 )
+    {
+        uint8_t *pixel = w_index + col_start * res_width + col_x;
+        int first = col_start;
+
+        for( ; col_start <= col_end && tex_y < tex_max; col_start++ )
+        {
+            tex_y = tex_counter;
+            if( tex_y >= TEX_SIZE )         tex_y = TEX_SIZE-1;
+            *pixel = texel_column[tex_y];
+            pixel += res_width;
+            tex_counter += tex_per_pix;
+        }
+
+        if( scr_overdraw_view == 1 )
+        {
+            Count_Column_Writes( col_x, first, col_start );
+        }
+
+        return;
+    }
+
+    for( ; col_start <= col_end && tex_y < tex_max; col_start++ )
     {
-        GRA_Set_RGBA_Pixel( x, y1, color );
+        tex_y = tex_counter;
+        if( tex_y >= TEX_SIZE )             tex_y = TEX_SIZE-1;
+        color_index = texel_column[tex_y];
+        GRA_Set_Palette_Pixel( col_x, col_start, color_index );
+        tex_counter += tex_per_pix;
     }
 
-    return;
-}
+    return; 
+}        
 
 
-// draws a textured column of pixels to the screen
-void GRA_Draw_Vertical_Texture_Line( float texel_normal, int col_x, int col_start, int col_end, int texture )
-{ 
-    
+// same as GRA_Draw_Vertical_Texture_Line() using only integer arithmetic
+void GRA_Draw_Vertical_Texture_Line_Fixed( int tex_x, int col_x, int col_start, int col_end, int texture )
+{
     // check column is horizontally on screen
-    if( col_x < 0 || col_x > res_width )
+    if( col_x < 0 || col_x >= res_width )
     {
         return;
     }
@@ -443,9 +2210,14 @@ void GRA_Draw_Vertical_Texture_Line( float texel_normal, int col_x, int col_star
         return;
     }
 
-    int top = 0, bottom = res_height - 1;
+    int top = 0;
     int col_height = col_end - col_start;
 
+    if( col_height < 1 )
+    {
+        col_height = 1;
+    }
+
     // restrict line to screen limits
     if( col_start < 0 )
     {
@@ -454,34 +2226,147 @@ void GRA_Draw_Vertical_Texture_Line( float texel_normal, int col_x, int col_star
     }
     if( col_end > res_height-1 )
     {
-        bottom = col_end;
         col_end = res_height - 1;
     }
 
+    // texels per pixel in 16.16, the start is worked out exactly so clipped columns of
+    // very close walls don't drift
+    int32_t tex_per_pix     = ( TEX_SIZE << 16 ) / col_height;
+    int32_t tex_counter     = (int32_t)( ( (int64_t)top * ( TEX_SIZE << 16 ) ) / col_height );
+    int     tex_y           = 0;
+    int     color_index     = 0;
+    // beginning of the desired texture in the buffer
+    int     texture_offset  = texture * TEX_SIZE * TEX_SIZE;
+    // textures are stored column by column, so the texels of this column are in one run
+    const uint8_t *texel_column = texture_buffer + texture_offset + tex_x * TEX_SIZE;
 
-    // row of texels to draw
-    int tex_x = texel_normal * (float)TEX_SIZE;
+    // in indexed mode the texels are copied straight down the index buffer
+    if( scr_indexed == 1 )
+    {
+        uint8_t *pixel = w_index + col_start * res_width + col_x;
+        int first = col_start;
 
-    // number of texels used to represent 1 pixel on screen:
-    float tex_per_pix       = (float)TEX_SIZE / (float) col_height;
-    float tex_counter       = top * tex_per_pix;
-    float tex_max           = bottom * tex_per_pix;
-    int   tex_y             = 0;
-    int   color_index       = 0;
-    // beginning of the desired texture in the buffer
-    int   texture_offset    = texture * TEX_SIZE * TEX_SIZE;       
+        for( ; col_start <= col_end; col_start++ )
+        {
+            tex_y = tex_counter >> 16;
+            if( tex_y >= TEX_SIZE )         tex_y = TEX_SIZE-1;
+            *pixel = texel_column[tex_y];
+            pixel += res_width;
+            tex_counter += tex_per_pix;
+        }
 
-    for( ; col_start <= col_end && tex_y < tex_max; col_start++ )
+        if( scr_overdraw_view == 1 )
+        {
+            Count_Column_Writes( col_x, first, col_start );
+        }
+
+        return;
+    }
+
+    for( ; col_start <= col_end; col_start++ )
     {
-        tex_y = tex_counter;
+        tex_y = tex_counter >> 16;
         if( tex_y >= TEX_SIZE )             tex_y = TEX_SIZE-1;
-        color_index = texture_buffer[texture_offset + (tex_y * TEX_SIZE + tex_x)];
+        color_index = texel_column[tex_y];
         GRA_Set_Palette_Pixel( col_x, col_start, color_index );
         tex_counter += tex_per_pix;
     }
 
-    return; 
-}        
+    return;
+}
+
+
+// draws a column of a sprite, the same as GRA_Draw_Vertical_Texture_Line_Fixed() except
+// texel_fixed is the texel column in 16.16 fixed point (0 - 65535), and texels of palette
+// index 0 are transparent and leave the pixel behind them
+void GRA_Draw_Vertical_Sprite_Line( int32_t texel_fixed, int col_x, int col_start, int col_end, int texture )
+{
+    // check column is on screen
+    if( col_x < 0 || col_x >= res_width || col_start > col_end ||
+        col_start >= res_height || col_end < 0 )
+    {
+        return;
+    }
+
+    int col_height = col_end - col_start;
+
+    if( col_height < 1 )
+    {
+        col_height = 1;
+    }
+
+    // column of texels to draw
+    int tex_x = ( texel_fixed * TEX_SIZE ) >> 16;
+    const uint8_t *texel_column = texture_buffer + texture * TEX_SIZE * TEX_SIZE + tex_x * TEX_SIZE;
+
+    // only the rows between the first and last solid texels are drawn, the one after the
+    // last is kept in case the stepped texel counter runs behind the exact one
+    int solid_first = 0;
+    int solid_last = TEX_SIZE - 1;
+
+    while( solid_first <= solid_last && texel_column[solid_first] == 0 )      solid_first++;
+    while( solid_last >= solid_first && texel_column[solid_last] == 0 )       solid_last--;
+
+    if( solid_first > solid_last )
+    {
+        return;
+    }
+
+    int top = (int)( ( (int64_t)solid_first * col_height + TEX_SIZE - 1 ) / TEX_SIZE );
+    int bottom = col_start + (int)( ( (int64_t)( solid_last + 1 ) * col_height ) / TEX_SIZE );
+
+    // restrict line to the solid texels and the screen limits
+    if( col_start + top < 0 )
+    {
+        top = -col_start;
+    }
+    col_start += top;
+
+    if( col_end > bottom )
+    {
+        col_end = bottom;
+    }
+    if( col_end > res_height-1 )
+    {
+        col_end = res_height - 1;
+    }
+
+    // texels per pixel in 16.16, worked out exactly at the first row as for the walls
+    int32_t tex_per_pix     = ( TEX_SIZE << 16 ) / col_height;
+    int32_t tex_counter     = (int32_t)( ( (int64_t)top * ( TEX_SIZE << 16 ) ) / col_height );
+
+    int offset = col_start * res_width + col_x;
+
+    for( ; col_start <= col_end; col_start++ )
+    {
+        int tex_y = tex_counter >> 16;
+        if( tex_y >= TEX_SIZE )             tex_y = TEX_SIZE-1;
+
+        uint8_t texel = texel_column[tex_y];
+
+        if( texel != 0 )
+        {
+            if( scr_indexed == 1 )
+            {
+                w_index[offset] = texel;
+            }
+            else
+            {
+                w_buffer[offset] = palette[texel];
+            }
+
+            if( scr_overdraw_view == 1 )
+            {
+                Count_Column_Writes( col_x, col_start, col_start + 1 );
+            }
+        }
+
+        offset += res_width;
+        tex_counter += tex_per_pix;
+    }
+
+    return;
+}
 
 
 // draws a horizontal line
@@ -521,6 +2406,121 @@ void GRA_Draw_Horizontal_Line( int x1, int x2, int y, uint32_t color )
 }
 
 
+// draws a row of floor or ceiling on row y from x1 to x2, u and v are the map position
+// the first pixel shows and u_step and v_step how far it moves with each pixel, in 16.16
+// fixed point. cells is the texture of every map cell, row by row, map_w cells across and
+// map_h down, with 3 more bytes after the last that can be read. positions off the map
+// show the nearest cell
+void GRA_Draw_Horizontal_Texture_Line( int y, int x1, int x2, int32_t u, int32_t v,
+                                       int32_t u_step, int32_t v_step,
+                                       const uint8_t *cells, int map_w, int map_h )
+{
+    // check line is on screen
+    if( y < 0 || y >= res_height || x2 < x1 || x2 < 0 || x1 >= res_width )
+    {
+        return;
+    }
+
+    // move the start along to the screen edge
+    if( x1 < 0 )
+    {
+        u -= x1 * u_step;
+        v -= x1 * v_step;
+        x1 = 0;
+    }
+    if( x2 > res_width-1 )      x2 = res_width-1;
+
+    int count = x2 - x1 + 1;
+    int offset = y * res_width + x1;
+
+    uint32_t *pixels = ( scr_indexed == 1 ) ? NULL : w_buffer + offset;
+    uint8_t *indices = ( scr_indexed == 1 ) ? w_index + offset : NULL;
+    int i = 0;
+
+#ifdef GRA_AVX2
+    // the gather reads the 4 bytes around a texel, which stay inside the textures as long
+    // as each texture is a multiple of 4 bytes
+    if( scr_has_avx2 == 1 && tex_shift >= 1 )
+    {
+        i = Draw_Span_AVX2( pixels, indices, count, u, v, u_step, v_step, cells, map_w, map_h );
+        u += i * u_step;
+        v += i * v_step;
+    }
+#endif
+
+    // a span whose ends are on the map stays on it, and with power of two textures the
+    // texel is found with shifts. the tables are held locally as the stores could alias them
+    int64_t u_last = (int64_t)u + (int64_t)( count - 1 - i ) * u_step;
+    int64_t v_last = (int64_t)v + (int64_t)( count - 1 - i ) * v_step;
+
+    if( i < count && tex_shift >= 0 &&
+        u >= 0 && ( u >> 16 ) < map_w && v >= 0 && ( v >> 16 ) < map_h &&
+        u_last >= 0 && ( u_last >> 16 ) < map_w && v_last >= 0 && ( v_last >> 16 ) < map_h )
+    {
+        const uint32_t *colors = tex_colors;
+        const uint8_t *texels = texture_buffer;
+        int to_column = tex_shift;
+        int to_texture = tex_shift * 2;
+        int to_texel = 16 - tex_shift;
+
+        // one loop each for RGBA and indexed, keeping the test out of them
+        for( ; i < count && pixels != NULL; i++ )
+        {
+            pixels[i] = colors[( cells[( v >> 16 ) * map_w + ( u >> 16 )] << to_texture ) |
+                               ( ( ( u & 0xffff ) >> to_texel ) << to_column ) |
+                               ( ( v & 0xffff ) >> to_texel )];
+            u += u_step;
+            v += v_step;
+        }
+
+        for( ; i < count; i++ )
+        {
+            indices[i] = texels[( cells[( v >> 16 ) * map_w + ( u >> 16 )] << to_texture ) |
+                                ( ( ( u & 0xffff ) >> to_texel ) << to_column ) |
+                                ( ( v & 0xffff ) >> to_texel )];
+            u += u_step;
+            v += v_step;
+        }
+    }
+
+    for( ; i < count; i++ )
+    {
+        int cell_x = u >> 16;
+        int cell_y = v >> 16;
+
+        if( cell_x < 0 )            cell_x = 0;
+        if( cell_x > map_w-1 )      cell_x = map_w-1;
+        if( cell_y < 0 )            cell_y = 0;
+        if( cell_y > map_h-1 )      cell_y = map_h-1;
+
+        int tex_x = ( ( u & 0xffff ) * TEX_SIZE ) >> 16;
+        int tex_y = ( ( v & 0xffff ) * TEX_SIZE ) >> 16;
+
+        // textures are stored column by column
+        int texel = ( cells[cell_y * map_w + cell_x] * TEX_SIZE + tex_x ) * TEX_SIZE + tex_y;
+
+        if( pixels != NULL )
+        {
+            pixels[i] = tex_colors[texel];
+        }
+        else
+        {
+            indices[i] = texture_buffer[texel];
+        }
+
+        u += u_step;
+        v += v_step;
+    }
+
+    if( scr_overdraw_view == 1 )
+    {
+        Count_Row_Writes( y, x1, x2 + 1 );
+    }
+
+    return;
+}
+
+
 // draws a hollow rectangle to the screen
 void GRA_Draw_Hollow_Rectangle( int x, int y, int w, int h, uint32_t color )
 {
@@ -550,53 +2550,250 @@ void GRA_Draw_Filled_Rectangle( int x, int y, int w, int h, uint32_t color )
 //  TEXTURES
 //==========================
 
-#include <string.h>
-
 
-// loads textures from file TODO - FINISH
+// loads textures from file, either format is accepted:
+//      "TXTR"  - 32 bit texture size and count, then a uint32_t palette index per texel
+//      "TXR8"  - 32 bit texture size and count, then a uint8_t palette index per texel
+// texels are stored row by row in both
 int GRA_Load_Textures( char *filename )
-{ 
+{
+    TRC_BEGIN( "load textures" );
+
     FILE *file = NULL;
     char check[5];
 
     // open file
-    file = fopen( filename, "r" );
+    file = fopen( filename, "rb" );
     if( file == NULL )
     {
         UTI_Print_Error( "Unable to open texture file" );
+        TRC_END( "load textures" );
         return 0;
     }
     
-    // check for texture signature ("TXTR") at the beginning of the file
-    fread( check, 4, 1, file );
+    // check for texture signature ("TXTR" or "TXR8") at the beginning of the file
+    if( fread( check, 4, 1, file ) != 1 )
+    {
+        UTI_Print_Error( "Texture file is too short" );
+        fclose( file );
+        TRC_END( "load textures" );
+        return 0;
+    }
     check[4] = '\0';
 
-    if( strcmp( check, "TXTR" ) != 0 )
+    int texel_bytes = 0;
+    if( strcmp( check, "TXTR" ) == 0 )
+    {
+        texel_bytes = sizeof( uint32_t );
+    }
+    else if( strcmp( check, "TXR8" ) == 0 )
+    {
+        texel_bytes = sizeof( uint8_t );
+    }
+    else
     {
         UTI_Print_Error( "Not a valid texture file" );
+        fclose( file );
+        TRC_END( "load textures" );
         return 0;
     }
 
     // the next 8 bytes of the file are the size of a texture and the number of textures
-    // respectively
-    fread( &TEX_SIZE, sizeof( uint32_t ), 1, file );
-    fread( &NO_OF_TEXTURES, sizeof( uint32_t ), 1, file );
+    // respectively, both are checked before anything is allocated for them
+    uint32_t header[2];
 
-    printf( "%d textures read, %dx%d\n", NO_OF_TEXTURES, TEX_SIZE, TEX_SIZE );
+    if( fread( header, sizeof( uint32_t ), 2, file ) != 2 )
+    {
+        UTI_Print_Error( "Texture file is too short" );
+        fclose( file );
+        TRC_END( "load textures" );
+        return 0;
+    }
+
+    if( header[0] == 0 || header[1] == 0 )
+    {
+        UTI_Print_Error( "Texture file has no textures" );
+        fclose( file );
+        TRC_END( "load textures" );
+        return 0;
+    }
+
+    if( header[0] > GRA_MAX_TEXTURE_SIZE || header[1] > GRA_MAX_TEXTURES )
+    {
+        UTI_Print_Error( "Texture file has too many or too large textures" );
+        fclose( file );
+        TRC_END( "load textures" );
+        return 0;
+    }
+
+    int     size            = (int)header[0];
+    int     count           = (int)header[1];
+
+    // the file stores each texture row by row, walls are drawn a column at a time so
+    // transpose them to keep each column of texels together in memory
+    int     texture_area    = size * size;
+    size_t  texel_count     = (size_t)texture_area * count;
+    uint8_t *rows           = UTI_EC_Malloc( texel_bytes * texel_count );
 
-    texture_buffer = UTI_EC_Malloc( sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE * NO_OF_TEXTURES );
-    fread( texture_buffer, sizeof( uint32_t ) * TEX_SIZE * TEX_SIZE * NO_OF_TEXTURES, 1, file );
+    if( fread( rows, texel_bytes * texel_count, 1, file ) != 1 )
+    {
+        UTI_Print_Error( "Texture file is too short" );
+        UTI_EC_Free( rows );
+        fclose( file );
+        TRC_END( "load textures" );
+        return 0;
+    }
 
     fclose( file );
 
+    // narrow the old 32 bit texels to single bytes, they only ever hold palette indices
+    if( texel_bytes == sizeof( uint32_t ) )
+    {
+        uint32_t *wide = (uint32_t *)rows;
+        size_t i;
+        for( i = 0; i < texel_count; i++ )
+        {
+            if( wide[i] >= PALETTE_SIZE )
+            {
+                UTI_Print_Error( "Texel is not a palette index" );
+                UTI_EC_Free( rows );
+                TRC_END( "load textures" );
+                return 0;
+            }
+
+            rows[i] = (uint8_t)wide[i];
+        }
+    }
+
+    // the textures of an earlier load are replaced
+    GRA_Free_Textures();
+
+    TEX_SIZE        = size;
+    NO_OF_TEXTURES  = count;
+    texture_buffer  = UTI_EC_Malloc( sizeof( uint8_t ) * texel_count );
+
+    int t, x, y;
+    for( t = 0; t < NO_OF_TEXTURES; t++ )
+    {
+        for( y = 0; y < TEX_SIZE; y++ )
+        {
+            for( x = 0; x < TEX_SIZE; x++ )
+            {
+                texture_buffer[t * texture_area + x * TEX_SIZE + y] =
+                    rows[t * texture_area + y * TEX_SIZE + x];
+            }
+        }
+    }
+
+    UTI_EC_Free( rows );
+
+    tex_shift = -1;
+    if( ( TEX_SIZE & ( TEX_SIZE - 1 ) ) == 0 )
+    {
+        for( tex_shift = 0; ( 1 << tex_shift ) < TEX_SIZE; tex_shift++ );
+    }
+
+    Build_Texture_Colors();
+
+    printf( "%d textures read, %dx%d\n", NO_OF_TEXTURES, TEX_SIZE, TEX_SIZE );
+
+    TRC_END( "load textures" );
+
     return 1;     
 }
 
 
+// saves the loaded textures in the 8 bit "TXR8" format, texels are written row by row
+int GRA_Save_Textures( char *filename )
+{
+    if( texture_buffer == NULL )
+    {
+        UTI_Print_Error( "No textures loaded to save" );
+        return 0;
+    }
+
+    FILE *file = fopen( filename, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create texture file" );
+        return 0;
+    }
+
+    uint32_t size   = TEX_SIZE;
+    uint32_t count  = NO_OF_TEXTURES;
+
+    fwrite( "TXR8", 4, 1, file );
+    fwrite( &size, sizeof( uint32_t ), 1, file );
+    fwrite( &count, sizeof( uint32_t ), 1, file );
+
+    int t, x, y;
+    for( t = 0; t < NO_OF_TEXTURES; t++ )
+    {
+        for( y = 0; y < TEX_SIZE; y++ )
+        {
+            for( x = 0; x < TEX_SIZE; x++ )
+            {
+                fputc( texture_buffer[t * TEX_SIZE * TEX_SIZE + x * TEX_SIZE + y], file );
+            }
+        }
+    }
+
+    if( fclose( file ) != 0 )
+    {
+        UTI_Print_Error( "Unable to write texture file" );
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// returns the palette index of texel (x, y) of a texture, x being the column and y the
+// row, whatever order the texels are stored in
+uint32_t GRA_Get_Texel( int texture, int x, int y )
+{
+    if( texture < 0 || texture >= NO_OF_TEXTURES || x < 0 || x >= TEX_SIZE ||
+        y < 0 || y >= TEX_SIZE )
+    {
+        return 0;
+    }
+
+    return texture_buffer[texture * TEX_SIZE * TEX_SIZE + x * TEX_SIZE + y];
+}
+
+
+// returns a pointer to the TEX_SIZE texels of column x of a texture, top to bottom
+const uint8_t *GRA_Get_Texture_Column( int texture, int x )
+{
+    return texture_buffer + texture * TEX_SIZE * TEX_SIZE + x * TEX_SIZE;
+}
+
+
+// returns the width and height of each texture in texels
+int GRA_Get_Texture_Size()
+{
+    return TEX_SIZE;
+}
+
+
+// returns the number of textures loaded
+int GRA_Get_Texture_Count()
+{
+    return NO_OF_TEXTURES;
+}
+
+
 // free texture memory
 void GRA_Free_Textures()
 {
-    // TODO
+    UTI_EC_Free( texture_buffer );
+    texture_buffer = NULL;
+
+    TEX_SIZE        = 0;
+    NO_OF_TEXTURES  = 0;
+
+    Build_Texture_Colors();
+    tex_shift       = -1;
 
     return;
 }
@@ -618,7 +2815,9 @@ void GRA_Free_Textures()
 
 // loads my own custom made font files for use in these functions - TODO
 int GRA_Load_Font( char *filename )
-{ 
+{
+    TRC_BEGIN( "load font" );
+
     // open file for reading
     FILE    *file = NULL;
     int     filesize = 0;
@@ -627,6 +2826,7 @@ int GRA_Load_Font( char *filename )
     if( file == NULL )
     {
         UTI_Print_Error( "Unable to open font file\n" );
+        TRC_END( "load font" );
         return 0;
     }
 
@@ -638,6 +2838,7 @@ int GRA_Load_Font( char *filename )
     if( filesize != FONT_FILE_SIZE )
     {
         UTI_Print_Error( "Font file is incorrect size" );
+        TRC_END( "load font" );
         return 0;
     }
 
@@ -666,6 +2867,8 @@ int GRA_Load_Font( char *filename )
     UTI_EC_Free( temp_buffer );
     fclose( file );
     
+    TRC_END( "load font" );
+
     return 1; 
 }
 
@@ -739,4 +2942,10 @@ uint32_t GRA_Get_Mouse_State( int *x, int *y )
 //  TESTING
 //===========================
 
+// stretches the last frame in the render surface over rect of window the same way frames
+// are presented, returns 0 if the integer upscaler can't be used for them
+int GRA_Upscale_Frame( SDL_Surface *window, const SDL_Rect *rect )
+{
+    return Upscale_Frame( window, rect );
+}
 
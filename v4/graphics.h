@@ -11,6 +11,10 @@
 #ifndef __graphics_h__
 #define __graphics_h__
 
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
 
 //===============================================================
 //  DEFINE
@@ -46,6 +50,23 @@
     #define     A_ADJUST            0x1000000
 #endif  // SDL_BYTEORDER
 
+// present modes, see GRA_Set_Present_Mode()
+#define GRA_PRESENT_COPY                0
+#define GRA_PRESENT_DIRECT              1
+
+// most finished frames that can wait for the present thread
+#define GRA_MAX_PRESENT_DEPTH           2
+
+// largest texture and most textures a texture file can hold, a map cell holds a wall's
+// texture + 1 in a byte
+#define GRA_MAX_TEXTURE_SIZE            1024
+#define GRA_MAX_TEXTURES                255
+
+// frames kept by the frame scheduler, and 1 ms histogram buckets of their times, the last
+// bucket holds every longer frame
+#define GRA_FRAME_HISTORY               240
+#define GRA_HISTOGRAM_BUCKETS           34
+
 //===============================================================
 //  STRUCTS AND TYPES
 //===============================================================
@@ -56,10 +77,27 @@ struct scr_buffer_s             {
 
                                     uint32_t    *buffer1;
                                     uint32_t    *buffer2;
+
+                                    uint8_t     *index1;        // indexed mode buffers
+                                    uint8_t     *index2;
                                 };
 typedef struct scr_buffer_s scr_buffer_type;
 
 
+// frame pacing of the last GRA_FRAME_HISTORY frames
+struct gra_frame_stats_s        {
+                                    int         frames;         // frames in the history
+                                    int         missed;         // of those, deadlines missed
+                                    int         total_missed;   // deadlines missed ever
+                                    double      target_ms;      // 0 if uncapped
+                                    double      mean_ms;
+                                    double      min_ms;
+                                    double      max_ms;
+                                    int         histogram[GRA_HISTOGRAM_BUCKETS];
+                                };
+typedef struct gra_frame_stats_s gra_frame_stats_type;
+
+
 // TODO
 //struct  texture_s               {};
 
@@ -79,10 +117,69 @@ typedef struct scr_buffer_s scr_buffer_type;
 int GRA_Create_Display( char *title, int width, int height, int w_res, int h_res );
 
 
+// sets up the screen buffers and render surface without starting SDL video or opening a
+// window, GRA_Refresh_Window() then only copies each frame to the render surface. used
+// for benchmarking and testing on machines without a display
+int GRA_Create_Headless_Display( int w_res, int h_res );
+
+
 // frees the SDL types, such as the window and surfaces and the 
 void GRA_Close();
 
 
+// switches indexed rendering on (1) or off (0). in indexed mode every pixel is written as a
+// one byte palette index, RGBA colours are drawn as the nearest palette colour, and the
+// whole frame is expanded to RGBA by GRA_Refresh_Window(). needs a display to be created
+int GRA_Set_Indexed_Mode( int indexed );
+
+
+// returns 1 if indexed rendering is on
+int GRA_Get_Indexed_Mode();
+
+
+// selects how frames reach the render surface:
+//      GRA_PRESENT_COPY    - drawn to a separate buffer and copied over by GRA_Refresh_Window()
+//      GRA_PRESENT_DIRECT  - drawn straight into the render surface, nothing is copied
+// needs a display to be created
+int GRA_Set_Present_Mode( int mode );
+
+
+// returns the current present mode
+int GRA_Get_Present_Mode();
+
+
+// starts a thread that presents each frame while the main thread draws the next, depth
+// is the number of finished frames that may wait to be shown (1 or 2). a deeper queue
+// smooths out uneven frames at the cost of a frame more latency. can't be used with the
+// direct present mode. the present thread draws each frame to the render surface and
+// upscales it, the window itself is only updated from GRA_Refresh_Window() and
+// GRA_Flush_Present() on the main thread
+int GRA_Start_Present_Thread( int depth );
+
+
+// waits until every frame handed to the present thread has been shown in the window
+void GRA_Flush_Present();
+
+
+// shows any frames still queued, stops the present thread and goes back to presenting
+// from GRA_Refresh_Window()
+void GRA_Stop_Present_Thread();
+
+
+// returns the depth of the present queue, 0 if there is no present thread
+int GRA_Get_Present_Depth();
+
+
+// switches the integer upscaler on (1) or off (0), when it is off or the window isn't a
+// 1x to 4x multiple of the render size frames are stretched with SDL_BlitScaled()
+void GRA_Set_Fast_Upscale( int enabled );
+
+
+// splits the integer upscale across the render threads (1) or runs it on the calling
+// thread (0), the render thread pool must be started first
+void GRA_Set_Upscale_Threads( int enabled );
+
+
 //=======================
 //  CONTROL
 //=======================
@@ -90,6 +187,26 @@ void GRA_Close();
 // wrapper for SDL_Delay, stalls program for milli milliseconds
 void GRA_Delay( int milli );
 
+
+// sets the frame rate GRA_Wait_Frame() paces frames to, 0 or less runs uncapped
+void GRA_Set_Target_FPS( int fps );
+
+
+// waits until the next frame is due, sleeping for most of the wait and spinning for the
+// end of it, then returns the time since the last call in seconds for moving the
+// simulation on. a frame that starts after its deadline is counted as missed and the
+// schedule restarts from it rather than rushing the following frames
+float GRA_Wait_Frame();
+
+
+// fills stats with the frame times of the last GRA_FRAME_HISTORY frames
+void GRA_Get_Frame_Stats( gra_frame_stats_type *stats );
+
+
+// prints the frame pacing statistics and the histogram of recent frame times
+void GRA_Print_Frame_Stats();
+
+
 // check if user quits, by clicking window 'x' or pressed escape
 int GRA_Check_Quit();
 
@@ -112,6 +229,46 @@ void GRA_Fill_Screen( uint32_t color );
 void GRA_Refresh_Window();
 
 
+// switches coverage clear mode on (1) or off (0). in coverage clear mode
+// GRA_Clear_Screen() doesn't clear the draw buffer, every frame must be cleared with
+// GRA_Clear_Uncovered() around what is drawn. the display must be created first
+int GRA_Set_Coverage_Clear( int enabled );
+
+
+// returns 1 in coverage clear mode
+int GRA_Get_Coverage_Clear();
+
+
+// in coverage clear mode, clears the pixels of the frame outside the rows top[x] to
+// bottom[x] (inclusive) of every column x, which the caller draws over before the frame is
+// shown. top[x] > bottom[x] clears the whole column. each uncovered run of a row is cleared
+// with one store, so no pixel is cleared that is drawn over. does nothing outside coverage
+// clear mode
+void GRA_Clear_Uncovered( const int *top, const int *bottom );
+
+
+// returns the number of bytes the last GRA_Refresh_Window() wrote while moving the frame
+// from the draw buffer to the window, with a present thread running it is the last frame
+// whose buffer has come back from it
+uint64_t GRA_Get_Bytes_Copied();
+
+
+// returns the pixels of the last frame shown by GRA_Refresh_Window(), res_width x
+// res_height RGBA values
+const uint32_t *GRA_Get_Frame();
+
+
+// shows (1) or stops showing (0) the overdraw heatmap, each pixel is coloured by how many
+// times it was written in the frame, from black for none through blue, cyan, green and
+// yellow to red for 5 or more. the display must be created first
+int GRA_Set_Overdraw_View( int enabled );
+
+
+// returns the average number of writes to each pixel in the last frame shown in the
+// overdraw view
+double GRA_Get_Overdraw();
+
+
 // generates a 256 colour palette
 int GRA_Generate_Palette();
 
@@ -128,6 +285,11 @@ void GRA_Free_Palette();
 uint32_t GRA_Create_Color( uint8_t r, uint8_t g, uint8_t b, uint8_t a );
 
 
+// returns a colour from a heat scale for value between 0 and max, running from black
+// through blue, cyan, green and yellow to red, values outside the range are clamped
+uint32_t GRA_Heat_Color( int value, int max );
+
+
 // returns color at given palette index
 uint32_t GRA_Get_Palette_Color( int index );
 
@@ -144,14 +306,35 @@ void GRA_Set_RGBA_Pixel( int x, int y, uint32_t color_rgba );
 void GRA_Draw_Vertical_Line( int x, int y1, int y2, uint32_t color_rgba );
 
 
-// draws a textured column of pixels to the screen      
-void GRA_Draw_Vertical_Texture_Line( float texel_normal, int col_x, int col_start, int col_end, int texture );
+// draws column tex_x (0 - TEX_SIZE-1) of a texture stretched from row col_start to col_end
+// of the screen column col_x
+void GRA_Draw_Vertical_Texture_Line( int tex_x, int col_x, int col_start, int col_end, int texture );
+
+
+// same as GRA_Draw_Vertical_Texture_Line() using only integer arithmetic
+void GRA_Draw_Vertical_Texture_Line_Fixed( int tex_x, int col_x, int col_start, int col_end, int texture );
+
+
+// draws a column of a sprite, the same as GRA_Draw_Vertical_Texture_Line_Fixed() except
+// texel_fixed is the texel column in 16.16 fixed point (0 - 65535), and texels of palette
+// index 0 are transparent and leave the pixel behind them
+void GRA_Draw_Vertical_Sprite_Line( int32_t texel_fixed, int col_x, int col_start, int col_end, int texture );
 
 
 // draws a horizontal line
 void GRA_Draw_Horizontal_Line( int x1, int x2, int y, uint32_t color_rgba );
 
 
+// draws a row of floor or ceiling on row y from x1 to x2, u and v are the map position
+// the first pixel shows and u_step and v_step how far it moves with each pixel, in 16.16
+// fixed point. cells is the texture of every map cell, row by row, map_w cells across and
+// map_h down, with 3 more bytes after the last that can be read. positions off the map
+// show the nearest cell
+void GRA_Draw_Horizontal_Texture_Line( int y, int x1, int x2, int32_t u, int32_t v,
+                                       int32_t u_step, int32_t v_step,
+                                       const uint8_t *cells, int map_w, int map_h );
+
+
 // draws a hollow rectangle to the screen
 void GRA_Draw_Hollow_Rectangle( int x, int y, int w, int h, uint32_t color_rgba );
 
@@ -166,8 +349,32 @@ void GRA_Draw_Filled_Rectangle( int x, int y, int w, int h, uint32_t color_rgba
 //==========================
 
 
-// loads textures from file
-int GRA_Load_Textures( char *filename );     // TODO
+// loads textures from a "TXTR" (32 bit texels) or "TXR8" (8 bit texels) file, texels are
+// kept as one byte palette indices and stored transposed (column by column) so the texels
+// of a wall column are contiguous, use GRA_Get_Texel() for row/column access
+int GRA_Load_Textures( char *filename );
+
+
+// saves the loaded textures in the 8 bit "TXR8" format
+int GRA_Save_Textures( char *filename );
+
+
+// returns the palette index of texel (x, y) of a texture, x being the column and y the
+// row, whatever order the texels are stored in
+uint32_t GRA_Get_Texel( int texture, int x, int y );
+
+
+// returns a pointer to the TEX_SIZE texels of column x of a texture, top to bottom
+const uint8_t *GRA_Get_Texture_Column( int texture, int x );
+
+
+// returns the width and height of each texture in texels
+int GRA_Get_Texture_Size();
+
+
+// returns the number of textures loaded
+int GRA_Get_Texture_Count();
+
 
 // free texture memory
 void GRA_Free_Textures();
@@ -202,6 +409,12 @@ uint32_t GRA_Get_Mouse_State( int *x, int *y );
 //  TESTING
 //===========================
 
+// stretches the last frame in the render surface over rect of window with the integer
+// upscaler frames are presented with, returns 0 without drawing anything if rect isn't a
+// 1x to 4x multiple of the render size or window isn't 32 bit RGB or BGR. lets the tests
+// check it against SDL_BlitScaled()
+int GRA_Upscale_Frame( SDL_Surface *window, const SDL_Rect *rect );
+
 
 //===============================================================
 //  FUNCTION BODIES
@@ -7,11 +7,18 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "utility.h"
 #include "graphics.h"
 #include "vecmat.h"
+#include "threads.h"
+#include "raycast.h"
+#include "map.h"
+#include "sprite.h"
+#include "profile.h"
+#include "trace.h"
 
 //==================================================================
 //  DEFINES AND CONSTANTS
@@ -23,45 +30,14 @@
 #define RES_W               640
 #define RES_H               400
 
-#define WORLD_WIDTH         16
-#define WORLD_HEIGHT        16
-
 #define PLAYER_START_X      10
 #define PLAYER_START_Y      10
 
-#define TEXTURE_FILE        "textures/walls.txr"
+#define TEXTURE_FILE        "textures/walls.tr8"
+#define SPRITE_TEXTURE      3           // scattered by -b
 
-// world to render
-int WORLD_MAP[WORLD_HEIGHT][WORLD_WIDTH] =
-{
-    { 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-    { 1, 0, 1, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 1 },
-    { 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-    { 4, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
-    { 1, 1, 1, 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 }
-};
-
-// these vectors are multiplied by the transformation matrix each frame to get the players
-// correct orientation, the screen falls between -1.0 ( 0 ) and 1.0 ( SCREEN_WIDTH_RES - 1 )
-const vector2d_type             DIRECTION_UP        = {  0.0, -1.0 };  // vector always points up
-const vector2d_type             DIRECTION_RIGHT     = {  1.0,  0.0 };  
-
-const matrix2d_type             IDENTITY_MATRIX     = {{   
-                                                        { 1.0, 0.0, 0.0 },
-                                                        { 0.0, 1.0, 0.0 },
-                                                        { 0.0, 0.0, 1.0 } 
-                                                      }};
+#define TARGET_FPS          60
+#define TURN_SPEED          0.6f        // radians per second
 
 uint32_t                        RED         = 0xff0000ff;
 uint32_t                        DARK_RED    = 0xff000080;
@@ -76,22 +52,34 @@ uint32_t                        GREEN       = 0xff00ff00;
 //==================================================================
 
 vector2d_type                   player_pos = { PLAYER_START_X, PLAYER_START_Y };
-vector2d_type                   player_dir;
-vector2d_type                   player_screen;          // the screen plane
 
 float                           player_angle = 0.0f;
 
-matrix2d_type                   matrix;
+// options
+int                             thread_count = 0;       // 0 uses one per cpu core
+int                             print_stats  = 0;       // print thread stats regularly
+int                             ray_engine   = RAY_ENGINE_PACKET;
+int                             skip         = RAY_SKIP_NONE;       // how rays skip empty space
+int                             indexed      = 0;       // draw to the 8 bit framebuffer
+int                             present      = GRA_PRESENT_COPY;
+int                             present_depth = 0;      // frames queued for the present thread
+char                            *csv_file    = NULL;    // per frame stage times
+int                             split_scale  = 0;       // split the window upscale
+int                             target_fps   = TARGET_FPS;
+int                             overlay      = 0;       // show stage times on screen
+int                             step_view    = 0;       // colour columns by dda steps
+int                             overdraw     = 0;       // colour pixels by writes
+int                             coverage     = 0;       // clear around the walls only
+int                             floors       = 0;       // textured floors and ceilings
+int                             sprite_count = 0;       // billboard sprites scattered in the map
+char                            *map_name    = NULL;    // map file or WxH, NULL for the built in map
 
 //==================================================================
 //  FUNCTION PROTOTYPES
 //==================================================================
 
-// renders the scene, all drawing code goes here
-void Draw_Scene();
-
-// initialize global variables and structs
-void Init_Globals();
+// reads the command line options
+void Read_Options( int argc, char *argv[] );
 
 //==================================================================
 //  MAIN FUNCTION
@@ -99,12 +87,37 @@ void Init_Globals();
 
 int main( int argc, char *argv[] )
 {
+    // read command line options
+    Read_Options( argc, argv );
+
+    TRC_THREAD_NAME( "main" );
+
     // start SDL
     if( GRA_Create_Display( "Raycaster v4 - Textures", SCREEN_W, SCREEN_H, RES_W, RES_H ) == 0 )
     {
         UTI_Fatal_Error( "Unable to start SDL" );
     }
 
+    if( GRA_Set_Indexed_Mode( indexed ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set indexed mode" );
+    }
+
+    if( GRA_Set_Present_Mode( present ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set present mode" );
+    }
+
+    if( GRA_Set_Coverage_Clear( coverage ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set coverage clear mode" );
+    }
+
+    if( present_depth > 0 && GRA_Start_Present_Thread( present_depth ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to start present thread" );
+    }
+
     // generate palette
     if( GRA_Generate_Palette() == 0 )
     {
@@ -123,10 +136,79 @@ int main( int argc, char *argv[] )
         UTI_Fatal_Error( "Unable to load textures" );
     }
 
+    // set up the ray caster
+    if( RAY_Init( RES_W, RES_H ) == 0 || RAY_Set_Engine( ray_engine ) == 0 ||
+        RAY_Set_Skip( skip ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set up ray caster" );
+    }
+
+    // load or generate the map, the camera starts in the middle of its start cell
+    if( map_name != NULL )
+    {
+        int map_w, map_h, length = 0;
+        int made;
+
+        if( sscanf( map_name, "%dx%d%n", &map_w, &map_h, &length ) == 2 && map_name[length] == '\0' )
+        {
+            made = MAP_Generate( map_w, map_h );
+        }
+        else
+        {
+            made = MAP_Load( map_name );
+        }
+
+        if( made == 0 )
+        {
+            UTI_Fatal_Error( "Unable to set up map" );
+        }
+
+        player_pos.x = MAP_Get_Map()->start_x + 0.5f;
+        player_pos.y = MAP_Get_Map()->start_y + 0.5f;
+    }
+
+    // scatter the sprites over the empty cells
+    if( SPR_Init( RES_W, RES_H ) == 0 ||
+        ( sprite_count > 0 && SPR_Scatter( sprite_count, SPRITE_TEXTURE ) == 0 ) )
+    {
+        UTI_Fatal_Error( "Unable to set up sprites" );
+    }
+
+    // start render threads
+    if( THR_Create_Pool( thread_count ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to start render threads" );
+    }
+
+    GRA_Set_Upscale_Threads( split_scale );
+
+    GRA_Set_Target_FPS( target_fps );
+
+    // debug views
+    RAY_Set_Step_View( step_view );
+    RAY_Set_Floors( floors );
+
+    if( overdraw == 1 && GRA_Set_Overdraw_View( 1 ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to show overdraw" );
+    }
+
+    // time the stages of each frame
+    if( overlay == 1 || print_stats == 1 || csv_file != NULL )
+    {
+        PRF_Enable( 1 );
+    }
+
+    if( csv_file != NULL && PRF_Open_CSV( csv_file ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to open csv file" );
+    }
+
     // load assets
 
     // loop control
     int running = 1;
+    int frame = 0;
     while( running )
     {
         // draw code
@@ -134,25 +216,56 @@ int main( int argc, char *argv[] )
 
         GRA_Fill_Screen( DARK_BLUE );
 
-        Draw_Scene();
+        RAY_Draw_Scene( player_pos, player_angle );
+
+        SPR_Draw_Sprites();
 
         GRA_Simple_Text( "Hallo There!", 16, 16, 0xffffffff, 0xff000000, 0 );
 
+        if( overlay == 1 )
+        {
+            PRF_Draw_Overlay( 16, 32 );
+        }
+
         GRA_Refresh_Window();
 
-        player_angle += 0.01f;
+        PRF_End_Frame();
+
+        // show how evenly the last frame was shared between the render threads, and how
+        // evenly the frames were paced
+        frame++;
+        if( print_stats == 1 && frame % 200 == 0 )
+        {
+            THR_Print_Stats();
+            GRA_Print_Frame_Stats();
+            PRF_Print_Averages();
+        }
 
         running = GRA_Check_Quit();
 
-        GRA_Delay( 5 );
+        // wait for the next frame and move on by the time since the last one
+        float delta = GRA_Wait_Frame();
+
+        player_angle += TURN_SPEED * delta;
     }
 
+    THR_Destroy_Pool();
+
+    SPR_Close();
+
+    MAP_Close();
+
+    PRF_Close_CSV();
+
     GRA_Free_Palette();
 
     GRA_Free_Textures();
 
     GRA_Close();
 
+    // only written when built with make TRACE=1
+    TRC_WRITE( "trace.json" );
+
 
     return 0;
 }
@@ -163,161 +276,118 @@ int main( int argc, char *argv[] )
 //  FUNCTION BODIES
 //==================================================================
 
-//==================
-//  RAYCASTING
-//==================
-
-// renders the scene, all drawing code goes here
-void Draw_Scene()
+// reads the command line options
+void Read_Options( int argc, char *argv[] )
 {
-    // data for the current ray
-    vector2d_type               ray_pos;
-    vector2d_type               ray_dir;
-
-    // transformation matrix
-    matrix                    = IDENTITY_MATRIX;
-
-    // get players orientation
-    VEC_Matrix_Rotation( &matrix, player_angle );
-
-    // get players new position and heading
-    player_dir      = VEC_Matrix_Transform_Vector( &matrix, DIRECTION_UP );
-    player_screen   = VEC_Matrix_Transform_Vector( &matrix, DIRECTION_RIGHT );
-
-    // screen variables, screen space runs from -1.0 to 1.0, width depending on the resolution
-    int column_index;                   // index of column of pixels being drawn
-    float screen_column;                // position of pixel column in normalised screen space
+    int i;
 
-    // this loop runs through all the columns on screen, drawing walls when needed
-    for( column_index = 0; column_index < RES_W; column_index++ )
+    for( i = 1; i < argc; i++ )
     {
-        // get pixel column position in screen space
-        screen_column = 2 * column_index / (float)( RES_W ) - 1;
-
-        // ray always starts at the player position
-        ray_pos = player_pos;
-
-        // ray_dir is the vector that points from the player to the point on the screen plane
-        ray_dir = VEC_Scale_Vector( player_screen, screen_column );
-        ray_dir = VEC_Vector_Addition( player_dir, ray_dir );
-
-        // these variables are used to calculate each step of the ray to check for walls
-        float       x_dist, y_dist, x_delta, y_delta, ray_length;
-        int         step_x, step_y, map_x, map_y;
-        
-        // flags to determine where to draw a wall
-        int wallhit     = 0;
-        int walltype    = 0;
-
-        map_x = (int)player_pos.x;      // the map position of the ray, beginning with the
-        map_y = (int)player_pos.y;      // players position, used to check for walls
-
-        // calculate how much to increment the ray along each axis
-        float x_sqr = ray_dir.x * ray_dir.x;
-        float y_sqr = ray_dir.y * ray_dir.y;
-        x_delta = sqrt( 1 + (y_sqr) / (x_sqr) );
-        y_delta = sqrt( 1 + (x_sqr) / (y_sqr) );
-
-        // check ray x axis direction
-        if( ray_dir.x < 0 )
+        // -t N sets the number of render threads
+        if( strcmp( argv[i], "-t" ) == 0 && i + 1 < argc )
         {
-            step_x = -1;                // ray is moving west
-
-            // distance to nearest edge from the current position
-            x_dist = (ray_pos.x - map_x) * x_delta;
+            thread_count = atoi( argv[++i] );
         }
-        else
+        // -s prints render thread statistics
+        else if( strcmp( argv[i], "-s" ) == 0 )
         {
-            step_x = 1;                 // ray is moving east
-            x_dist = (map_x + 1 - ray_pos.x) * x_delta;
+            print_stats = 1;
         }
-
-        // same check for y axis
-        if( ray_dir.y < 0 )
+        // -e scalar|packet|fixed selects the ray casting engine
+        else if( strcmp( argv[i], "-e" ) == 0 && i + 1 < argc )
         {
-            step_y = -1;                // ray is moving north
-            y_dist = (ray_pos.y - map_y) * y_delta;
+            ray_engine = RAY_Get_Engine_By_Name( argv[++i] );
+            if( ray_engine < 0 )
+            {
+                UTI_Fatal_Error( "Unknown engine, use scalar, packet or fixed" );
+            }
         }
-        else
+        // -a none|pyramid|distance selects how rays skip empty space
+        else if( strcmp( argv[i], "-a" ) == 0 && i + 1 < argc )
+        {
+            skip = RAY_Get_Skip_By_Name( argv[++i] );
+            if( skip < 0 )
+            {
+                UTI_Fatal_Error( "Unknown skipping, use none, pyramid or distance" );
+            }
+        }
+        // -i draws palette indices and expands them to RGBA once per frame
+        else if( strcmp( argv[i], "-i" ) == 0 )
         {
-            step_y = 1;
-            y_dist = (map_y + 1 - ray_pos.y) * y_delta;
+            indexed = 1;
         }
-
-        // raycasting - the ray is extended until is hits a wall (non-zero block on the map)
-        while( wallhit == 0 && map_x < WORLD_WIDTH  && map_x > 0
-                            && map_y < WORLD_HEIGHT && map_y > 0 )
+        // -z draws straight into the render surface, without copying each frame
+        else if( strcmp( argv[i], "-z" ) == 0 )
+        {
+            present = GRA_PRESENT_DIRECT;
+        }
+        // -o shows the average time of each stage of the frame on screen
+        else if( strcmp( argv[i], "-o" ) == 0 )
+        {
+            overlay = 1;
+        }
+        // -d steps|overdraw shows the dda steps of each column or the writes to each pixel
+        else if( strcmp( argv[i], "-d" ) == 0 && i + 1 < argc )
         {
-            // increment shortest first to avoid returning wrong side of a block
-            if( x_dist < y_dist )
+            i++;
+            if( strcmp( argv[i], "steps" ) == 0 )
             {
-                x_dist      += x_delta;
-                map_x       += step_x;
-                walltype    = 0;
+                step_view = 1;
             }
-            else
+            else if( strcmp( argv[i], "overdraw" ) == 0 )
             {
-                y_dist      += y_delta;
-                map_y       += step_y;
-                walltype    = 1;
+                overdraw = 1;
             }
-
-            if( WORLD_MAP[map_y][map_x] > 0 )
+            else
             {
-                wallhit = 1;
+                UTI_Fatal_Error( "Unknown debug view, use steps or overdraw" );
             }
         }
-
-        // if a wall is hit, draw it
-        if( wallhit == 1 )
+        // -w clears only the pixels the walls don't cover instead of the whole frame
+        else if( strcmp( argv[i], "-w" ) == 0 )
         {
-            float texel_normal;             // texel column from 0.0 - 1.0
-
-            if( walltype == 0 )             // if wall is on x axis
-            {
-                // get the distance to the wall
-                ray_length = fabs( (map_x - ray_pos.x + (1 - step_x) / 2) / ray_dir.x );
-
-                // find where on the block the ray hit
-                texel_normal = ray_pos.y + ray_length * ray_dir.y;
-            }
-            else
+            coverage = 1;
+        }
+        // -g draws textured floors and ceilings
+        else if( strcmp( argv[i], "-g" ) == 0 )
+        {
+            floors = 1;
+        }
+        // -m file|WxH loads a map file or generates a map of WxH cells
+        else if( strcmp( argv[i], "-m" ) == 0 && i + 1 < argc )
+        {
+            map_name = argv[++i];
+        }
+        // -b N scatters N billboard sprites over the map
+        else if( strcmp( argv[i], "-b" ) == 0 && i + 1 < argc )
+        {
+            sprite_count = atoi( argv[++i] );
+            if( sprite_count < 0 || sprite_count > SPR_MAX_SPRITES )
             {
-                ray_length = fabs( (map_y - ray_pos.y + (1 - step_y) / 2) / ray_dir.y );
-                texel_normal = ray_pos.x + ray_length * ray_dir.x;
+                UTI_Fatal_Error( "Sprite count must be from 0 to 4096" );
             }
-
-            // the fractional part of texel_normal is the normalised column on the texture
-            texel_normal -= floor(  texel_normal );
-
-            // the height of the wall on screen depends on its distance from the player
-            // (ray_length)
-
-            int column_height       = abs( (int)( RES_H / ray_length ) );
-
-            // get height above horizon
-            int column_start        = -column_height / 2 + RES_H / 2;
-            // get height below horizon
-            int column_end          =  column_height / 2 + RES_H / 2;
-
-            // the texture index, -1 as map walls start at 1, not 0
-            int tex = WORLD_MAP[map_y][map_x] - 1;
-
-            GRA_Draw_Vertical_Texture_Line( texel_normal, column_index, column_start, 
-                                            column_end, tex );
         }
-    }            
-
-    return;
-}
-
-
-
-// initialize global variables and structs
-void Init_Globals()
-{
-    player_dir          = DIRECTION_UP;
-    player_screen       = DIRECTION_RIGHT;
+        // -c file writes the time of each stage of every frame to a csv file
+        else if( strcmp( argv[i], "-c" ) == 0 && i + 1 < argc )
+        {
+            csv_file = argv[++i];
+        }
+        // -p N presents frames on their own thread with up to N frames queued
+        else if( strcmp( argv[i], "-p" ) == 0 && i + 1 < argc )
+        {
+            present_depth = atoi( argv[++i] );
+        }
+        // -f N paces frames to N per second, 0 runs as fast as possible
+        else if( strcmp( argv[i], "-f" ) == 0 && i + 1 < argc )
+        {
+            target_fps = atoi( argv[++i] );
+        }
+        // -u splits stretching each frame to the window across the render threads
+        else if( strcmp( argv[i], "-u" ) == 0 )
+        {
+            split_scale = 1;
+        }
+    }
 
     return;
 }
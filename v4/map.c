@@ -0,0 +1,657 @@
+/*
+    map.c
+    the world map, loaded into three heap allocated byte layers of any size up to
+    MAP_MAX_SIZE cells across and down
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "trace.h"
+#include "map.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+#define DEFAULT_WIDTH           16
+#define DEFAULT_HEIGHT          16
+
+// the original world, walls are textures + 1
+const map_cell_type DEFAULT_WALLS[DEFAULT_HEIGHT][DEFAULT_WIDTH] =
+{
+    { 1, 1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    { 1, 0, 1, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 1 },
+    { 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    { 4, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    { 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 },
+    { 1, 1, 1, 1, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 }
+};
+
+// cell the player starts in
+#define DEFAULT_START_X         10
+#define DEFAULT_START_Y         10
+
+// generated maps are a grid of rooms this many cells across, walls included
+#define ROOM_SIZE               16
+
+// textures of generated maps
+#define WALL_BRICK              1
+#define WALL_WOOD               2
+#define TEXTURE_BRICK           0
+#define TEXTURE_WOOD            1
+
+static map_type                 map                 = { 0, 0, 0, 0, NULL, NULL, NULL, { 0 }, { NULL }, NULL };
+static uint32_t                 generate_seed       = 1;
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// returns the tiles down a level of the occupancy pyramid, which covers a row more than
+// the map
+int Tiles_Down( int level )
+{
+    int units = map.height + 1;
+    int i;
+
+    for( i = 0; i <= level; i++ )
+    {
+        units = ( units + MAP_TILE_MASK ) >> MAP_TILE_SHIFT;
+    }
+
+    return units;
+}
+
+
+// frees the layers and allocates new ones for a map of width x height cells, all empty
+void Allocate_Layers( int width, int height )
+{
+    size_t cells = (size_t)width * height;
+
+    MAP_Close();
+
+    map.width       = width;
+    map.height      = height;
+    map.start_x     = 0;
+    map.start_y     = 0;
+    map.walls       = UTI_EC_Malloc( cells + MAP_PADDING );
+    map.floors      = UTI_EC_Malloc( cells + MAP_PADDING );
+    map.ceilings    = UTI_EC_Malloc( cells + MAP_PADDING );
+
+    memset( map.walls, 0, cells + MAP_PADDING );
+    memset( map.floors, 0, cells + MAP_PADDING );
+    memset( map.ceilings, 0, cells + MAP_PADDING );
+
+    // each level has a bit per tile of the level below, and a column more than the map
+    int units = width + 1;
+    int level;
+
+    for( level = 0; level < MAP_LEVELS; level++ )
+    {
+        map.tiles_across[level] = ( units + MAP_TILE_MASK ) >> MAP_TILE_SHIFT;
+        map.occupancy[level]    = UTI_EC_Malloc( sizeof( uint64_t ) * map.tiles_across[level] *
+                                                 Tiles_Down( level ) );
+        units = map.tiles_across[level];
+    }
+
+    // a byte per bit of the bitmap
+    map.distance = UTI_EC_Malloc( (size_t)map.tiles_across[0] * Tiles_Down( 0 ) <<
+                                  ( 2 * MAP_TILE_SHIFT ) );
+    memset( map.distance, 0, (size_t)map.tiles_across[0] * Tiles_Down( 0 ) << ( 2 * MAP_TILE_SHIFT ) );
+
+    return;
+}
+
+
+// sets the bits of the occupancy pyramid from the walls layer
+void Build_Occupancy()
+{
+    int level, x, y;
+
+    for( level = 0; level < MAP_LEVELS; level++ )
+    {
+        memset( map.occupancy[level], 0, sizeof( uint64_t ) * map.tiles_across[level] *
+                                         Tiles_Down( level ) );
+    }
+
+    for( y = 0; y < map.height; y++ )
+    {
+        uint64_t *tiles = map.occupancy[0] + ( y >> MAP_TILE_SHIFT ) * map.tiles_across[0];
+        int row = ( y & MAP_TILE_MASK ) << MAP_TILE_SHIFT;
+
+        for( x = 0; x < map.width; x++ )
+        {
+            if( map.walls[y * map.width + x] != 0 )
+            {
+                tiles[x >> MAP_TILE_SHIFT] |= (uint64_t)1 << ( row | ( x & MAP_TILE_MASK ) );
+            }
+        }
+    }
+
+    // every tile with a wall in it sets its bit in the level above
+    for( level = 1; level < MAP_LEVELS; level++ )
+    {
+        int below_down = Tiles_Down( level - 1 );
+
+        for( y = 0; y < below_down; y++ )
+        {
+            for( x = 0; x < map.tiles_across[level - 1]; x++ )
+            {
+                if( map.occupancy[level - 1][y * map.tiles_across[level - 1] + x] != 0 )
+                {
+                    MAP_Tile( &map, level, x, y ) |= (uint64_t)1 << MAP_Tile_Bit( x, y );
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+
+// sets the bit of cell (x, y) in the occupancy bitmap from the walls layer, and its bit in
+// each level above from the tile below
+void Update_Occupancy( int x, int y )
+{
+    uint64_t    *tile   = &MAP_Tile( &map, 0, x, y );
+    uint64_t    bit     = (uint64_t)1 << MAP_Tile_Bit( x, y );
+    int         level;
+
+    *tile = ( map.walls[y * map.width + x] != 0 ) ? ( *tile | bit ) : ( *tile & ~bit );
+
+    for( level = 1; level < MAP_LEVELS; level++ )
+    {
+        uint64_t below = *tile;
+
+        x       >>= MAP_TILE_SHIFT;
+        y       >>= MAP_TILE_SHIFT;
+        tile    = &MAP_Tile( &map, level, x, y );
+        bit     = (uint64_t)1 << MAP_Tile_Bit( x, y );
+
+        *tile = ( below != 0 ) ? ( *tile | bit ) : ( *tile & ~bit );
+    }
+
+    return;
+}
+
+
+// returns the cells of row y of the distance layer, cell x of the row is Row_Cell( row, x )
+uint8_t *Distance_Row( int y )
+{
+    return &MAP_Distance( &map, 0, y );
+}
+
+#define Row_Cell( row, x )      ( (row)[( ( (x) >> MAP_TILE_SHIFT ) << ( 2 * MAP_TILE_SHIFT ) ) | \
+                                        ( (x) & MAP_TILE_MASK )] )
+
+
+// returns distance, or the distance of a cell next to it plus 1 if that is nearer
+int Nearer( int distance, int next )
+{
+    return ( next + 1 < distance ) ? next + 1 : distance;
+}
+
+
+// works out the distances of the cells from (left, top) up to (right, bottom) again, from
+// the walls among them and the distances of the cells around them, which must be right.
+// a distance is the smallest of the distances of the 8 cells around it plus 1, which a
+// pass down the map and a pass back up work out exactly, and the cells around only ever
+// keep their distance
+void Update_Distance( int left, int top, int right, int bottom )
+{
+    int x, y;
+
+    for( y = top; y < bottom; y++ )
+    {
+        uint8_t             *row    = Distance_Row( y );
+        const map_cell_type *walls  = map.walls + y * map.width;
+
+        for( x = left; x < right; x++ )
+        {
+            Row_Cell( row, x ) = ( walls[x] != 0 ) ? 0 : MAP_DISTANCE_MAX;
+        }
+    }
+
+    // the cells around the block are worked out too, but keep their distances
+    if( left > 0 )                  left--;
+    if( top > 0 )                   top--;
+    if( right < map.width )         right++;
+    if( bottom < map.height )       bottom++;
+
+    // down the map each cell takes the distances of the cells above it and to its left
+    for( y = top; y < bottom; y++ )
+    {
+        uint8_t *row    = Distance_Row( y );
+        uint8_t *above  = ( y > top ) ? Distance_Row( y - 1 ) : NULL;
+
+        for( x = left; x < right; x++ )
+        {
+            int distance = Row_Cell( row, x );
+
+            if( x > left )                          distance = Nearer( distance, Row_Cell( row, x - 1 ) );
+            if( above != NULL )
+            {
+                                                    distance = Nearer( distance, Row_Cell( above, x ) );
+                if( x > left )                      distance = Nearer( distance, Row_Cell( above, x - 1 ) );
+                if( x < right - 1 )                 distance = Nearer( distance, Row_Cell( above, x + 1 ) );
+            }
+
+            Row_Cell( row, x ) = distance;
+        }
+    }
+
+    // back up the map each cell takes the distances of the cells below it and to its right
+    for( y = bottom - 1; y >= top; y-- )
+    {
+        uint8_t *row    = Distance_Row( y );
+        uint8_t *below  = ( y < bottom - 1 ) ? Distance_Row( y + 1 ) : NULL;
+
+        for( x = right - 1; x >= left; x-- )
+        {
+            int distance = Row_Cell( row, x );
+
+            if( x < right - 1 )                     distance = Nearer( distance, Row_Cell( row, x + 1 ) );
+            if( below != NULL )
+            {
+                                                    distance = Nearer( distance, Row_Cell( below, x ) );
+                if( x < right - 1 )                 distance = Nearer( distance, Row_Cell( below, x + 1 ) );
+                if( x > left )                      distance = Nearer( distance, Row_Cell( below, x - 1 ) );
+            }
+
+            Row_Cell( row, x ) = distance;
+        }
+    }
+
+    return;
+}
+
+
+// returns a random number from 0 up to (but not including) range, from a fixed sequence
+int Random_Int( int range )
+{
+    generate_seed = generate_seed * 1103515245 + 12345;
+
+    return (int)( ( generate_seed >> 8 ) % range );
+}
+
+
+// returns 1 if every cell of a layer is below limit
+int Check_Layer( const map_cell_type *layer, size_t cells, int limit )
+{
+    size_t i;
+
+    for( i = 0; i < cells; i++ )
+    {
+        if( layer[i] >= limit )
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// replaces the map with the built in 16x16 map
+int MAP_Build_Default()
+{
+    int x, y;
+
+    Allocate_Layers( DEFAULT_WIDTH, DEFAULT_HEIGHT );
+
+    map.start_x = DEFAULT_START_X;
+    map.start_y = DEFAULT_START_Y;
+
+    for( y = 0; y < DEFAULT_HEIGHT; y++ )
+    {
+        for( x = 0; x < DEFAULT_WIDTH; x++ )
+        {
+            int cell = y * DEFAULT_WIDTH + x;
+
+            // the floor is wood with a square of bricks in the middle, the ceiling is
+            // bricks with a strip of wood along the top of the map
+            map.walls[cell]     = DEFAULT_WALLS[y][x];
+            map.floors[cell]    = ( x >= 6 && x <= 9 && y >= 6 && y <= 9 ) ? TEXTURE_BRICK : TEXTURE_WOOD;
+            map.ceilings[cell]  = ( x >= 1 && x <= 14 && y >= 1 && y <= 2 ) ? TEXTURE_WOOD : TEXTURE_BRICK;
+        }
+    }
+
+    Build_Occupancy();
+    Update_Distance( 0, 0, map.width, map.height );
+
+    return 1;
+}
+
+
+// replaces the map with a generated one of width x height cells, a grid of rooms with
+// doorways between them and pillars in some of them, the same map for the same size
+int MAP_Generate( int width, int height )
+{
+    if( width < 3 || height < 3 || width > MAP_MAX_SIZE || height > MAP_MAX_SIZE )
+    {
+        UTI_Print_Error( "Map size must be from 3 to 32768 cells" );
+        return 0;
+    }
+
+    TRC_BEGIN( "generate map" );
+
+    Allocate_Layers( width, height );
+    generate_seed = 1;
+
+    int x, y;
+
+    for( y = 0; y < height; y++ )
+    {
+        for( x = 0; x < width; x++ )
+        {
+            int cell = y * width + x;
+
+            // the outside of the map and the edges of the rooms are walls
+            if( x == 0 || y == 0 || x == width - 1 || y == height - 1 ||
+                x % ROOM_SIZE == 0 || y % ROOM_SIZE == 0 )
+            {
+                map.walls[cell] = WALL_BRICK;
+            }
+
+            map.floors[cell]    = ( ( x / 4 + y / 4 ) % 2 == 0 ) ? TEXTURE_WOOD : TEXTURE_BRICK;
+            map.ceilings[cell]  = TEXTURE_BRICK;
+        }
+    }
+
+    // a doorway two cells wide in the west and north wall of every room, at a random place
+    // along it so the doorways don't line up into long sight lines
+    int room_x, room_y;
+
+    for( room_y = 0; room_y < height; room_y += ROOM_SIZE )
+    {
+        for( room_x = 0; room_x < width; room_x += ROOM_SIZE )
+        {
+            int door = 2 + Random_Int( ROOM_SIZE - 5 );
+
+            if( room_x > 0 && room_y + door + 1 < height - 1 )
+            {
+                map.walls[( room_y + door ) * width + room_x]       = 0;
+                map.walls[( room_y + door + 1 ) * width + room_x]   = 0;
+            }
+
+            door = 2 + Random_Int( ROOM_SIZE - 5 );
+
+            if( room_y > 0 && room_x + door + 1 < width - 1 )
+            {
+                map.walls[room_y * width + room_x + door]       = 0;
+                map.walls[room_y * width + room_x + door + 1]   = 0;
+            }
+
+            // a wooden pillar in some rooms, kept clear of the middle
+            if( Random_Int( 2 ) == 0 )
+            {
+                int pillar_x = room_x + 2 + Random_Int( 4 );
+                int pillar_y = room_y + 2 + Random_Int( 4 );
+
+                if( pillar_x + 1 < width - 1 && pillar_y + 1 < height - 1 )
+                {
+                    map.walls[pillar_y * width + pillar_x]              = WALL_WOOD;
+                    map.walls[pillar_y * width + pillar_x + 1]          = WALL_WOOD;
+                    map.walls[( pillar_y + 1 ) * width + pillar_x]      = WALL_WOOD;
+                    map.walls[( pillar_y + 1 ) * width + pillar_x + 1]  = WALL_WOOD;
+                }
+            }
+        }
+    }
+
+    // start in the middle of the room nearest the middle of the map
+    map.start_x = ( width / 2 / ROOM_SIZE ) * ROOM_SIZE + ROOM_SIZE / 2;
+    map.start_y = ( height / 2 / ROOM_SIZE ) * ROOM_SIZE + ROOM_SIZE / 2;
+
+    if( map.start_x >= width - 1 )      map.start_x = width / 2;
+    if( map.start_y >= height - 1 )     map.start_y = height / 2;
+
+    map.walls[map.start_y * width + map.start_x] = 0;
+
+    Build_Occupancy();
+    Update_Distance( 0, 0, map.width, map.height );
+
+    TRC_END( "generate map" );
+
+    return 1;
+}
+
+
+// replaces the map with one loaded from a "MAP8" file, the textures must be loaded first
+// so the cells can be checked against them. if the file can't be used the map is freed and
+// the built in map is used
+int MAP_Load( char *filename )
+{
+    TRC_BEGIN( "load map" );
+
+    FILE *file = fopen( filename, "rb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to open map file" );
+        TRC_END( "load map" );
+        return 0;
+    }
+
+    char check[5] = { 0 };
+    uint32_t header[4];
+
+    if( fread( check, 4, 1, file ) != 1 || strcmp( check, "MAP8" ) != 0 ||
+        fread( header, sizeof( uint32_t ), 4, file ) != 4 )
+    {
+        UTI_Print_Error( "Not a valid map file" );
+        fclose( file );
+        TRC_END( "load map" );
+        return 0;
+    }
+
+    if( header[0] < 3 || header[1] < 3 || header[0] > MAP_MAX_SIZE || header[1] > MAP_MAX_SIZE ||
+        header[2] >= header[0] || header[3] >= header[1] )
+    {
+        UTI_Print_Error( "Map file has a bad size or start" );
+        fclose( file );
+        TRC_END( "load map" );
+        return 0;
+    }
+
+    Allocate_Layers( header[0], header[1] );
+    map.start_x = header[2];
+    map.start_y = header[3];
+
+    size_t cells = (size_t)map.width * map.height;
+
+    if( fread( map.walls, cells, 1, file ) != 1 || fread( map.floors, cells, 1, file ) != 1 ||
+        fread( map.ceilings, cells, 1, file ) != 1 )
+    {
+        UTI_Print_Error( "Map file is too short" );
+        fclose( file );
+        MAP_Close();
+        TRC_END( "load map" );
+        return 0;
+    }
+
+    fclose( file );
+
+    // every cell must show a loaded texture
+    int textures = GRA_Get_Texture_Count();
+
+    if( Check_Layer( map.walls, cells, textures + 1 ) == 0 ||
+        Check_Layer( map.floors, cells, textures ) == 0 ||
+        Check_Layer( map.ceilings, cells, textures ) == 0 )
+    {
+        UTI_Print_Error( "Map file uses textures that aren't loaded" );
+        MAP_Close();
+        TRC_END( "load map" );
+        return 0;
+    }
+
+    if( map.walls[map.start_y * map.width + map.start_x] != 0 )
+    {
+        UTI_Print_Error( "Map file starts inside a wall" );
+        MAP_Close();
+        TRC_END( "load map" );
+        return 0;
+    }
+
+    Build_Occupancy();
+    Update_Distance( 0, 0, map.width, map.height );
+
+    printf( "map read, %dx%d\n", map.width, map.height );
+
+    TRC_END( "load map" );
+
+    return 1;
+}
+
+
+// saves the map as a "MAP8" file
+int MAP_Save( char *filename )
+{
+    const map_type *world = MAP_Get_Map();
+
+    FILE *file = fopen( filename, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create map file" );
+        return 0;
+    }
+
+    uint32_t header[4] = { world->width, world->height, world->start_x, world->start_y };
+    size_t cells = (size_t)world->width * world->height;
+
+    fwrite( "MAP8", 4, 1, file );
+    fwrite( header, sizeof( uint32_t ), 4, file );
+    fwrite( world->walls, cells, 1, file );
+    fwrite( world->floors, cells, 1, file );
+    fwrite( world->ceilings, cells, 1, file );
+
+    if( fclose( file ) != 0 )
+    {
+        UTI_Print_Error( "Unable to write map file" );
+        return 0;
+    }
+
+    return 1;
+}
+
+
+// frees the map
+void MAP_Close()
+{
+    UTI_EC_Free( map.walls );
+    UTI_EC_Free( map.floors );
+    UTI_EC_Free( map.ceilings );
+
+    map.walls       = NULL;
+    map.floors      = NULL;
+    map.ceilings    = NULL;
+
+    int level;
+    for( level = 0; level < MAP_LEVELS; level++ )
+    {
+        UTI_EC_Free( map.occupancy[level] );
+        map.occupancy[level] = NULL;
+    }
+
+    UTI_EC_Free( map.distance );
+    map.distance    = NULL;
+
+    map.width       = 0;
+    map.height      = 0;
+
+    return;
+}
+
+
+// returns the map, built in if no other has been set up
+const map_type *MAP_Get_Map()
+{
+    if( map.walls == NULL )
+    {
+        MAP_Build_Default();
+    }
+
+    return &map;
+}
+
+
+// returns the wall in a cell, 0 for an empty cell, cells off the map are walls
+int MAP_Get_Wall( int x, int y )
+{
+    const map_type *world = MAP_Get_Map();
+
+    if( x < 0 || x >= world->width || y < 0 || y >= world->height )
+    {
+        return 1;
+    }
+
+    return world->walls[y * world->width + x];
+}
+
+
+// sets the wall in a cell on the map, 0 for an empty cell, otherwise the texture + 1, and
+// updates the occupancy pyramid and distances around it
+int MAP_Set_Wall( int x, int y, int wall )
+{
+    MAP_Get_Map();
+
+    if( x < 0 || x >= map.width || y < 0 || y >= map.height )
+    {
+        UTI_Print_Error( "Cell is off the map" );
+        return 0;
+    }
+
+    if( wall < 0 || wall > GRA_Get_Texture_Count() )
+    {
+        UTI_Print_Error( "Wall uses a texture that isn't loaded" );
+        return 0;
+    }
+
+    map.walls[y * map.width + x] = wall;
+
+    Update_Occupancy( x, y );
+
+    // only cells nearer the cell than MAP_DISTANCE_MAX can have it as their nearest wall
+    int reach   = MAP_DISTANCE_MAX - 1;
+    int left    = ( x - reach > 0 ) ? x - reach : 0;
+    int top     = ( y - reach > 0 ) ? y - reach : 0;
+    int right   = ( x + reach + 1 < map.width ) ? x + reach + 1 : map.width;
+    int bottom  = ( y + reach + 1 < map.height ) ? y + reach + 1 : map.height;
+
+    Update_Distance( left, top, right, bottom );
+
+    return 1;
+}
+
+
+//===========================
+//  TESTING
+//===========================
+
+// works out the distance of every cell of the map again from the walls
+void MAP_Rebuild_Distance()
+{
+    MAP_Get_Map();
+
+    Update_Distance( 0, 0, map.width, map.height );
+
+    return;
+}
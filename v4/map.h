@@ -0,0 +1,164 @@
+/*
+    map.h
+    the world map, a grid of cells held on the heap in three byte layers, row by row:
+
+        walls       - 0 for an empty cell, otherwise the texture of the wall + 1
+        floors      - the texture of the floor of each cell
+        ceilings    - the texture of the ceiling of each cell
+
+    maps are built in (the original 16x16 map), generated, or loaded from "MAP8" files:
+
+        "MAP8", uint32 width, uint32 height, uint32 start x, uint32 start y,
+        then width * height bytes of each of the walls, floors and ceilings layers
+
+    alongside the walls a bitmap holds a bit per cell, set for walls, which is all the rays
+    read until they hit something. it is stored in 8x8 tiles of cells, a uint64_t each, so
+    a ray stepping across or down the map stays in the same few cache lines, where a step
+    down the walls layer is a whole row of the map away
+
+    above the bitmap are coarser levels of the same tiles, a bit per 8x8, 64x64 and 512x512
+    cells set if any of them is a wall, so rays can cross empty parts of the map a block at
+    a time. the 2x2 and 4x4 blocks in between are read from the bits of a single tile. each
+    level covers a column and row more than the map, so a ray stepping just off the edge of
+    the map still reads inside it
+
+    a byte per cell also holds the chebyshev distance from the cell to the nearest wall, up
+    to MAP_DISTANCE_MAX, so the cells fewer than that many cells away from it across, down
+    or diagonally are all empty. it is kept in the same 8x8 tiles as the bitmap, a 64 byte
+    tile to a cache line. when a wall is set or cleared only the cells within
+    MAP_DISTANCE_MAX of it are worked out again
+
+    nothing is done per frame for the size of the map, the renderer only reads the cells
+    its rays pass through. the border of a map doesn't have to be walls, rays leave the map
+    through any gaps in it and draw nothing
+*/
+
+#ifndef __map_h__
+#define __map_h__
+
+#include <stdint.h>
+
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+// largest width or height of a map, so every cell index fits in an int
+#define MAP_MAX_SIZE                32768
+
+// cells across and down each tile of the occupancy bitmap, as a shift
+#define MAP_TILE_SHIFT              3
+#define MAP_TILE_MASK               ( ( 1 << MAP_TILE_SHIFT ) - 1 )
+
+// levels of the occupancy pyramid, level 0 is the bitmap of cells
+#define MAP_LEVELS                  4
+
+// the tile of a level holding (x, y), in units of the level, and the bit of (x, y) in it
+#define MAP_Tile( map, level, x, y )    ( (map)->occupancy[level][( (y) >> MAP_TILE_SHIFT ) * \
+                                                              (map)->tiles_across[level] + \
+                                                              ( (x) >> MAP_TILE_SHIFT )] )
+#define MAP_Tile_Bit( x, y )            ( ( ( (y) & MAP_TILE_MASK ) << MAP_TILE_SHIFT ) | \
+                                          ( (x) & MAP_TILE_MASK ) )
+
+// returns 1 if cell (x, y) of map is a wall, from the occupancy bitmap, (x, y) must be on
+// the map or one cell past its right or bottom edge, where the bits are always clear
+#define MAP_Is_Solid( map, x, y )       (int)( ( MAP_Tile( map, 0, x, y ) >> MAP_Tile_Bit( x, y ) ) & 1 )
+
+// largest distance kept for a cell, cells further from every wall keep this distance
+#define MAP_DISTANCE_MAX            64
+
+// the distance from cell (x, y) to the nearest wall, (x, y) must be on the map or just off
+// its right or bottom edge
+#define MAP_Distance( map, x, y )       ( (map)->distance[( ( ( (y) >> MAP_TILE_SHIFT ) * \
+                                                              (map)->tiles_across[0] + \
+                                                              ( (x) >> MAP_TILE_SHIFT ) ) << \
+                                                            ( 2 * MAP_TILE_SHIFT ) ) | \
+                                                          MAP_Tile_Bit( x, y )] )
+
+// bytes that can be read past the end of every layer, so the avx2 code can gather the 4
+// bytes starting at any cell
+#define MAP_PADDING                 3
+
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+// a cell in one of the layers
+typedef uint8_t map_cell_type;
+
+struct map_s                    {
+                                    int             width;
+                                    int             height;
+                                    int             start_x;    // cell the player starts in
+                                    int             start_y;
+
+                                    map_cell_type   *walls;
+                                    map_cell_type   *floors;
+                                    map_cell_type   *ceilings;
+
+                                    // a bit per cell set for walls, then a bit per 8x8
+                                    // tile of the level below set if any of its bits are,
+                                    // each level in 8x8 tiles row by row
+                                    int             tiles_across[MAP_LEVELS];
+                                    uint64_t        *occupancy[MAP_LEVELS];
+
+                                    // a byte per cell, its distance to the nearest wall,
+                                    // in 8x8 tiles of cells row by row
+                                    uint8_t         *distance;
+                                };
+typedef struct map_s map_type;
+
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// replaces the map with the built in 16x16 map
+int MAP_Build_Default();
+
+
+// replaces the map with a generated one of width x height cells, a grid of rooms with
+// doorways between them and pillars in some of them, the same map for the same size
+int MAP_Generate( int width, int height );
+
+
+// replaces the map with one loaded from a "MAP8" file, the textures must be loaded first
+// so the cells can be checked against them. if the file can't be used the map is freed and
+// the built in map is used
+int MAP_Load( char *filename );
+
+
+// saves the map as a "MAP8" file
+int MAP_Save( char *filename );
+
+
+// frees the map
+void MAP_Close();
+
+
+// returns the map, built in if no other has been set up
+const map_type *MAP_Get_Map();
+
+
+// returns the wall in a cell, 0 for an empty cell, cells off the map are walls
+int MAP_Get_Wall( int x, int y );
+
+
+// sets the wall in a cell on the map, 0 for an empty cell, otherwise the texture + 1, and
+// updates the occupancy pyramid and distances around it
+int MAP_Set_Wall( int x, int y, int wall );
+
+
+//===========================
+//  TESTING
+//===========================
+
+// works out the distance of every cell of the map again from the walls, as loading a map
+// does. lets the tests check the updates of MAP_Set_Wall() against it
+void MAP_Rebuild_Distance();
+
+
+#endif  // __map_h__
@@ -0,0 +1,255 @@
+/*
+    profile.c
+    per stage frame profiler, stage times are collected in ticks of the performance counter
+    during a frame and converted to milliseconds when the frame ends
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "profile.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+#define OVERLAY_LINE            10          // pixels between overlay lines
+
+const char *STAGE_NAMES[PRF_STAGE_COUNT] =
+{
+    "scene",
+    "cast",
+    "draw",
+    "floors",
+    "sprites",
+    "buffer",
+    "scale",
+    "update",
+};
+
+static int                  prf_enabled         = 0;
+
+// ticks spent in each stage of the current frame, the render threads add to these under
+// the lock
+static uint64_t             prf_ticks[PRF_STAGE_COUNT];
+static SDL_SpinLock         prf_lock            = 0;
+
+static uint64_t             prf_frame_start     = 0;
+static int                  prf_frame           = 0;        // frames ended
+
+// milliseconds spent in each stage over the last PRF_HISTORY frames
+static double               prf_history[PRF_HISTORY][PRF_STAGE_COUNT];
+static double               prf_frame_ms[PRF_HISTORY];
+
+static FILE                 *prf_csv            = NULL;
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// starts (1) or stops (0) timing stages
+void PRF_Enable( int enabled )
+{
+    prf_enabled = ( enabled == 1 ) ? 1 : 0;
+
+    memset( prf_ticks, 0, sizeof( prf_ticks ) );
+    prf_frame_start = SDL_GetPerformanceCounter();
+
+    return;
+}
+
+
+// returns 1 if stages are being timed
+int PRF_Is_Enabled()
+{
+    return prf_enabled;
+}
+
+
+// returns the current time in performance counter ticks, for PRF_Stop()
+uint64_t PRF_Start()
+{
+    return ( prf_enabled == 1 ) ? SDL_GetPerformanceCounter() : 0;
+}
+
+
+// adds the time since start to a stage of the current frame
+void PRF_Stop( int stage, uint64_t start )
+{
+    if( prf_enabled == 0 )
+    {
+        return;
+    }
+
+    PRF_Add_Time( stage, SDL_GetPerformanceCounter() - start );
+
+    return;
+}
+
+
+// adds ticks to a stage of the current frame, safe to call from any thread
+void PRF_Add_Time( int stage, uint64_t ticks )
+{
+    if( prf_enabled == 0 || stage < 0 || stage >= PRF_STAGE_COUNT )
+    {
+        return;
+    }
+
+    SDL_AtomicLock( &prf_lock );
+    prf_ticks[stage] += ticks;
+    SDL_AtomicUnlock( &prf_lock );
+
+    return;
+}
+
+
+// files the stage times of the frame in the history and the csv file, and starts the next
+// frame
+void PRF_End_Frame()
+{
+    if( prf_enabled == 0 )
+    {
+        return;
+    }
+
+    double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    uint64_t now = SDL_GetPerformanceCounter();
+    int slot = prf_frame % PRF_HISTORY;
+    int i;
+
+    SDL_AtomicLock( &prf_lock );
+    for( i = 0; i < PRF_STAGE_COUNT; i++ )
+    {
+        prf_history[slot][i] = prf_ticks[i] * ms_per_tick;
+        prf_ticks[i] = 0;
+    }
+    SDL_AtomicUnlock( &prf_lock );
+
+    prf_frame_ms[slot] = ( now - prf_frame_start ) * ms_per_tick;
+    prf_frame_start = now;
+
+    if( prf_csv != NULL )
+    {
+        fprintf( prf_csv, "%d", prf_frame );
+        for( i = 0; i < PRF_STAGE_COUNT; i++ )
+        {
+            fprintf( prf_csv, ",%.4f", prf_history[slot][i] );
+        }
+        fprintf( prf_csv, ",%.4f\n", prf_frame_ms[slot] );
+    }
+
+    prf_frame++;
+
+    return;
+}
+
+
+// returns the average time of a stage over the history in milliseconds, PRF_STAGE_COUNT
+// gives the average time of a whole frame
+double PRF_Get_Average( int stage )
+{
+    int frames = ( prf_frame < PRF_HISTORY ) ? prf_frame : PRF_HISTORY;
+    double total = 0.0;
+    int i;
+
+    if( frames == 0 || stage < 0 || stage > PRF_STAGE_COUNT )
+    {
+        return 0.0;
+    }
+
+    for( i = 0; i < frames; i++ )
+    {
+        total += ( stage == PRF_STAGE_COUNT ) ? prf_frame_ms[i] : prf_history[i][stage];
+    }
+
+    return total / frames;
+}
+
+
+// returns the name of a stage, "frame" for PRF_STAGE_COUNT
+char *PRF_Get_Stage_Name( int stage )
+{
+    if( stage < 0 || stage >= PRF_STAGE_COUNT )
+    {
+        return "frame";
+    }
+
+    return (char *)STAGE_NAMES[stage];
+}
+
+
+// draws the average time of every stage at (x, y) with GRA_Simple_Text(), needs a font
+void PRF_Draw_Overlay( int x, int y )
+{
+    char line[32];
+    int i;
+
+    for( i = 0; i <= PRF_STAGE_COUNT; i++ )
+    {
+        sprintf( line, "%-7s%7.3f ms", PRF_Get_Stage_Name( i ), PRF_Get_Average( i ) );
+        GRA_Simple_Text( line, x, y + i * OVERLAY_LINE, 0xffffffff, 0xff000000, 1 );
+    }
+
+    return;
+}
+
+
+// prints the average time of every stage
+void PRF_Print_Averages()
+{
+    int i;
+
+    printf( "stages (average of the last %d frames, cast, draw and floors summed over "
+            "threads):\n",
+            ( prf_frame < PRF_HISTORY ) ? prf_frame : PRF_HISTORY );
+
+    for( i = 0; i <= PRF_STAGE_COUNT; i++ )
+    {
+        printf( "    %-7s %8.3f ms\n", PRF_Get_Stage_Name( i ), PRF_Get_Average( i ) );
+    }
+
+    return;
+}
+
+
+// starts writing a row of stage times for every frame to a csv file
+int PRF_Open_CSV( char *filename )
+{
+    PRF_Close_CSV();
+
+    prf_csv = fopen( filename, "w" );
+    if( prf_csv == NULL )
+    {
+        UTI_Print_Error( "Unable to open profile csv file" );
+        return 0;
+    }
+
+    int i;
+    fprintf( prf_csv, "frame" );
+    for( i = 0; i < PRF_STAGE_COUNT; i++ )
+    {
+        fprintf( prf_csv, ",%s_ms", STAGE_NAMES[i] );
+    }
+    fprintf( prf_csv, ",frame_ms\n" );
+
+    return 1;
+}
+
+
+// closes the csv file
+void PRF_Close_CSV()
+{
+    if( prf_csv != NULL )
+    {
+        fclose( prf_csv );
+        prf_csv = NULL;
+    }
+
+    return;
+}
@@ -0,0 +1,97 @@
+/*
+    profile.h
+    per stage frame profiler. each stage of a frame is timed with PRF_Start() and
+    PRF_Stop(), or has time added to it with PRF_Add_Time() from the render threads, and
+    PRF_End_Frame() files the stage times of the frame in a ring of the last PRF_HISTORY
+    frames. the averages over the ring can be drawn over the frame with PRF_Draw_Overlay()
+    and every frame can be written as a row of a csv file for looking at later.
+
+    the scene stage is wall clock time, the cast and draw stages are the time spent in them
+    added up over all the render threads. stages run by the present thread are counted in
+    whichever frame is being drawn when they finish
+
+    nothing is timed until PRF_Enable() is called
+*/
+
+#ifndef __profile_h__
+#define __profile_h__
+
+#include <stdint.h>
+
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+// stages of a frame
+#define PRF_STAGE_SCENE             0       // RAY_Draw_Scene(), all threads
+#define PRF_STAGE_CAST              1       // casting rays, summed over threads
+#define PRF_STAGE_DRAW              2       // drawing texture columns, summed over threads
+#define PRF_STAGE_FLOORS            3       // drawing floor and ceiling rows, summed over threads
+#define PRF_STAGE_SPRITES           4       // SPR_Draw_Sprites(), all threads
+#define PRF_STAGE_BUFFER            5       // draw buffer to render surface
+#define PRF_STAGE_SCALE             6       // render surface to window surface
+#define PRF_STAGE_UPDATE            7       // SDL_UpdateWindowSurface()
+#define PRF_STAGE_COUNT             8
+
+// frames kept for the overlay averages
+#define PRF_HISTORY                 60
+
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// starts (1) or stops (0) timing stages
+void PRF_Enable( int enabled );
+
+
+// returns 1 if stages are being timed
+int PRF_Is_Enabled();
+
+
+// returns the current time in performance counter ticks, for PRF_Stop()
+uint64_t PRF_Start();
+
+
+// adds the time since start to a stage of the current frame
+void PRF_Stop( int stage, uint64_t start );
+
+
+// adds ticks to a stage of the current frame, safe to call from any thread
+void PRF_Add_Time( int stage, uint64_t ticks );
+
+
+// files the stage times of the frame in the history and the csv file, and starts the next
+// frame
+void PRF_End_Frame();
+
+
+// returns the average time of a stage over the history in milliseconds, PRF_STAGE_COUNT
+// gives the average time of a whole frame
+double PRF_Get_Average( int stage );
+
+
+// returns the name of a stage, "frame" for PRF_STAGE_COUNT
+char *PRF_Get_Stage_Name( int stage );
+
+
+// draws the average time of every stage at (x, y) with GRA_Simple_Text(), needs a font
+void PRF_Draw_Overlay( int x, int y );
+
+
+// prints the average time of every stage
+void PRF_Print_Averages();
+
+
+// starts writing a row of stage times for every frame to a csv file
+int PRF_Open_CSV( char *filename );
+
+
+// closes the csv file
+void PRF_Close_CSV();
+
+
+#endif  // __profile_h__
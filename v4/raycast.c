@@ -0,0 +1,1908 @@
+/*
+    raycast.c
+
+    casts a ray for every column on screen through the world map and draws the walls it
+    hits. the packet engine steps 4 or 8 rays with the same floating point operations in
+    the same order as the scalar engine, so both find exactly the same walls. the fixed
+    engine is a separate 16.16 fixed point version of the scalar engine. every column is
+    cast into the hit buffer before any are drawn, and the draw pass reads nothing else.
+    floors and ceilings are drawn afterwards a row at a time in the gaps the walls leave
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "vecmat.h"
+#include "threads.h"
+#include "profile.h"
+#include "counters.h"
+#include "trace.h"
+#include "map.h"
+#include "raycast.h"
+
+// sse2 is part of every x86-64 cpu, avx2 is compiled per function and checked at runtime
+#if defined( __SSE2__ )
+    #include <emmintrin.h>
+    #define RAY_SSE2
+#endif
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+    #include <immintrin.h>
+    #define RAY_AVX2
+#endif
+
+//==================================================================
+//  DEFINES AND CONSTANTS
+//==================================================================
+
+// steps shown in the hottest colour of the step view
+#define STEP_VIEW_MAX       16
+
+// these vectors are multiplied by the transformation matrix each frame to get the players
+// correct orientation, the screen falls between -1.0 ( 0 ) and 1.0 ( SCREEN_WIDTH_RES - 1 )
+const vector2d_type             DIRECTION_UP        = {  0.0, -1.0 };  // vector always points up
+const vector2d_type             DIRECTION_RIGHT     = {  1.0,  0.0 };
+
+const matrix2d_type             IDENTITY_MATRIX     = {{
+                                                        { 1.0, 0.0, 0.0 },
+                                                        { 0.0, 1.0, 0.0 },
+                                                        { 0.0, 0.0, 1.0 }
+                                                      }};
+
+//==================================================================
+//  GLOBAL VARIABLES
+//==================================================================
+
+static int                      res_w           = 0;    // render resolution
+static int                      res_h           = 0;
+
+static int                      ray_engine      = RAY_ENGINE_SCALAR;
+static int                      packet_size     = 1;    // rays per packet, 1 if no simd
+
+// how rays skip empty space
+static int                      ray_skip        = RAY_SKIP_NONE;
+
+// the step view draws each column by the number of cells its ray crossed, the render
+// threads add up the steps and occupancy reads of their columns in step_total and
+// read_total
+static int                      step_view       = 0;
+static SDL_atomic_t             step_total;
+static SDL_atomic_t             read_total;
+static double                   step_mean       = 0.0;
+static double                   read_mean       = 0.0;
+
+// floors and ceilings are drawn a row at a time once the walls are drawn
+static int                      floors          = 0;
+
+// passes of Draw_Scene_Columns(), every column is cast into the hit buffer before any are
+// drawn, so in coverage clear mode the frame can be cleared around the walls in between
+#define SCENE_CAST              0
+#define SCENE_DRAW              1
+
+// camera for the current frame
+static vector2d_type            player_pos;
+static vector2d_type            player_dir;
+static vector2d_type            player_screen;          // the screen plane
+
+static matrix2d_type            matrix;
+
+// the map the rays are cast through
+static const map_type           *world          = NULL;
+
+// state of a single ray as it is stepped through the map, shared by both engines so the
+// scalar code can finish rays the packet engine gives up on
+struct dda_state_s              {
+                                    vector2d_type   ray_dir;
+
+                                    float           x_dist;     // distance to next x side
+                                    float           y_dist;     // distance to next y side
+                                    float           x_delta;    // distance between x sides
+                                    float           y_delta;    // distance between y sides
+
+                                    int             step_x;
+                                    int             step_y;
+                                    int             map_x;
+                                    int             map_y;
+                                    int             walltype;   // side last crossed
+                                    int             reads;      // occupancy tiles read
+                                };
+typedef struct dda_state_s dda_state_type;
+
+// a block of empty cells inside the map a ray can step through without reading the map,
+// a ray is in it while map_x - x is below w and map_y - y is below h, unsigned
+struct empty_block_s            {
+                                    int             x;
+                                    int             y;
+                                    int             w;
+                                    int             h;
+                                };
+typedef struct empty_block_s empty_block_type;
+
+// bits of the 2x2 and 4x4 blocks at the top left of an occupancy tile
+#define BLOCK_2X2               0x0303ULL
+#define BLOCK_4X4               0x0f0f0f0fULL
+
+// narrowest block a ray jumps across in one go, rays step through narrower blocks cell
+// by cell without reading the map
+#define BLOCK_JUMP_MIN          8
+
+// returns 1 if (x, y) is in block
+#define In_Block( block, cell_x, cell_y )   ( (unsigned)( (cell_x) - (block).x ) < (unsigned)(block).w && \
+                                            (unsigned)( (cell_y) - (block).y ) < (unsigned)(block).h )
+
+//==================
+//  FIXED POINT
+//==================
+
+// 16.16 fixed point numbers
+typedef int32_t fixed_type;
+
+#define FIX_SHIFT               16
+#define FIX_ONE                 ( 1 << FIX_SHIFT )
+#define FIX_FRACTION            ( FIX_ONE - 1 )
+
+// converts a float to fixed point, only used once a frame for the camera
+#define FIX_From_Float( A )     ( (fixed_type)( (A) * FIX_ONE ) )
+
+// the step distance used for a ray parallel to an axis, far beyond any map
+#define FIX_FAR                 ( (int64_t)1 << 40 )
+
+// camera for the current frame in fixed point
+static fixed_type               fix_pos_x;
+static fixed_type               fix_pos_y;
+static fixed_type               fix_dir_x;
+static fixed_type               fix_dir_y;
+static fixed_type               fix_screen_x;
+static fixed_type               fix_screen_y;
+
+// where a fixed point ray hit a wall
+struct fixed_hit_s              {
+                                    int         hit;
+                                    int         map_x;
+                                    int         map_y;
+                                    int         side;           // 0 for x side, 1 for y
+                                    fixed_type  distance;       // perpendicular distance
+                                    fixed_type  texel;          // texel column 0 - FIX_ONE
+                                    int         steps;          // cells the ray crossed
+                                    int         reads;          // occupancy tiles read
+                                };
+typedef struct fixed_hit_s fixed_hit_type;
+
+// the walls of every column, filled by the cast pass and read by the draw pass, the floors
+// and the sprites
+static ray_hit_buffer_type      hit_buffer          = { 0, NULL, NULL, NULL, NULL, NULL,
+                                                        NULL, NULL, NULL, NULL };
+
+// size of the wall textures in texels, for the texel columns of the hit buffer
+static int                      texture_size        = 0;
+
+// the map position of column 0 of each row of floor or ceiling, and how far it moves from
+// one column to the next. each row is all at one distance from the camera
+struct floor_row_s              {
+                                    fixed_type  u;
+                                    fixed_type  v;
+                                    fixed_type  u_step;
+                                    fixed_type  v_step;
+                                };
+typedef struct floor_row_s floor_row_type;
+
+static floor_row_type           *frame_rows         = NULL;
+
+// rows of ceiling above open_top and floor below open_bottom are open in every column,
+// every column covers the rows from covered_top to covered_bottom
+static int                      open_top            = 0;
+static int                      open_bottom         = 0;
+static int                      covered_top         = 0;
+static int                      covered_bottom      = 0;
+
+//==================================================================
+//  PRIVATE FUNCTIONS
+//==================================================================
+
+//==================
+//  EMPTY BLOCKS
+//==================
+
+// finds the largest empty block of the occupancy pyramid around the empty cell (x, y),
+// given the occupancy tile holding it. the tile is searched for an empty 2x2 or 4x4 block
+// around the cell, and if the whole tile is empty the level above is searched the same way
+// for the tile as a single empty cell. the block stops short of the edges of the map,
+// where rays stop. returns the tiles read above level 0
+int Find_Empty_Block( const map_type *map, int x, int y, uint64_t tile, empty_block_type *block )
+{
+    int         level   = 0;
+    int         shift   = 0;        // the block is 1 << shift cells across
+    int         unit_x  = x;        // the cell in units of the level
+    int         unit_y  = y;
+    uint64_t    bits    = tile;
+
+    while( 1 )
+    {
+        int bit_x = unit_x & MAP_TILE_MASK;
+        int bit_y = unit_y & MAP_TILE_MASK;
+
+        if( ( bits & ( BLOCK_2X2 << ( ( ( bit_y & 6 ) << MAP_TILE_SHIFT ) | ( bit_x & 6 ) ) ) ) != 0 )
+        {
+            break;
+        }
+        shift++;
+
+        if( ( bits & ( BLOCK_4X4 << ( ( ( bit_y & 4 ) << MAP_TILE_SHIFT ) | ( bit_x & 4 ) ) ) ) != 0 )
+        {
+            break;
+        }
+        shift++;
+
+        if( bits != 0 )
+        {
+            break;
+        }
+        shift++;
+
+        if( level == MAP_LEVELS - 1 )
+        {
+            break;
+        }
+
+        // the empty tile is a single empty unit of the level above
+        level++;
+        unit_x  >>= MAP_TILE_SHIFT;
+        unit_y  >>= MAP_TILE_SHIFT;
+        bits    = MAP_Tile( map, level, unit_x, unit_y );
+    }
+
+    int size    = 1 << shift;
+    int left    = x & -size;
+    int top     = y & -size;
+    int right   = left + size;
+    int bottom  = top + size;
+
+    // rays stop in columns 0 and width, and rows 0 and height
+    if( left < 1 )                  left    = 1;
+    if( top < 1 )                   top     = 1;
+    if( right > map->width )        right   = map->width;
+    if( bottom > map->height )      bottom  = map->height;
+
+    block->x = left;
+    block->y = top;
+    block->w = ( right > left ) ? right - left : 0;
+    block->h = ( bottom > top ) ? bottom - top : 0;
+
+    return level;
+}
+
+
+// finds the empty block around the empty cell (x, y) from its distance to the nearest
+// wall, the cells nearer to it than that across, down or diagonally, and leaves block as
+// it is if the cell is next to a wall. returns the distances read
+int Find_Distance_Block( const map_type *map, int x, int y, empty_block_type *block )
+{
+    int reach = MAP_Distance( map, x, y ) - 1;
+
+    if( reach <= 0 )
+    {
+        return 1;
+    }
+
+    int left    = x - reach;
+    int top     = y - reach;
+    int right   = x + reach + 1;
+    int bottom  = y + reach + 1;
+
+    // rays stop in columns 0 and width, and rows 0 and height
+    if( left < 1 )                  left    = 1;
+    if( top < 1 )                   top     = 1;
+    if( right > map->width )        right   = map->width;
+    if( bottom > map->height )      bottom  = map->height;
+
+    block->x = left;
+    block->y = top;
+    block->w = right - left;
+    block->h = bottom - top;
+
+    return 1;
+}
+
+
+// finds the empty block around the empty cell (x, y) in the empty occupancy tile holding
+// it, for the skipping in use. returns the tiles or distances read
+int Find_Block( const map_type *map, int x, int y, uint64_t tile, empty_block_type *block )
+{
+    if( ray_skip == RAY_SKIP_DISTANCE )
+    {
+        return Find_Distance_Block( map, x, y, block );
+    }
+
+    return Find_Empty_Block( map, x, y, tile, block );
+}
+
+
+//==================
+//  SCALAR ENGINE
+//==================
+
+// ray_dir is the vector that points from the player to the point on the screen plane
+vector2d_type Get_Ray_Direction( int column_index )
+{
+    // get pixel column position in screen space
+    float screen_column = 2 * column_index / (float)( res_w ) - 1;
+
+    vector2d_type ray_dir;
+    ray_dir = VEC_Scale_Vector( player_screen, screen_column );
+    ray_dir = VEC_Vector_Addition( player_dir, ray_dir );
+
+    return ray_dir;
+}
+
+
+// works out the step distances and the distance to the first cell edges for a ray
+void Setup_Ray( vector2d_type ray_dir, dda_state_type *ray )
+{
+    // ray always starts at the player position
+    vector2d_type ray_pos = player_pos;
+
+    ray->ray_dir    = ray_dir;
+    ray->walltype   = 0;
+    ray->reads      = 0;
+
+    ray->map_x = (int)player_pos.x;     // the map position of the ray, beginning with the
+    ray->map_y = (int)player_pos.y;     // players position, used to check for walls
+
+    // calculate how much to increment the ray along each axis
+    float x_sqr = ray_dir.x * ray_dir.x;
+    float y_sqr = ray_dir.y * ray_dir.y;
+    ray->x_delta = sqrt( 1 + (y_sqr) / (x_sqr) );
+    ray->y_delta = sqrt( 1 + (x_sqr) / (y_sqr) );
+
+    // check ray x axis direction
+    if( ray_dir.x < 0 )
+    {
+        ray->step_x = -1;               // ray is moving west
+
+        // distance to nearest edge from the current position
+        ray->x_dist = (ray_pos.x - ray->map_x) * ray->x_delta;
+    }
+    else
+    {
+        ray->step_x = 1;                // ray is moving east
+        ray->x_dist = (ray->map_x + 1 - ray_pos.x) * ray->x_delta;
+    }
+
+    // same check for y axis
+    if( ray_dir.y < 0 )
+    {
+        ray->step_y = -1;               // ray is moving north
+        ray->y_dist = (ray_pos.y - ray->map_y) * ray->y_delta;
+    }
+    else
+    {
+        ray->step_y = 1;
+        ray->y_dist = (ray->map_y + 1 - ray_pos.y) * ray->y_delta;
+    }
+
+    return;
+}
+
+
+// the same as Trace_Ray(), but the ray only reads the map when it leaves the empty block
+// it is in. each distance is a sum of its own step distance whatever order the x and y
+// steps are taken in, so the ray can jump across a wide block by adding up each axis on
+// its own in the same order as the cell by cell steps, without their unpredictable
+// branches
+int Trace_Ray_Blocks( dda_state_type *ray )
+{
+    const map_type      *map    = world;
+    const int           width   = map->width;
+    const int           height  = map->height;
+    empty_block_type    block   = { 0, 0, 0, 0 };
+    int                 wallhit = 0;
+    int                 i;
+
+    // the ray is kept in locals, so it stays in registers across Find_Block()
+    int     map_x       = ray->map_x;
+    int     map_y       = ray->map_y;
+    int     step_x      = ray->step_x;
+    int     step_y      = ray->step_y;
+    float   x_dist      = ray->x_dist;
+    float   y_dist      = ray->y_dist;
+    float   x_delta     = ray->x_delta;
+    float   y_delta     = ray->y_delta;
+    int     walltype    = ray->walltype;
+    int     reads       = ray->reads;
+
+    while( wallhit == 0 && map_x < width  && map_x > 0
+                        && map_y < height && map_y > 0 )
+    {
+        if( block.w >= BLOCK_JUMP_MIN && block.h >= BLOCK_JUMP_MIN && In_Block( block, map_x, map_y ) )
+        {
+            // x_exit and y_exit are the distances the last x and y steps inside the block
+            // are taken at, an x step is taken while x_dist < y_dist
+            int     x_steps = ( step_x > 0 ) ? block.x + block.w - map_x : map_x - block.x + 1;
+            int     y_steps = ( step_y > 0 ) ? block.y + block.h - map_y : map_y - block.y + 1;
+            float   x_exit  = x_dist;
+            float   y_exit  = y_dist;
+
+            for( i = 1; i < x_steps; i++ )      x_exit += x_delta;
+            for( i = 1; i < y_steps; i++ )      y_exit += y_delta;
+
+            if( x_exit < y_exit )
+            {
+                // leaves across an x side, after the y steps at or before x_exit
+                while( y_dist <= x_exit )
+                {
+                    y_dist  += y_delta;
+                    map_y   += step_y;
+                }
+
+                x_dist      = x_exit + x_delta;
+                map_x       += x_steps * step_x;
+                walltype    = 0;
+            }
+            else
+            {
+                // leaves across a y side, after the x steps before y_exit
+                while( x_dist < y_exit )
+                {
+                    x_dist  += x_delta;
+                    map_x   += step_x;
+                }
+
+                y_dist      = y_exit + y_delta;
+                map_y       += y_steps * step_y;
+                walltype    = 1;
+            }
+        }
+        // increment shortest first to avoid returning wrong side of a block
+        else if( x_dist < y_dist )
+        {
+            x_dist      += x_delta;
+            map_x       += step_x;
+            walltype    = 0;
+        }
+        else
+        {
+            y_dist      += y_delta;
+            map_y       += step_y;
+            walltype    = 1;
+        }
+
+        // the cells of the block are empty and inside the map
+        if( In_Block( block, map_x, map_y ) )
+        {
+            continue;
+        }
+
+        uint64_t tile = MAP_Tile( map, 0, map_x, map_y );
+        reads++;
+
+        if( ( tile >> MAP_Tile_Bit( map_x, map_y ) ) & 1 )
+        {
+            wallhit = 1;
+        }
+        else if( tile == 0 )
+        {
+            reads += Find_Block( map, map_x, map_y, tile, &block );
+        }
+    }
+
+    ray->map_x      = map_x;
+    ray->map_y      = map_y;
+    ray->x_dist     = x_dist;
+    ray->y_dist     = y_dist;
+    ray->walltype   = walltype;
+    ray->reads      = reads;
+
+    return wallhit;
+}
+
+
+// raycasting - the ray is extended until is hits a wall (non-zero block on the map),
+// returns 1 if a wall was hit
+int Trace_Ray( dda_state_type *ray )
+{
+    if( ray_skip != RAY_SKIP_NONE )
+    {
+        return Trace_Ray_Blocks( ray );
+    }
+
+    // a copy of the map, so its fields stay in registers while ray is written to
+    const map_type map = *world;
+    int wallhit = 0;
+
+    while( wallhit == 0 && ray->map_x < map.width  && ray->map_x > 0
+                        && ray->map_y < map.height && ray->map_y > 0 )
+    {
+        // increment shortest first to avoid returning wrong side of a block
+        if( ray->x_dist < ray->y_dist )
+        {
+            ray->x_dist     += ray->x_delta;
+            ray->map_x      += ray->step_x;
+            ray->walltype   = 0;
+        }
+        else
+        {
+            ray->y_dist     += ray->y_delta;
+            ray->map_y      += ray->step_y;
+            ray->walltype   = 1;
+        }
+
+        ray->reads++;
+
+        if( MAP_Is_Solid( &map, ray->map_x, ray->map_y ) )
+        {
+            wallhit = 1;
+        }
+    }
+
+    return wallhit;
+}
+
+
+// fills in the distance and texture column of the wall a ray stopped at
+void Resolve_Hit( dda_state_type *ray, int wallhit, ray_hit_type *hit )
+{
+    vector2d_type ray_pos = player_pos;
+    vector2d_type ray_dir = ray->ray_dir;
+    float texel_normal;                 // texel column from 0.0 - 1.0
+
+    hit->hit    = wallhit;
+    hit->map_x  = ray->map_x;
+    hit->map_y  = ray->map_y;
+    hit->side   = ray->walltype;
+
+    // every step of the dda moves one cell along one axis, so the steps taken are the
+    // cells between the player and where the ray stopped
+    hit->steps  = abs( ray->map_x - (int)player_pos.x ) + abs( ray->map_y - (int)player_pos.y );
+    hit->reads  = ray->reads;
+
+    if( wallhit == 0 )
+    {
+        hit->ray_length     = 0.0f;
+        hit->texel_normal   = 0.0f;
+        return;
+    }
+
+    if( ray->walltype == 0 )            // if wall is on x axis
+    {
+        // get the distance to the wall
+        hit->ray_length = fabs( (ray->map_x - ray_pos.x + (1 - ray->step_x) / 2) / ray_dir.x );
+
+        // find where on the block the ray hit
+        texel_normal = ray_pos.y + hit->ray_length * ray_dir.y;
+    }
+    else
+    {
+        hit->ray_length = fabs( (ray->map_y - ray_pos.y + (1 - ray->step_y) / 2) / ray_dir.y );
+        texel_normal = ray_pos.x + hit->ray_length * ray_dir.x;
+    }
+
+    // the fractional part of texel_normal is the normalised column on the texture
+    texel_normal -= floor(  texel_normal );
+    hit->texel_normal = texel_normal;
+
+    return;
+}
+
+
+//==================
+//  PACKET ENGINE
+//==================
+
+// the packet gives up and hands its remaining rays to the scalar code once no more than
+// this fraction of its lanes are still active
+#define PACKET_MIN_ACTIVE( lanes )      ( (lanes) / 4 )
+
+#ifdef RAY_SSE2
+
+// counts the set lanes of a 4 bit movemask
+static const int LANE_COUNT[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+
+// the bit of each lane in a movemask, used to turn the mask back into a vector
+static const int LANE_BITS[4] = { 1, 2, 4, 8 };
+
+// steps 4 adjacent rays together, lanes beyond count repeat the last ray and are ignored
+void Cast_Packet_SSE2( int column, int count, ray_hit_type *hits )
+{
+    float           dir_x[4], dir_y[4];
+    dda_state_type  rays[4];
+    int             lane;
+
+    for( lane = 0; lane < 4; lane++ )
+    {
+        vector2d_type ray_dir = Get_Ray_Direction( column + ( lane < count ? lane : count-1 ) );
+        dir_x[lane] = ray_dir.x;
+        dir_y[lane] = ray_dir.y;
+        rays[lane].ray_dir = ray_dir;
+    }
+
+    __m128  ray_x   = _mm_loadu_ps( dir_x );
+    __m128  ray_y   = _mm_loadu_ps( dir_y );
+    __m128  pos_x   = _mm_set1_ps( player_pos.x );
+    __m128  pos_y   = _mm_set1_ps( player_pos.y );
+    __m128  zero    = _mm_setzero_ps();
+    __m128i one     = _mm_set1_epi32( 1 );
+
+    __m128i map_x   = _mm_set1_epi32( (int)player_pos.x );
+    __m128i map_y   = _mm_set1_epi32( (int)player_pos.y );
+
+    // calculate how much to increment the ray along each axis
+    __m128  x_sqr   = _mm_mul_ps( ray_x, ray_x );
+    __m128  y_sqr   = _mm_mul_ps( ray_y, ray_y );
+    __m128  x_delta = _mm_sqrt_ps( _mm_add_ps( _mm_set1_ps( 1.0f ), _mm_div_ps( y_sqr, x_sqr ) ) );
+    __m128  y_delta = _mm_sqrt_ps( _mm_add_ps( _mm_set1_ps( 1.0f ), _mm_div_ps( x_sqr, y_sqr ) ) );
+
+    // distance to the first edge on each axis, picked per lane by the ray direction
+    __m128  west    = _mm_cmplt_ps( ray_x, zero );
+    __m128  north   = _mm_cmplt_ps( ray_y, zero );
+
+    __m128  x_back  = _mm_mul_ps( _mm_sub_ps( pos_x, _mm_cvtepi32_ps( map_x ) ), x_delta );
+    __m128  x_fwd   = _mm_mul_ps( _mm_sub_ps( _mm_cvtepi32_ps( _mm_add_epi32( map_x, one ) ),
+                                              pos_x ), x_delta );
+    __m128  y_back  = _mm_mul_ps( _mm_sub_ps( pos_y, _mm_cvtepi32_ps( map_y ) ), y_delta );
+    __m128  y_fwd   = _mm_mul_ps( _mm_sub_ps( _mm_cvtepi32_ps( _mm_add_epi32( map_y, one ) ),
+                                              pos_y ), y_delta );
+
+    __m128  x_dist  = _mm_or_ps( _mm_and_ps( west, x_back ), _mm_andnot_ps( west, x_fwd ) );
+    __m128  y_dist  = _mm_or_ps( _mm_and_ps( north, y_back ), _mm_andnot_ps( north, y_fwd ) );
+
+    // -1 where the ray moves west/north, 1 otherwise
+    __m128i step_x  = _mm_or_si128( _mm_castps_si128( west ), one );
+    __m128i step_y  = _mm_or_si128( _mm_castps_si128( north ), one );
+
+    __m128i walltype = _mm_setzero_si128();
+
+    __m128i width   = _mm_set1_epi32( world->width );
+    __m128i height  = _mm_set1_epi32( world->height );
+    __m128i izero   = _mm_setzero_si128();
+
+    int     active  = ( 1 << count ) - 1;   // lanes still stepping
+    int     wallhit = 0;                    // lanes that hit a wall
+
+    int     mx[4], my[4];
+
+    // each lane skips the empty block it is in, and counts its reads
+    empty_block_type    blocks[4]   = { { 0, 0, 0, 0 } };
+    int                 reads[4]    = { 0 };
+
+    const map_type map = *world;
+
+    while( 1 )
+    {
+        // same loop condition as the scalar engine, rays leaving the map stop
+        __m128i inside = _mm_and_si128(
+                            _mm_and_si128( _mm_cmplt_epi32( map_x, width ),
+                                           _mm_cmpgt_epi32( map_x, izero ) ),
+                            _mm_and_si128( _mm_cmplt_epi32( map_y, height ),
+                                           _mm_cmpgt_epi32( map_y, izero ) ) );
+
+        active &= _mm_movemask_ps( _mm_castsi128_ps( inside ) );
+
+        if( LANE_COUNT[active] <= PACKET_MIN_ACTIVE( 4 ) )
+        {
+            break;
+        }
+
+        // lanes stepping along x and along y this iteration
+        __m128i lanes   = _mm_cmpeq_epi32( _mm_and_si128( _mm_set1_epi32( active ),
+                                                          _mm_loadu_si128( (__m128i *)LANE_BITS ) ),
+                                           _mm_loadu_si128( (__m128i *)LANE_BITS ) );
+        __m128i x_first = _mm_castps_si128( _mm_cmplt_ps( x_dist, y_dist ) );
+        __m128i move_x  = _mm_and_si128( lanes, x_first );
+        __m128i move_y  = _mm_andnot_si128( x_first, lanes );
+
+        // increment shortest first to avoid returning wrong side of a block
+        x_dist  = _mm_add_ps( x_dist, _mm_and_ps( _mm_castsi128_ps( move_x ), x_delta ) );
+        y_dist  = _mm_add_ps( y_dist, _mm_and_ps( _mm_castsi128_ps( move_y ), y_delta ) );
+        map_x   = _mm_add_epi32( map_x, _mm_and_si128( move_x, step_x ) );
+        map_y   = _mm_add_epi32( map_y, _mm_and_si128( move_y, step_y ) );
+
+        walltype = _mm_or_si128( _mm_andnot_si128( lanes, walltype ),
+                                 _mm_and_si128( move_y, one ) );
+
+        // sse2 has no gather, so check the map one lane at a time
+        _mm_storeu_si128( (__m128i *)mx, map_x );
+        _mm_storeu_si128( (__m128i *)my, map_y );
+
+        for( lane = 0; lane < 4; lane++ )
+        {
+            if( ( active & ( 1 << lane ) ) == 0 || In_Block( blocks[lane], mx[lane], my[lane] ) )
+            {
+                continue;
+            }
+
+            uint64_t tile = MAP_Tile( &map, 0, mx[lane], my[lane] );
+            reads[lane]++;
+
+            if( ( tile >> MAP_Tile_Bit( mx[lane], my[lane] ) ) & 1 )
+            {
+                wallhit |= 1 << lane;
+                active  &= ~( 1 << lane );
+            }
+            else if( ray_skip != RAY_SKIP_NONE && tile == 0 )
+            {
+                reads[lane] += Find_Block( &map, mx[lane], my[lane], tile, &blocks[lane] );
+            }
+        }
+    }
+
+    // unpack the lanes into scalar ray states
+    float   xd[4], yd[4], xdel[4], ydel[4];
+    int     sx[4], sy[4], wt[4];
+
+    _mm_storeu_ps( xd, x_dist );
+    _mm_storeu_ps( yd, y_dist );
+    _mm_storeu_ps( xdel, x_delta );
+    _mm_storeu_ps( ydel, y_delta );
+    _mm_storeu_si128( (__m128i *)sx, step_x );
+    _mm_storeu_si128( (__m128i *)sy, step_y );
+    _mm_storeu_si128( (__m128i *)mx, map_x );
+    _mm_storeu_si128( (__m128i *)my, map_y );
+    _mm_storeu_si128( (__m128i *)wt, walltype );
+
+    for( lane = 0; lane < count; lane++ )
+    {
+        dda_state_type *ray = &rays[lane];
+
+        ray->x_dist     = xd[lane];
+        ray->y_dist     = yd[lane];
+        ray->x_delta    = xdel[lane];
+        ray->y_delta    = ydel[lane];
+        ray->step_x     = sx[lane];
+        ray->step_y     = sy[lane];
+        ray->map_x      = mx[lane];
+        ray->map_y      = my[lane];
+        ray->walltype   = wt[lane];
+        ray->reads      = reads[lane];
+
+        // finish off any rays still travelling with the scalar code
+        int lane_hit = ( wallhit >> lane ) & 1;
+        if( active & ( 1 << lane ) )
+        {
+            lane_hit = Trace_Ray( ray );
+        }
+
+        Resolve_Hit( ray, lane_hit, &hits[lane] );
+    }
+
+    return;
+}
+
+#endif  // RAY_SSE2
+
+
+#ifdef RAY_AVX2
+
+// finds the empty block around the cell of each lane set in lanes, one lane at a time
+__attribute__(( target( "avx2" ) ))
+void Find_Lane_Blocks( int lanes, __m256i map_x, __m256i map_y, __m256i *block_x, __m256i *block_y,
+                       __m256i *block_w, __m256i *block_h, __m256i *reads )
+{
+    empty_block_type    block;
+    int                 mx[8], my[8], bx[8], by[8], bw[8], bh[8], rd[8];
+
+    _mm256_storeu_si256( (__m256i *)mx, map_x );
+    _mm256_storeu_si256( (__m256i *)my, map_y );
+    _mm256_storeu_si256( (__m256i *)bx, *block_x );
+    _mm256_storeu_si256( (__m256i *)by, *block_y );
+    _mm256_storeu_si256( (__m256i *)bw, *block_w );
+    _mm256_storeu_si256( (__m256i *)bh, *block_h );
+    _mm256_storeu_si256( (__m256i *)rd, *reads );
+
+    while( lanes != 0 )
+    {
+        int lane = __builtin_ctz( lanes );
+        lanes &= lanes - 1;
+
+        // the tile was just gathered, so reading all of it again is cheap
+        uint64_t tile = MAP_Tile( world, 0, mx[lane], my[lane] );
+        if( tile != 0 )
+        {
+            continue;
+        }
+
+        rd[lane] += Find_Block( world, mx[lane], my[lane], tile, &block );
+
+        bx[lane] = block.x;
+        by[lane] = block.y;
+        bw[lane] = block.w;
+        bh[lane] = block.h;
+    }
+
+    *block_x    = _mm256_loadu_si256( (__m256i *)bx );
+    *block_y    = _mm256_loadu_si256( (__m256i *)by );
+    *block_w    = _mm256_loadu_si256( (__m256i *)bw );
+    *block_h    = _mm256_loadu_si256( (__m256i *)bh );
+    *reads      = _mm256_loadu_si256( (__m256i *)rd );
+
+    return;
+}
+
+
+// steps 8 adjacent rays together, lanes beyond count repeat the last ray and are ignored
+__attribute__(( target( "avx2" ) ))
+void Cast_Packet_AVX2( int column, int count, ray_hit_type *hits )
+{
+    float           dir_x[8], dir_y[8];
+    dda_state_type  rays[8];
+    int             lane;
+
+    for( lane = 0; lane < 8; lane++ )
+    {
+        vector2d_type ray_dir = Get_Ray_Direction( column + ( lane < count ? lane : count-1 ) );
+        dir_x[lane] = ray_dir.x;
+        dir_y[lane] = ray_dir.y;
+        rays[lane].ray_dir = ray_dir;
+    }
+
+    __m256  ray_x   = _mm256_loadu_ps( dir_x );
+    __m256  ray_y   = _mm256_loadu_ps( dir_y );
+    __m256  pos_x   = _mm256_set1_ps( player_pos.x );
+    __m256  pos_y   = _mm256_set1_ps( player_pos.y );
+    __m256  zero    = _mm256_setzero_ps();
+    __m256i one     = _mm256_set1_epi32( 1 );
+
+    __m256i map_x   = _mm256_set1_epi32( (int)player_pos.x );
+    __m256i map_y   = _mm256_set1_epi32( (int)player_pos.y );
+
+    // calculate how much to increment the ray along each axis
+    __m256  x_sqr   = _mm256_mul_ps( ray_x, ray_x );
+    __m256  y_sqr   = _mm256_mul_ps( ray_y, ray_y );
+    __m256  x_delta = _mm256_sqrt_ps( _mm256_add_ps( _mm256_set1_ps( 1.0f ),
+                                                     _mm256_div_ps( y_sqr, x_sqr ) ) );
+    __m256  y_delta = _mm256_sqrt_ps( _mm256_add_ps( _mm256_set1_ps( 1.0f ),
+                                                     _mm256_div_ps( x_sqr, y_sqr ) ) );
+
+    // distance to the first edge on each axis, picked per lane by the ray direction
+    __m256  west    = _mm256_cmp_ps( ray_x, zero, _CMP_LT_OQ );
+    __m256  north   = _mm256_cmp_ps( ray_y, zero, _CMP_LT_OQ );
+
+    __m256  x_back  = _mm256_mul_ps( _mm256_sub_ps( pos_x, _mm256_cvtepi32_ps( map_x ) ), x_delta );
+    __m256  x_fwd   = _mm256_mul_ps( _mm256_sub_ps( _mm256_cvtepi32_ps(
+                                        _mm256_add_epi32( map_x, one ) ), pos_x ), x_delta );
+    __m256  y_back  = _mm256_mul_ps( _mm256_sub_ps( pos_y, _mm256_cvtepi32_ps( map_y ) ), y_delta );
+    __m256  y_fwd   = _mm256_mul_ps( _mm256_sub_ps( _mm256_cvtepi32_ps(
+                                        _mm256_add_epi32( map_y, one ) ), pos_y ), y_delta );
+
+    __m256  x_dist  = _mm256_blendv_ps( x_fwd, x_back, west );
+    __m256  y_dist  = _mm256_blendv_ps( y_fwd, y_back, north );
+
+    // -1 where the ray moves west/north, 1 otherwise
+    __m256i step_x  = _mm256_or_si256( _mm256_castps_si256( west ), one );
+    __m256i step_y  = _mm256_or_si256( _mm256_castps_si256( north ), one );
+
+    __m256i walltype = _mm256_setzero_si256();
+
+    __m256i width   = _mm256_set1_epi32( world->width );
+    __m256i height  = _mm256_set1_epi32( world->height );
+    __m256i izero   = _mm256_setzero_si256();
+    __m256i across  = _mm256_set1_epi32( world->tiles_across[0] );
+    __m256i in_tile = _mm256_set1_epi32( MAP_TILE_MASK );
+    __m256i in_word = _mm256_set1_epi32( 31 );
+    __m256i outside = _mm256_set1_epi32( -1 );
+
+    // the empty block each lane is in, and the reads of each lane
+    __m256i block_x = izero;
+    __m256i block_y = izero;
+    __m256i block_w = izero;
+    __m256i block_h = izero;
+    __m256i reads   = izero;
+
+    // lanes still stepping, lanes past count start inactive
+    __m256i active  = _mm256_cmpgt_epi32( _mm256_set1_epi32( count ),
+                                          _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) );
+    int     wallhit = 0;                    // lanes that hit a wall
+
+    while( 1 )
+    {
+        // same loop condition as the scalar engine, rays leaving the map stop
+        __m256i inside = _mm256_and_si256(
+                            _mm256_and_si256( _mm256_cmpgt_epi32( width, map_x ),
+                                              _mm256_cmpgt_epi32( map_x, izero ) ),
+                            _mm256_and_si256( _mm256_cmpgt_epi32( height, map_y ),
+                                              _mm256_cmpgt_epi32( map_y, izero ) ) );
+
+        active = _mm256_and_si256( active, inside );
+
+        int active_bits = _mm256_movemask_ps( _mm256_castsi256_ps( active ) );
+        if( __builtin_popcount( active_bits ) <= PACKET_MIN_ACTIVE( 8 ) )
+        {
+            break;
+        }
+
+        // lanes stepping along x and along y this iteration
+        __m256i x_first = _mm256_castps_si256( _mm256_cmp_ps( x_dist, y_dist, _CMP_LT_OQ ) );
+        __m256i move_x  = _mm256_and_si256( active, x_first );
+        __m256i move_y  = _mm256_andnot_si256( x_first, active );
+
+        // increment shortest first to avoid returning wrong side of a block
+        x_dist  = _mm256_add_ps( x_dist, _mm256_and_ps( _mm256_castsi256_ps( move_x ), x_delta ) );
+        y_dist  = _mm256_add_ps( y_dist, _mm256_and_ps( _mm256_castsi256_ps( move_y ), y_delta ) );
+        map_x   = _mm256_add_epi32( map_x, _mm256_and_si256( move_x, step_x ) );
+        map_y   = _mm256_add_epi32( map_y, _mm256_and_si256( move_y, step_y ) );
+
+        walltype = _mm256_blendv_epi8( walltype, _mm256_and_si256( move_y, one ), active );
+
+        // only lanes that have left their empty block read the map
+        __m256i x_in    = _mm256_sub_epi32( map_x, block_x );
+        __m256i y_in    = _mm256_sub_epi32( map_y, block_y );
+        __m256i in_block = _mm256_and_si256(
+                            _mm256_and_si256( _mm256_cmpgt_epi32( block_w, x_in ),
+                                              _mm256_cmpgt_epi32( x_in, outside ) ),
+                            _mm256_and_si256( _mm256_cmpgt_epi32( block_h, y_in ),
+                                              _mm256_cmpgt_epi32( y_in, outside ) ) );
+        __m256i reading = _mm256_andnot_si256( in_block, active );
+
+        if( _mm256_testz_si256( reading, reading ) )
+        {
+            continue;
+        }
+
+        reads = _mm256_sub_epi32( reads, reading );
+
+        // gather the half of the occupancy tile holding the bit of each reading lane
+        __m256i tile    = _mm256_add_epi32( _mm256_mullo_epi32( _mm256_srai_epi32( map_y, MAP_TILE_SHIFT ),
+                                                                across ),
+                                            _mm256_srai_epi32( map_x, MAP_TILE_SHIFT ) );
+        __m256i bit     = _mm256_or_si256( _mm256_slli_epi32( _mm256_and_si256( map_y, in_tile ),
+                                                              MAP_TILE_SHIFT ),
+                                           _mm256_and_si256( map_x, in_tile ) );
+        __m256i half    = _mm256_add_epi32( _mm256_slli_epi32( tile, 1 ), _mm256_srli_epi32( bit, 5 ) );
+        __m256i bits    = _mm256_mask_i32gather_epi32( izero, (const int *)world->occupancy[0], half,
+                                                       reading, sizeof( int ) );
+        __m256i cell    = _mm256_and_si256( _mm256_srlv_epi32( bits, _mm256_and_si256( bit, in_word ) ),
+                                            one );
+        __m256i hit     = _mm256_and_si256( reading, _mm256_cmpgt_epi32( cell, izero ) );
+
+        wallhit |= _mm256_movemask_ps( _mm256_castsi256_ps( hit ) );
+        active  = _mm256_andnot_si256( hit, active );
+
+        if( ray_skip != RAY_SKIP_NONE )
+        {
+            Find_Lane_Blocks( _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_and_si256( reading, _mm256_cmpeq_epi32( bits, izero ) ) ) ),
+                              map_x, map_y, &block_x, &block_y, &block_w, &block_h, &reads );
+        }
+    }
+
+    // unpack the lanes into scalar ray states
+    float   xd[8], yd[8], xdel[8], ydel[8];
+    int     sx[8], sy[8], mx[8], my[8], wt[8], rd[8];
+
+    _mm256_storeu_ps( xd, x_dist );
+    _mm256_storeu_ps( yd, y_dist );
+    _mm256_storeu_ps( xdel, x_delta );
+    _mm256_storeu_ps( ydel, y_delta );
+    _mm256_storeu_si256( (__m256i *)sx, step_x );
+    _mm256_storeu_si256( (__m256i *)sy, step_y );
+    _mm256_storeu_si256( (__m256i *)mx, map_x );
+    _mm256_storeu_si256( (__m256i *)my, map_y );
+    _mm256_storeu_si256( (__m256i *)wt, walltype );
+    _mm256_storeu_si256( (__m256i *)rd, reads );
+
+    int still_active = _mm256_movemask_ps( _mm256_castsi256_ps( active ) );
+
+    for( lane = 0; lane < count; lane++ )
+    {
+        dda_state_type *ray = &rays[lane];
+
+        ray->x_dist     = xd[lane];
+        ray->y_dist     = yd[lane];
+        ray->x_delta    = xdel[lane];
+        ray->y_delta    = ydel[lane];
+        ray->step_x     = sx[lane];
+        ray->step_y     = sy[lane];
+        ray->map_x      = mx[lane];
+        ray->map_y      = my[lane];
+        ray->walltype   = wt[lane];
+        ray->reads      = rd[lane];
+
+        // finish off any rays still travelling with the scalar code
+        int lane_hit = ( wallhit >> lane ) & 1;
+        if( still_active & ( 1 << lane ) )
+        {
+            lane_hit = Trace_Ray( ray );
+        }
+
+        Resolve_Hit( ray, lane_hit, &hits[lane] );
+    }
+
+    return;
+}
+
+#endif  // RAY_AVX2
+
+
+//==================
+//  FIXED ENGINE
+//==================
+
+// casts the ray for a column using only integer arithmetic. instead of the length of the
+// ray between cell edges the steps are measured along the view direction, 1 / ray_dir,
+// which keeps the same ordering of x and y steps and gives the perpendicular wall
+// distance directly
+void Cast_Column_Fixed( int column_index, fixed_hit_type *hit )
+{
+    // screen position from -1.0 to 1.0
+    fixed_type screen_column = (fixed_type)( ( (int64_t)2 * column_index * FIX_ONE ) / res_w ) - FIX_ONE;
+
+    fixed_type ray_x = fix_dir_x + (fixed_type)( ( (int64_t)fix_screen_x * screen_column ) >> FIX_SHIFT );
+    fixed_type ray_y = fix_dir_y + (fixed_type)( ( (int64_t)fix_screen_y * screen_column ) >> FIX_SHIFT );
+
+    int map_x = fix_pos_x >> FIX_SHIFT;
+    int map_y = fix_pos_y >> FIX_SHIFT;
+
+    // distance along the view direction between cell edges on each axis
+    int64_t x_delta = ( ray_x == 0 ) ? FIX_FAR : ( (int64_t)1 << ( 2 * FIX_SHIFT ) ) / llabs( ray_x );
+    int64_t y_delta = ( ray_y == 0 ) ? FIX_FAR : ( (int64_t)1 << ( 2 * FIX_SHIFT ) ) / llabs( ray_y );
+
+    int64_t x_dist, y_dist;
+    int     step_x, step_y;
+
+    if( ray_x < 0 )
+    {
+        step_x = -1;
+        x_dist = ( ( fix_pos_x & FIX_FRACTION ) * x_delta ) >> FIX_SHIFT;
+    }
+    else
+    {
+        step_x = 1;
+        x_dist = ( ( FIX_ONE - ( fix_pos_x & FIX_FRACTION ) ) * x_delta ) >> FIX_SHIFT;
+    }
+
+    if( ray_y < 0 )
+    {
+        step_y = -1;
+        y_dist = ( ( fix_pos_y & FIX_FRACTION ) * y_delta ) >> FIX_SHIFT;
+    }
+    else
+    {
+        step_y = 1;
+        y_dist = ( ( FIX_ONE - ( fix_pos_y & FIX_FRACTION ) ) * y_delta ) >> FIX_SHIFT;
+    }
+
+    const map_type      map         = *world;
+    empty_block_type    block       = { 0, 0, 0, 0 };
+    int                 wallhit     = 0;
+    int                 walltype    = 0;
+    int                 reads       = 0;
+
+    while( wallhit == 0 && map_x < map.width  && map_x > 0
+                        && map_y < map.height && map_y > 0 )
+    {
+        if( block.w >= BLOCK_JUMP_MIN && block.h >= BLOCK_JUMP_MIN && In_Block( block, map_x, map_y ) )
+        {
+            // the sums are exact, so the ray can jump to the cell it leaves the block by.
+            // x_exit and y_exit are the distances the last x and y steps inside the block
+            // are taken at, an x step is taken while x_dist < y_dist
+            int64_t x_steps = ( step_x > 0 ) ? block.x + block.w - map_x : map_x - block.x + 1;
+            int64_t y_steps = ( step_y > 0 ) ? block.y + block.h - map_y : map_y - block.y + 1;
+            int64_t x_exit  = x_dist + ( x_steps - 1 ) * x_delta;
+            int64_t y_exit  = y_dist + ( y_steps - 1 ) * y_delta;
+
+            if( x_exit < y_exit )
+            {
+                // leaves across an x side, after the y steps at or before x_exit
+                int64_t taken = ( x_exit >= y_dist ) ? ( x_exit - y_dist ) / y_delta + 1 : 0;
+
+                x_dist      = x_exit + x_delta;
+                map_x       += (int)x_steps * step_x;
+                y_dist      += taken * y_delta;
+                map_y       += (int)taken * step_y;
+                walltype    = 0;
+            }
+            else
+            {
+                // leaves across a y side, after the x steps before y_exit
+                int64_t taken = ( y_exit > x_dist ) ? ( y_exit - x_dist - 1 ) / x_delta + 1 : 0;
+
+                y_dist      = y_exit + y_delta;
+                map_y       += (int)y_steps * step_y;
+                x_dist      += taken * x_delta;
+                map_x       += (int)taken * step_x;
+                walltype    = 1;
+            }
+        }
+        // increment shortest first to avoid returning wrong side of a block
+        else if( x_dist < y_dist )
+        {
+            x_dist      += x_delta;
+            map_x       += step_x;
+            walltype    = 0;
+        }
+        else
+        {
+            y_dist      += y_delta;
+            map_y       += step_y;
+            walltype    = 1;
+        }
+
+        if( In_Block( block, map_x, map_y ) )
+        {
+            continue;
+        }
+
+        uint64_t tile = MAP_Tile( &map, 0, map_x, map_y );
+        reads++;
+
+        if( ( tile >> MAP_Tile_Bit( map_x, map_y ) ) & 1 )
+        {
+            wallhit = 1;
+        }
+        else if( ray_skip != RAY_SKIP_NONE && tile == 0 )
+        {
+            reads += Find_Block( &map, map_x, map_y, tile, &block );
+        }
+    }
+
+    hit->hit    = wallhit;
+    hit->map_x  = map_x;
+    hit->map_y  = map_y;
+    hit->side   = walltype;
+    hit->steps  = abs( map_x - ( fix_pos_x >> FIX_SHIFT ) ) + abs( map_y - ( fix_pos_y >> FIX_SHIFT ) );
+    hit->reads  = reads;
+
+    if( wallhit == 0 )
+    {
+        return;
+    }
+
+    // the last step went one cell edge past the wall, step back to get its distance, then
+    // find where along the block the ray hit
+    fixed_type wall_pos;
+    int64_t distance;
+
+    if( walltype == 0 )
+    {
+        distance = x_dist - x_delta;
+        wall_pos = fix_pos_y + (fixed_type)( ( distance * ray_y ) >> FIX_SHIFT );
+    }
+    else
+    {
+        distance = y_dist - y_delta;
+        wall_pos = fix_pos_x + (fixed_type)( ( distance * ray_x ) >> FIX_SHIFT );
+    }
+
+    hit->distance   = ( distance < 1 ) ? 1 : (fixed_type)distance;
+    hit->texel      = wall_pos & FIX_FRACTION;
+
+    return;
+}
+
+
+// finds the rows from start to end (before clipping) of the wall a fixed point ray hit
+void Wall_Span_Fixed( fixed_hit_type *hit, int *start, int *end )
+{
+    // the height of the wall on screen depends on its distance from the player
+    int64_t height = ( (int64_t)res_h << FIX_SHIFT ) / hit->distance;
+    int column_height       = ( height > 0x3fffffff ) ? 0x3fffffff : (int)height;
+
+    *start                  = -column_height / 2 + res_h / 2;
+    *end                    =  column_height / 2 + res_h / 2;
+
+    return;
+}
+
+
+//==================
+//  HIT BUFFER
+//==================
+
+// finds the rows from start to end (before clipping) of the wall a ray hit
+void Wall_Span( ray_hit_type *hit, int *start, int *end )
+{
+    // the height of the wall on screen depends on its distance from the player
+    // (ray_length)
+
+    int column_height       = abs( (int)( res_h / hit->ray_length ) );
+
+    // get height above horizon
+    *start                  = -column_height / 2 + res_h / 2;
+    // get height below horizon
+    *end                    =  column_height / 2 + res_h / 2;
+
+    return;
+}
+
+
+// keeps a column without a wall in the hit buffer, it draws nothing, which is an empty
+// span at the horizon
+void Store_Miss( int column_index )
+{
+    hit_buffer.distance[column_index]   = RAY_DEPTH_FAR;
+    hit_buffer.cell[column_index]       = -1;
+    hit_buffer.side[column_index]       = 0;
+    hit_buffer.texel[column_index]      = 0;
+    hit_buffer.texture[column_index]    = 0;
+    hit_buffer.top[column_index]        = res_h / 2;
+    hit_buffer.bottom[column_index]     = res_h / 2 - 1;
+
+    return;
+}
+
+
+// keeps the wall a ray hit in its column of the hit buffer
+void Store_Hit( int column_index, ray_hit_type *hit )
+{
+    hit_buffer.steps[column_index]  = hit->steps;
+    hit_buffer.reads[column_index]  = hit->reads;
+
+    if( hit->hit == 0 )
+    {
+        Store_Miss( column_index );
+        return;
+    }
+
+    int cell = hit->map_y * world->width + hit->map_x;
+
+    hit_buffer.distance[column_index]   = hit->ray_length;
+    hit_buffer.cell[column_index]       = cell;
+    hit_buffer.side[column_index]       = (uint8_t)hit->side;
+    hit_buffer.texel[column_index]      = (int)( hit->texel_normal * (float)texture_size );
+
+    // the texture index, -1 as map walls start at 1, not 0
+    hit_buffer.texture[column_index]    = world->walls[cell] - 1;
+
+    Wall_Span( hit, &hit_buffer.top[column_index], &hit_buffer.bottom[column_index] );
+
+    return;
+}
+
+
+// keeps the wall a fixed point ray hit in its column of the hit buffer
+void Store_Hit_Fixed( int column_index, fixed_hit_type *hit )
+{
+    hit_buffer.steps[column_index]  = hit->steps;
+    hit_buffer.reads[column_index]  = hit->reads;
+
+    if( hit->hit == 0 )
+    {
+        Store_Miss( column_index );
+        return;
+    }
+
+    int cell = hit->map_y * world->width + hit->map_x;
+
+    hit_buffer.distance[column_index]   = (float)hit->distance / FIX_ONE;
+    hit_buffer.cell[column_index]       = cell;
+    hit_buffer.side[column_index]       = (uint8_t)hit->side;
+    hit_buffer.texel[column_index]      = ( hit->texel * texture_size ) >> FIX_SHIFT;
+    hit_buffer.texture[column_index]    = world->walls[cell] - 1;
+
+    Wall_Span_Fixed( hit, &hit_buffer.top[column_index], &hit_buffer.bottom[column_index] );
+
+    return;
+}
+
+
+// casts the rays for the columns from first up to (but not including) last, no more than
+// THR_CHUNK_COLUMNS, and keeps their walls in the hit buffer
+void Cast_Block( int first, int last )
+{
+    ray_hit_type    hits[THR_CHUNK_COLUMNS];
+    fixed_hit_type  fixed_hits[THR_CHUNK_COLUMNS];
+    int             column_index = first;
+
+    if( ray_engine == RAY_ENGINE_FIXED )
+    {
+        for( ; column_index < last; column_index++ )
+        {
+            Cast_Column_Fixed( column_index, &fixed_hits[column_index - first] );
+            Store_Hit_Fixed( column_index, &fixed_hits[column_index - first] );
+        }
+    }
+    else
+    {
+        // whole packets first, any columns left over are cast one at a time
+        if( ray_engine == RAY_ENGINE_PACKET && packet_size > 1 )
+        {
+            for( ; column_index + packet_size <= last; column_index += packet_size )
+            {
+                RAY_Cast_Packet( column_index, packet_size, &hits[column_index - first] );
+            }
+        }
+
+        for( ; column_index < last; column_index++ )
+        {
+            RAY_Cast_Column( column_index, &hits[column_index - first] );
+        }
+
+        for( column_index = first; column_index < last; column_index++ )
+        {
+            Store_Hit( column_index, &hits[column_index - first] );
+        }
+    }
+
+    int steps = 0;
+    int reads = 0;
+
+    for( column_index = first; column_index < last; column_index++ )
+    {
+        // the step view fills every column
+        if( step_view == 1 )
+        {
+            hit_buffer.top[column_index]    = 0;
+            hit_buffer.bottom[column_index] = res_h - 1;
+        }
+
+        steps += hit_buffer.steps[column_index];
+        reads += hit_buffer.reads[column_index];
+    }
+
+    SDL_AtomicAdd( &step_total, steps );
+    SDL_AtomicAdd( &read_total, reads );
+
+    return;
+}
+
+
+//==================
+//  DRAWING
+//==================
+
+// fills a screen column with the heat colour of the steps its ray took, for the step view
+void Draw_Steps( int column_index, int steps )
+{
+    GRA_Draw_Vertical_Line( column_index, 0, res_h - 1, GRA_Heat_Color( steps, STEP_VIEW_MAX ) );
+
+    return;
+}
+
+
+// returns 1 if floors and ceilings are drawn this frame, the step view fills every column
+int Floors_Visible()
+{
+    return ( floors == 1 && step_view == 0 ) ? 1 : 0;
+}
+
+
+// draws the walls of the columns from first up to (but not including) last, reading only
+// the hit buffer
+void Draw_Block( int first, int last )
+{
+    int column_index;
+
+    for( column_index = first; column_index < last; column_index++ )
+    {
+        if( step_view == 1 )
+        {
+            Draw_Steps( column_index, hit_buffer.steps[column_index] );
+        }
+        else if( hit_buffer.cell[column_index] < 0 )
+        {
+            continue;
+        }
+        else if( ray_engine == RAY_ENGINE_FIXED )
+        {
+            GRA_Draw_Vertical_Texture_Line_Fixed( hit_buffer.texel[column_index], column_index,
+                                                  hit_buffer.top[column_index],
+                                                  hit_buffer.bottom[column_index],
+                                                  hit_buffer.texture[column_index] );
+        }
+        else
+        {
+            GRA_Draw_Vertical_Texture_Line( hit_buffer.texel[column_index], column_index,
+                                            hit_buffer.top[column_index],
+                                            hit_buffer.bottom[column_index],
+                                            hit_buffer.texture[column_index] );
+        }
+    }
+
+    return;
+}
+
+
+// casts or draws the columns from first up to (but not including) last, run by each
+// thread in the render pool. data points to the SCENE_ pass to run
+void Draw_Scene_Columns( int first, int last, void *data )
+{
+    int pass = *(int *)data;
+    int block, end;
+
+    // a block of columns at a time, the hits of a block are cast on the stack
+    for( block = first; block < last; block = end )
+    {
+        end = block + THR_CHUNK_COLUMNS;
+        if( end > last )
+        {
+            end = last;
+        }
+
+        cnt_sample_type counts;
+        CNT_Read( &counts );
+        uint64_t start = PRF_Start();
+
+        if( pass == SCENE_CAST )
+        {
+            TRC_BEGIN( "cast" );
+            Cast_Block( block, end );
+            TRC_END( "cast" );
+
+            PRF_Stop( PRF_STAGE_CAST, start );
+            CNT_Stop( PRF_STAGE_CAST, &counts );
+        }
+        else
+        {
+            TRC_BEGIN( "draw" );
+            Draw_Block( block, end );
+            TRC_END( "draw" );
+
+            PRF_Stop( PRF_STAGE_DRAW, start );
+            CNT_Stop( PRF_STAGE_DRAW, &counts );
+        }
+    }
+
+    return;
+}
+
+
+//==================
+//  FLOORS
+//==================
+
+// works out where each row of floor and ceiling falls on the map for the current camera.
+// a row p pixels from the horizon (measured to the middle of the row) is at the distance
+// where a wall would be 2p pixels high, so the ceiling row above the horizon and the floor
+// row below at the same p are the same distance away
+void Setup_Rows()
+{
+    int horizon = res_h / 2;
+    int x, y;
+
+    // the rows the walls leave open or covered in every column don't need to be searched
+    open_top        = hit_buffer.top[0];
+    open_bottom     = hit_buffer.bottom[0];
+    covered_top     = hit_buffer.top[0];
+    covered_bottom  = hit_buffer.bottom[0];
+
+    for( x = 1; x < res_w; x++ )
+    {
+        if( hit_buffer.top[x] < open_top )             open_top = hit_buffer.top[x];
+        if( hit_buffer.bottom[x] > open_bottom )       open_bottom = hit_buffer.bottom[x];
+        if( hit_buffer.top[x] > covered_top )          covered_top = hit_buffer.top[x];
+        if( hit_buffer.bottom[x] < covered_bottom )    covered_bottom = hit_buffer.bottom[x];
+    }
+
+    for( y = 0; y < res_h; y++ )
+    {
+        // twice p, so it stays a whole number
+        int half_rows = abs( 2 * y + 1 - 2 * horizon );
+        int64_t distance = ( (int64_t)res_h << ( FIX_SHIFT + 1 ) ) / half_rows;
+
+        // column 0 looks along the view direction less the screen plane, and each column
+        // moves 2 / res_w of the screen plane along
+        frame_rows[y].u         = fix_pos_x + (fixed_type)( ( distance * ( fix_dir_x - fix_screen_x ) ) >> FIX_SHIFT );
+        frame_rows[y].v         = fix_pos_y + (fixed_type)( ( distance * ( fix_dir_y - fix_screen_y ) ) >> FIX_SHIFT );
+        frame_rows[y].u_step    = (fixed_type)( ( distance * fix_screen_x * 2 ) / ( (int64_t)res_w << FIX_SHIFT ) );
+        frame_rows[y].v_step    = (fixed_type)( ( distance * fix_screen_y * 2 ) / ( (int64_t)res_w << FIX_SHIFT ) );
+    }
+
+    return;
+}
+
+
+// draws the floor or ceiling of the rows from first up to (but not including) last in the
+// columns their walls leave open, run by each thread in the render pool once every wall
+// has been found. each open run of a row is drawn as one horizontal line
+void Draw_Floor_Rows( int first, int last, void *data )
+{
+    int horizon = res_h / 2;
+    int y;
+
+    cnt_sample_type counts;
+    CNT_Read( &counts );
+    uint64_t start = PRF_Start();
+    TRC_BEGIN( "floors" );
+
+    for( y = first; y < last; y++ )
+    {
+        floor_row_type *row = &frame_rows[y];
+        const map_cell_type *cells = ( y < horizon ) ? world->ceilings : world->floors;
+        int x = 0;
+
+        if( y >= covered_top && y <= covered_bottom )
+        {
+            continue;
+        }
+
+        if( y < open_top || y > open_bottom )
+        {
+            GRA_Draw_Horizontal_Texture_Line( y, 0, res_w - 1, row->u, row->v,
+                                              row->u_step, row->v_step,
+                                              cells, world->width, world->height );
+            continue;
+        }
+
+        while( x < res_w )
+        {
+            int run;
+
+            // skip the columns whose walls cover this row, then find where the next one does
+            if( y < horizon )
+            {
+                while( x < res_w && hit_buffer.top[x] <= y )       x++;
+                for( run = x; run < res_w && hit_buffer.top[run] > y; run++ );
+            }
+            else
+            {
+                while( x < res_w && hit_buffer.bottom[x] >= y )    x++;
+                for( run = x; run < res_w && hit_buffer.bottom[run] < y; run++ );
+            }
+
+            if( run > x )
+            {
+                GRA_Draw_Horizontal_Texture_Line( y, x, run - 1,
+                                                  row->u + x * row->u_step, row->v + x * row->v_step,
+                                                  row->u_step, row->v_step,
+                                                  cells, world->width, world->height );
+            }
+
+            x = run;
+        }
+    }
+
+    TRC_END( "floors" );
+    PRF_Stop( PRF_STAGE_FLOORS, start );
+    CNT_Stop( PRF_STAGE_FLOORS, &counts );
+
+    return;
+}
+
+
+//==================================================================
+//  FUNCTION BODIES
+//==================================================================
+
+// sets the render resolution the scene is cast at and picks the widest packet size the
+// cpu supports
+int RAY_Init( int w, int h )
+{
+    res_w = w;
+    res_h = h;
+
+    world = MAP_Get_Map();
+
+    UTI_EC_Free( hit_buffer.distance );
+    UTI_EC_Free( hit_buffer.cell );
+    UTI_EC_Free( hit_buffer.side );
+    UTI_EC_Free( hit_buffer.texel );
+    UTI_EC_Free( hit_buffer.texture );
+    UTI_EC_Free( hit_buffer.top );
+    UTI_EC_Free( hit_buffer.bottom );
+    UTI_EC_Free( hit_buffer.steps );
+    UTI_EC_Free( hit_buffer.reads );
+    UTI_EC_Free( frame_rows );
+
+    hit_buffer.columns  = w;
+    hit_buffer.distance = UTI_EC_Malloc( sizeof( float ) * w );
+    hit_buffer.cell     = UTI_EC_Malloc( sizeof( int ) * w );
+    hit_buffer.side     = UTI_EC_Malloc( sizeof( uint8_t ) * w );
+    hit_buffer.texel    = UTI_EC_Malloc( sizeof( int ) * w );
+    hit_buffer.texture  = UTI_EC_Malloc( sizeof( uint8_t ) * w );
+    hit_buffer.top      = UTI_EC_Malloc( sizeof( int ) * w );
+    hit_buffer.bottom   = UTI_EC_Malloc( sizeof( int ) * w );
+    hit_buffer.steps    = UTI_EC_Malloc( sizeof( int ) * w );
+    hit_buffer.reads    = UTI_EC_Malloc( sizeof( int ) * w );
+    frame_rows          = UTI_EC_Malloc( sizeof( floor_row_type ) * h );
+
+    packet_size = 1;
+
+#ifdef RAY_SSE2
+    packet_size = 4;
+#endif
+
+#ifdef RAY_AVX2
+    if( SDL_HasAVX2() )
+    {
+        packet_size = 8;
+    }
+#endif
+
+    ray_engine = ( packet_size > 1 ) ? RAY_ENGINE_PACKET : RAY_ENGINE_SCALAR;
+
+    return 1;
+}
+
+
+// selects the casting engine, returns 0 if engine is unknown
+int RAY_Set_Engine( int engine )
+{
+    if( engine != RAY_ENGINE_SCALAR && engine != RAY_ENGINE_PACKET && engine != RAY_ENGINE_FIXED )
+    {
+        UTI_Print_Error( "Unknown ray casting engine" );
+        return 0;
+    }
+
+    ray_engine = engine;
+
+    return 1;
+}
+
+
+// returns the current casting engine
+int RAY_Get_Engine()
+{
+    return ray_engine;
+}
+
+
+// returns the engine with the given name (scalar, packet or fixed), -1 if there is none
+int RAY_Get_Engine_By_Name( char *name )
+{
+    int engine;
+    for( engine = RAY_ENGINE_SCALAR; engine <= RAY_ENGINE_FIXED; engine++ )
+    {
+        if( strcmp( name, RAY_Get_Engine_Name( engine ) ) == 0 )
+        {
+            return engine;
+        }
+    }
+
+    return -1;
+}
+
+
+// returns the name of an engine
+char *RAY_Get_Engine_Name( int engine )
+{
+    switch( engine )
+    {
+        case RAY_ENGINE_SCALAR:     return "scalar";
+        case RAY_ENGINE_PACKET:     return "packet";
+        case RAY_ENGINE_FIXED:      return "fixed";
+        default:                    return "unknown";
+    }
+}
+
+
+// returns the number of rays the packet engine casts together, 1 if it is unavailable
+int RAY_Get_Packet_Size()
+{
+    return packet_size;
+}
+
+
+// selects how rays skip empty space, returns 0 if skip is unknown
+int RAY_Set_Skip( int skip )
+{
+    if( skip < RAY_SKIP_NONE || skip > RAY_SKIP_DISTANCE )
+    {
+        UTI_Print_Error( "Unknown empty space skipping" );
+        return 0;
+    }
+
+    ray_skip = skip;
+
+    return 1;
+}
+
+
+// returns how rays skip empty space
+int RAY_Get_Skip()
+{
+    return ray_skip;
+}
+
+
+// returns the skipping with the given name (none, pyramid or distance), -1 if there is none
+int RAY_Get_Skip_By_Name( char *name )
+{
+    int skip;
+    for( skip = RAY_SKIP_NONE; skip <= RAY_SKIP_DISTANCE; skip++ )
+    {
+        if( strcmp( name, RAY_Get_Skip_Name( skip ) ) == 0 )
+        {
+            return skip;
+        }
+    }
+
+    return -1;
+}
+
+
+// returns the name of a way of skipping empty space
+char *RAY_Get_Skip_Name( int skip )
+{
+    switch( skip )
+    {
+        case RAY_SKIP_NONE:         return "none";
+        case RAY_SKIP_PYRAMID:      return "pyramid";
+        case RAY_SKIP_DISTANCE:     return "distance";
+        default:                    return "unknown";
+    }
+}
+
+
+// renders the scene from pos looking along angle (radians), split across the render
+// threads
+void RAY_Draw_Scene( vector2d_type pos, float angle )
+{
+    player_pos = pos;
+
+    // the map can be replaced between frames
+    world = MAP_Get_Map();
+
+    // transformation matrix
+    matrix                    = IDENTITY_MATRIX;
+
+    // get players orientation
+    VEC_Matrix_Rotation( &matrix, angle );
+
+    // get players new position and heading
+    player_dir      = VEC_Matrix_Transform_Vector( &matrix, DIRECTION_UP );
+    player_screen   = VEC_Matrix_Transform_Vector( &matrix, DIRECTION_RIGHT );
+
+    // the fixed engine converts the camera once, columns are then all integer
+    fix_pos_x       = FIX_From_Float( player_pos.x );
+    fix_pos_y       = FIX_From_Float( player_pos.y );
+    fix_dir_x       = FIX_From_Float( player_dir.x );
+    fix_dir_y       = FIX_From_Float( player_dir.y );
+    fix_screen_x    = FIX_From_Float( player_screen.x );
+    fix_screen_y    = FIX_From_Float( player_screen.y );
+
+    // split the columns across the render threads, returns once every column is drawn
+    cnt_sample_type counts;
+    CNT_Read( &counts );
+    uint64_t start = PRF_Start();
+    TRC_BEGIN( "scene" );
+
+    SDL_AtomicSet( &step_total, 0 );
+    SDL_AtomicSet( &read_total, 0 );
+
+    // textures can be reloaded between frames
+    texture_size = GRA_Get_Texture_Size();
+
+    // cast every column into the hit buffer, then draw the walls from it
+    int pass = SCENE_CAST;
+    THR_Run_Columns( res_w, Draw_Scene_Columns, &pass );
+
+    // the floors and ceilings cover every pixel the walls leave, so there is nothing to
+    // clear when they are drawn
+    if( GRA_Get_Coverage_Clear() == 1 && Floors_Visible() == 0 )
+    {
+        GRA_Clear_Uncovered( hit_buffer.top, hit_buffer.bottom );
+    }
+
+    pass = SCENE_DRAW;
+    THR_Run_Columns( res_w, Draw_Scene_Columns, &pass );
+
+    // the rows are split across the render threads the same way as the columns, the
+    // thread statistics are left describing the walls
+    if( Floors_Visible() == 1 )
+    {
+        Setup_Rows();
+        THR_Run_Quiet( res_h, Draw_Floor_Rows, NULL );
+    }
+
+    step_mean = (double)SDL_AtomicGet( &step_total ) / res_w;
+    read_mean = (double)SDL_AtomicGet( &read_total ) / res_w;
+
+    TRC_END( "scene" );
+    PRF_Stop( PRF_STAGE_SCENE, start );
+    CNT_Stop( PRF_STAGE_SCENE, &counts );
+
+    return;
+}
+
+
+// shows (1) or stops showing (0) the dda step view, each column is drawn in a heat colour
+// for the number of cells its ray stepped through, from black for none to red for
+// STEP_VIEW_MAX or more, in place of its wall
+void RAY_Set_Step_View( int enabled )
+{
+    step_view = ( enabled == 1 ) ? 1 : 0;
+
+    return;
+}
+
+
+// returns the average number of cells stepped through per column in the last
+// RAY_Draw_Scene()
+double RAY_Get_Average_Steps()
+{
+    return step_mean;
+}
+
+
+// returns the average number of occupancy tiles read per column in the last
+// RAY_Draw_Scene(), without skipping a cell is read at every step
+double RAY_Get_Average_Reads()
+{
+    return read_mean;
+}
+
+
+// draws (1) or stops drawing (0) textured floors and ceilings, cast a row at a time around
+// the walls. the floors and ceilings cover every pixel the walls don't, so in coverage
+// clear mode the frame isn't cleared at all
+void RAY_Set_Floors( int enabled )
+{
+    floors = ( enabled == 1 ) ? 1 : 0;
+
+    return;
+}
+
+
+// returns 1 if floors and ceilings are drawn
+int RAY_Get_Floors()
+{
+    return floors;
+}
+
+
+// returns the hit buffer of the last RAY_Draw_Scene(). columns without a wall have no
+// cell and draw nothing, top is then below bottom, and in the step view every column
+// draws over every row
+const ray_hit_buffer_type *RAY_Get_Hit_Buffer()
+{
+    return &hit_buffer;
+}
+
+
+// returns the perpendicular distance from the camera to the wall in each column of the
+// last RAY_Draw_Scene(), res_w values, RAY_DEPTH_FAR where no wall was hit, the distances
+// of the hit buffer
+const float *RAY_Get_Depth_Buffer()
+{
+    return hit_buffer.distance;
+}
+
+
+// gets the camera of the last RAY_Draw_Scene(), its position, the unit vector it looks
+// along and the screen plane, which runs from pos + dir - screen at column 0 to
+// pos + dir + screen at column res_w
+void RAY_Get_Camera( vector2d_type *pos, vector2d_type *dir, vector2d_type *screen )
+{
+    *pos    = player_pos;
+    *dir    = player_dir;
+    *screen = player_screen;
+
+    return;
+}
+
+
+// casts the ray for a single screen column using the camera of the last RAY_Draw_Scene()
+void RAY_Cast_Column( int column, ray_hit_type *hit )
+{
+    dda_state_type ray;
+
+    Setup_Ray( Get_Ray_Direction( column ), &ray );
+    Resolve_Hit( &ray, Trace_Ray( &ray ), hit );
+
+    return;
+}
+
+
+// casts the rays for count adjacent columns starting at column, count must be no more
+// than RAY_Get_Packet_Size()
+void RAY_Cast_Packet( int column, int count, ray_hit_type *hits )
+{
+#ifdef RAY_AVX2
+    if( packet_size == 8 )
+    {
+        Cast_Packet_AVX2( column, count, hits );
+        return;
+    }
+#endif
+
+#ifdef RAY_SSE2
+    if( packet_size == 4 )
+    {
+        Cast_Packet_SSE2( column, count, hits );
+        return;
+    }
+#endif
+
+    int i;
+    for( i = 0; i < count; i++ )
+    {
+        RAY_Cast_Column( column + i, &hits[i] );
+    }
+
+    return;
+}
@@ -0,0 +1,199 @@
+/*
+    raycast.h
+    casts a ray for every column on screen through the world map and draws the walls it
+    hits with GRA_Draw_Vertical_Texture_Line().
+
+    the scalar and packet engines produce identical hits:
+        scalar  - one ray at a time
+        packet  - 4 (SSE2) or 8 (AVX2) adjacent rays stepped together, a ray leaves the
+                  packet when it hits a wall and the last few rays are finished by the
+                  scalar code once the packet is mostly empty
+
+    the fixed engine uses only 16.16 fixed point arithmetic per column, for cpus where
+    float to int conversion is slow. its frames differ very slightly from the others
+
+    with pyramid skipping every engine reads the occupancy pyramid of the map to find the
+    largest empty block around each cell it reads, and crosses the block without reading
+    the map. the float engines still step each cell of the block, as their distances have
+    to add up in the same order to hit the same walls, the fixed engine jumps straight to
+    the cell the ray leaves the block by. the hits are identical either way
+
+    distance skipping reads the distance from the cell to the nearest wall instead of the
+    pyramid, which gives an empty block centred on the cell, crossed the same way. rays
+    next to walls step cell by cell
+
+    each frame is rendered in two passes split across the render threads. the cast pass
+    finds the wall of every column and keeps it in the hit buffer, an array per field, and
+    the draw pass draws the walls from the hit buffer alone. the buffer is kept until the
+    next frame for the sprites and anything else that needs to know where the walls are
+*/
+
+#ifndef __raycast_h__
+#define __raycast_h__
+
+#include <stdint.h>
+
+#include "vecmat.h"
+
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+// casting engines
+#define RAY_ENGINE_SCALAR           0
+#define RAY_ENGINE_PACKET           1
+#define RAY_ENGINE_FIXED            2
+
+// empty space skipping
+#define RAY_SKIP_NONE               0
+#define RAY_SKIP_PYRAMID            1
+#define RAY_SKIP_DISTANCE           2
+
+// widest packet of rays cast together
+#define RAY_MAX_PACKET              8
+
+// depth of a column where no wall was hit
+#define RAY_DEPTH_FAR               1.0e30f
+
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+// where a ray hit a wall
+struct ray_hit_s                {
+                                    int         hit;            // 0 if no wall was hit
+                                    int         map_x;          // map cell of the wall
+                                    int         map_y;
+                                    int         side;           // 0 for x side, 1 for y
+                                    float       ray_length;     // distance to the wall
+                                    float       texel_normal;   // texel column 0.0 - 1.0
+                                    int         steps;          // cells the ray crossed
+                                    int         reads;          // occupancy tiles read
+                                };
+typedef struct ray_hit_s ray_hit_type;
+
+// the walls of every column of a frame, res_w values in each array, so a pass over the
+// columns only reads the fields it needs
+struct ray_hit_buffer_s         {
+                                    int         columns;
+                                    float       *distance;      // RAY_DEPTH_FAR if no wall
+                                    int         *cell;          // y * map width + x, or -1
+                                    uint8_t     *side;          // 0 for x side, 1 for y
+                                    int         *texel;         // texel column 0 - TEX_SIZE-1
+                                    uint8_t     *texture;
+                                    int         *top;           // rows the column draws
+                                    int         *bottom;        // over, before clipping
+                                    int         *steps;         // cells the ray crossed
+                                    int         *reads;         // occupancy tiles read
+                                };
+typedef struct ray_hit_buffer_s ray_hit_buffer_type;
+
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// sets the render resolution the scene is cast at and picks the widest packet size the
+// cpu supports
+int RAY_Init( int res_w, int res_h );
+
+
+// selects the casting engine, returns 0 if engine is unknown
+int RAY_Set_Engine( int engine );
+
+
+// returns the current casting engine
+int RAY_Get_Engine();
+
+
+// returns the engine with the given name (scalar, packet or fixed), -1 if there is none
+int RAY_Get_Engine_By_Name( char *name );
+
+
+// returns the name of an engine
+char *RAY_Get_Engine_Name( int engine );
+
+
+// returns the number of rays the packet engine casts together, 1 if it is unavailable
+int RAY_Get_Packet_Size();
+
+
+// selects how rays skip empty space, returns 0 if skip is unknown
+int RAY_Set_Skip( int skip );
+
+
+// returns how rays skip empty space
+int RAY_Get_Skip();
+
+
+// returns the skipping with the given name (none, pyramid or distance), -1 if there is none
+int RAY_Get_Skip_By_Name( char *name );
+
+
+// returns the name of a way of skipping empty space
+char *RAY_Get_Skip_Name( int skip );
+
+
+// renders the scene from pos looking along angle (radians), split across the render
+// threads
+void RAY_Draw_Scene( vector2d_type pos, float angle );
+
+
+// shows (1) or stops showing (0) the dda step view, each column is drawn in a heat colour
+// for the number of cells its ray stepped through, from black for none to red for 16 or
+// more, in place of its wall
+void RAY_Set_Step_View( int enabled );
+
+
+// returns the average number of cells stepped through per column in the last
+// RAY_Draw_Scene()
+double RAY_Get_Average_Steps();
+
+
+// returns the average number of occupancy tiles read per column in the last
+// RAY_Draw_Scene(), without skipping a cell is read at every step
+double RAY_Get_Average_Reads();
+
+
+// draws (1) or stops drawing (0) textured floors and ceilings, cast a row at a time around
+// the walls. the floors and ceilings cover every pixel the walls don't, so in coverage
+// clear mode the frame isn't cleared at all
+void RAY_Set_Floors( int enabled );
+
+
+// returns 1 if floors and ceilings are drawn
+int RAY_Get_Floors();
+
+
+// returns the hit buffer of the last RAY_Draw_Scene(). columns without a wall have no
+// cell and draw nothing, top is then below bottom, and in the step view every column
+// draws over every row
+const ray_hit_buffer_type *RAY_Get_Hit_Buffer();
+
+
+// returns the perpendicular distance from the camera to the wall in each column of the
+// last RAY_Draw_Scene(), res_w values, RAY_DEPTH_FAR where no wall was hit, the distances
+// of the hit buffer
+const float *RAY_Get_Depth_Buffer();
+
+
+// gets the camera of the last RAY_Draw_Scene(), its position, the unit vector it looks
+// along and the screen plane, which runs from pos + dir - screen at column 0 to
+// pos + dir + screen at column res_w
+void RAY_Get_Camera( vector2d_type *pos, vector2d_type *dir, vector2d_type *screen );
+
+
+// casts the ray for a single screen column using the camera of the last RAY_Draw_Scene()
+void RAY_Cast_Column( int column, ray_hit_type *hit );
+
+
+// casts the rays for count adjacent columns starting at column, count must be no more
+// than RAY_Get_Packet_Size()
+void RAY_Cast_Packet( int column, int count, ray_hit_type *hits );
+
+
+#endif  // __raycast_h__
@@ -0,0 +1,449 @@
+/*
+    sprite.c
+    billboard sprites drawn over the walls. each frame the sprites are moved into camera
+    space, checked against the depth buffer left by RAY_Draw_Scene() and sorted, all on the
+    calling thread, then the render threads draw the columns of every sprite left in their
+    share of the screen
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "vecmat.h"
+#include "threads.h"
+#include "raycast.h"
+#include "map.h"
+#include "profile.h"
+#include "counters.h"
+#include "trace.h"
+#include "sprite.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// columns in each block of the depth buffer, a sprite behind the farthest wall of a block
+// is hidden in all of it
+#define DEPTH_BLOCK             16
+
+// sprites nearer the camera than this are not drawn
+#define NEAR_DEPTH              0.1f
+
+// a sprite in the map
+struct spr_sprite_s             {
+                                    float       x;
+                                    float       y;
+                                    int         texture;
+                                };
+typedef struct spr_sprite_s spr_sprite_type;
+
+// a sprite that is drawn this frame, in screen space
+struct spr_visible_s            {
+                                    float       depth;          // distance along the view
+                                    float       left;           // screen x of the left edge
+                                    float       width;          // in columns
+                                    int         first;          // columns to draw
+                                    int         last;
+                                    int         top;            // rows before clipping
+                                    int         bottom;
+                                    int         texture;
+                                    int         index;          // in the sprite list
+                                };
+typedef struct spr_visible_s spr_visible_type;
+
+static int                  res_w               = 0;            // render resolution
+static int                  res_h               = 0;
+
+static spr_sprite_type      sprites[SPR_MAX_SPRITES];
+static int                  sprite_count        = 0;
+static uint32_t             scatter_seed        = 1;
+
+// the sprites drawn this frame, farthest first
+static spr_visible_type     visible[SPR_MAX_SPRITES];
+static int                  visible_count       = 0;
+
+// the depth buffer of the frame, and the farthest wall in each block of it
+static const float          *depth_buffer       = NULL;
+static float                *block_far          = NULL;
+
+static spr_stats_type       spr_stats;
+static SDL_atomic_t         spr_columns;
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// returns a random number from 0.0 up to (but not including) 1.0, from a fixed sequence
+float Random_Float()
+{
+    scatter_seed = scatter_seed * 1103515245 + 12345;
+
+    return ( scatter_seed >> 8 ) / (float)( 1 << 24 );
+}
+
+
+// finds the farthest wall in each block of the depth buffer
+void Find_Block_Depths()
+{
+    int x;
+
+    for( x = 0; x < res_w; x++ )
+    {
+        if( x % DEPTH_BLOCK == 0 || depth_buffer[x] > block_far[x / DEPTH_BLOCK] )
+        {
+            block_far[x / DEPTH_BLOCK] = depth_buffer[x];
+        }
+    }
+
+    return;
+}
+
+
+// moves first and last in to the outermost columns where a sprite at depth is in front of
+// the wall, skipping whole blocks that are behind walls. returns 0 if the sprite is behind
+// the walls in every column, without changing first or last
+int Trim_Hidden( float depth, int *first, int *last )
+{
+    int x = *first;
+
+    while( x <= *last )
+    {
+        if( block_far[x / DEPTH_BLOCK] <= depth )
+        {
+            x = ( x / DEPTH_BLOCK + 1 ) * DEPTH_BLOCK;
+        }
+        else if( depth_buffer[x] <= depth )
+        {
+            x++;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if( x > *last )
+    {
+        return 0;
+    }
+
+    *first = x;
+
+    // there is a column in front of the walls, so this stops at or after first
+    x = *last;
+    while( depth_buffer[x] <= depth )
+    {
+        if( block_far[x / DEPTH_BLOCK] <= depth )
+        {
+            x = ( x / DEPTH_BLOCK ) * DEPTH_BLOCK - 1;
+        }
+        else
+        {
+            x--;
+        }
+    }
+
+    *last = x;
+
+    return 1;
+}
+
+
+// moves a sprite into screen space, returns 0 if it can't be seen and isn't drawn
+int Project_Sprite( int index, vector2d_type pos, vector2d_type dir, vector2d_type screen,
+                    spr_visible_type *sprite )
+{
+    // the position of the sprite relative to the camera, in screen plane and view
+    // direction units
+    float x = sprites[index].x - pos.x;
+    float y = sprites[index].y - pos.y;
+
+    float inverse   = 1.0f / ( screen.x * dir.y - dir.x * screen.y );
+    float across    = ( dir.y * x - dir.x * y ) * inverse;
+    float depth     = ( screen.x * y - screen.y * x ) * inverse;
+
+    if( depth < NEAR_DEPTH )
+    {
+        spr_stats.culled++;
+        return 0;
+    }
+
+    // the sprite is one cell wide, and the screen plane runs from -1.0 to 1.0 across the
+    // columns
+    float left  = ( ( across - 0.5f ) / depth + 1.0f ) * res_w / 2;
+    float right = ( ( across + 0.5f ) / depth + 1.0f ) * res_w / 2;
+
+    int first   = ( left < 0.0f ) ? 0 : (int)ceilf( left );
+    int last    = ( right > res_w ) ? res_w - 1 : (int)ceilf( right ) - 1;
+
+    if( first > last )
+    {
+        spr_stats.culled++;
+        return 0;
+    }
+
+    // hidden sprites are dropped before any of their texels are read
+    if( Trim_Hidden( depth, &first, &last ) == 0 )
+    {
+        spr_stats.hidden++;
+        return 0;
+    }
+
+    // the same height as a wall at the same distance
+    int height = (int)( res_h / depth );
+
+    sprite->depth   = depth;
+    sprite->left    = left;
+    sprite->width   = right - left;
+    sprite->first   = first;
+    sprite->last    = last;
+    sprite->top     = -height / 2 + res_h / 2;
+    sprite->bottom  =  height / 2 + res_h / 2;
+    sprite->texture = sprites[index].texture;
+    sprite->index   = index;
+
+    return 1;
+}
+
+
+// orders visible sprites from the farthest to the nearest, sprites at the same distance
+// keep their order in the sprite list
+int Compare_Depths( const void *a, const void *b )
+{
+    const spr_visible_type *sa = a;
+    const spr_visible_type *sb = b;
+
+    if( sa->depth != sb->depth )
+    {
+        return ( sa->depth < sb->depth ) ? 1 : -1;
+    }
+
+    return sa->index - sb->index;
+}
+
+
+// draws the columns from first up to (but not including) last of every visible sprite,
+// run by each thread in the render pool
+void Draw_Sprite_Columns( int first, int last, void *data )
+{
+    int columns = 0;
+    int i, x;
+
+    TRC_BEGIN( "sprite columns" );
+
+    for( i = 0; i < visible_count; i++ )
+    {
+        spr_visible_type *sprite = &visible[i];
+
+        int start   = ( sprite->first > first ) ? sprite->first : first;
+        int end     = ( sprite->last < last - 1 ) ? sprite->last : last - 1;
+
+        for( x = start; x <= end; x++ )
+        {
+            // the middle columns can still be behind walls
+            if( depth_buffer[x] <= sprite->depth )
+            {
+                continue;
+            }
+
+            int32_t texel = (int32_t)( ( x - sprite->left ) / sprite->width * 65536.0f );
+            if( texel < 0 )             texel = 0;
+            if( texel > 65535 )         texel = 65535;
+
+            GRA_Draw_Vertical_Sprite_Line( texel, x, sprite->top, sprite->bottom,
+                                           sprite->texture );
+            columns++;
+        }
+    }
+
+    SDL_AtomicAdd( &spr_columns, columns );
+
+    TRC_END( "sprite columns" );
+
+    return;
+}
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// sets the render resolution the sprites are drawn at, the same as RAY_Init()
+int SPR_Init( int w, int h )
+{
+    if( w <= 0 || h <= 0 )
+    {
+        UTI_Print_Error( "Sprite resolution must be above 0" );
+        return 0;
+    }
+
+    res_w = w;
+    res_h = h;
+
+    UTI_EC_Free( block_far );
+    block_far = UTI_EC_Malloc( sizeof( float ) * ( ( w + DEPTH_BLOCK - 1 ) / DEPTH_BLOCK ) );
+
+    return 1;
+}
+
+
+// removes every sprite and frees the sprite buffers
+void SPR_Close()
+{
+    SPR_Clear();
+
+    UTI_EC_Free( block_far );
+    block_far = NULL;
+
+    return;
+}
+
+
+// adds a sprite standing at (x, y) on the map, fails if there are SPR_MAX_SPRITES already
+int SPR_Add( float x, float y, int texture )
+{
+    if( sprite_count >= SPR_MAX_SPRITES )
+    {
+        UTI_Print_Error( "Too many sprites" );
+        return 0;
+    }
+
+    sprites[sprite_count].x         = x;
+    sprites[sprite_count].y         = y;
+    sprites[sprite_count].texture   = texture;
+    sprite_count++;
+
+    return 1;
+}
+
+
+// adds count sprites at random places in the empty cells of the map, the same places
+// every run
+int SPR_Scatter( int count, int texture )
+{
+    const map_type *world = MAP_Get_Map();
+    size_t cells = (size_t)world->width * world->height;
+    size_t i, empty = 0;
+
+    for( i = 0; i < cells; i++ )
+    {
+        empty += ( world->walls[i] == 0 ) ? 1 : 0;
+    }
+
+    if( empty == 0 )
+    {
+        UTI_Print_Error( "No empty cells to put sprites in" );
+        return 0;
+    }
+
+    int sprite;
+    for( sprite = 0; sprite < count; sprite++ )
+    {
+        float sprite_x, sprite_y;
+
+        do
+        {
+            sprite_x = Random_Float() * world->width;
+            sprite_y = Random_Float() * world->height;
+        }
+        while( MAP_Get_Wall( (int)sprite_x, (int)sprite_y ) != 0 );
+
+        if( SPR_Add( sprite_x, sprite_y, texture ) == 0 )
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+// removes every sprite
+void SPR_Clear()
+{
+    sprite_count    = 0;
+    visible_count   = 0;
+    scatter_seed    = 1;
+
+    return;
+}
+
+
+// returns the number of sprites in the map
+int SPR_Get_Count()
+{
+    return sprite_count;
+}
+
+
+// draws the sprites over the scene drawn by the last RAY_Draw_Scene()
+void SPR_Draw_Sprites()
+{
+    spr_stats.sprites   = sprite_count;
+    spr_stats.culled    = 0;
+    spr_stats.hidden    = 0;
+    spr_stats.drawn     = 0;
+    spr_stats.columns   = 0;
+
+    if( sprite_count == 0 )
+    {
+        return;
+    }
+
+    cnt_sample_type counts;
+    CNT_Read( &counts );
+    uint64_t start = PRF_Start();
+    TRC_BEGIN( "sprites" );
+
+    vector2d_type pos, dir, screen;
+    RAY_Get_Camera( &pos, &dir, &screen );
+
+    depth_buffer = RAY_Get_Depth_Buffer();
+    Find_Block_Depths();
+
+    int i;
+
+    visible_count = 0;
+    for( i = 0; i < sprite_count; i++ )
+    {
+        if( Project_Sprite( i, pos, dir, screen, &visible[visible_count] ) == 1 )
+        {
+            visible_count++;
+        }
+    }
+
+    qsort( visible, visible_count, sizeof( spr_visible_type ), Compare_Depths );
+
+    spr_stats.drawn = visible_count;
+
+    // split the columns across the render threads, returns once every column is drawn
+    SDL_AtomicSet( &spr_columns, 0 );
+
+    if( visible_count > 0 )
+    {
+        THR_Run_Columns( res_w, Draw_Sprite_Columns, NULL );
+    }
+
+    spr_stats.columns = SDL_AtomicGet( &spr_columns );
+
+    TRC_END( "sprites" );
+    PRF_Stop( PRF_STAGE_SPRITES, start );
+    CNT_Stop( PRF_STAGE_SPRITES, &counts );
+
+    return;
+}
+
+
+// copies what happened to the sprites in the last SPR_Draw_Sprites() into stats
+void SPR_Get_Stats( spr_stats_type *stats )
+{
+    *stats = spr_stats;
+
+    return;
+}
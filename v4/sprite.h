@@ -0,0 +1,79 @@
+/*
+    sprite.h
+    billboard sprites, textures stood upright in the map that always face the camera, one
+    cell wide and as tall as the walls. texels of palette index 0 are transparent.
+
+    the walls of the last RAY_Draw_Scene() are used as a depth buffer: sprites behind the
+    walls in every column are rejected before any texel is read, the rest are trimmed to
+    the columns where they are in front of the wall, sorted by distance and drawn from the
+    farthest to the nearest, so nearer sprites cover farther ones. the columns are split
+    across the render threads the same way as the walls
+*/
+
+#ifndef __sprite_h__
+#define __sprite_h__
+
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+// most sprites in the map
+#define SPR_MAX_SPRITES             4096
+
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+// what happened to the sprites in the last SPR_Draw_Sprites()
+struct spr_stats_s              {
+                                    int         sprites;        // in the map
+                                    int         culled;         // behind camera or off screen
+                                    int         hidden;         // behind the walls
+                                    int         drawn;
+                                    int         columns;        // sprite columns drawn
+                                };
+typedef struct spr_stats_s spr_stats_type;
+
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// sets the render resolution the sprites are drawn at, the same as RAY_Init()
+int SPR_Init( int res_w, int res_h );
+
+
+// removes every sprite and frees the sprite buffers
+void SPR_Close();
+
+
+// adds a sprite standing at (x, y) on the map, fails if there are SPR_MAX_SPRITES already
+int SPR_Add( float x, float y, int texture );
+
+
+// adds count sprites at random places in the empty cells of the map, the same places
+// every run
+int SPR_Scatter( int count, int texture );
+
+
+// removes every sprite
+void SPR_Clear();
+
+
+// returns the number of sprites in the map
+int SPR_Get_Count();
+
+
+// draws the sprites over the scene drawn by the last RAY_Draw_Scene()
+void SPR_Draw_Sprites();
+
+
+// copies what happened to the sprites in the last SPR_Draw_Sprites() into stats
+void SPR_Get_Stats( spr_stats_type *stats );
+
+
+#endif  // __sprite_h__
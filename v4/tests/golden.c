@@ -0,0 +1,956 @@
+/*
+    golden.c
+
+    golden image regression test for the renderer. renders a set of camera poses over the
+    world map headlessly in every rendering mode, hashes each frame and compares it with
+    the hashes stored in tests/golden.txt. run from the v4 folder:
+
+        tests/golden-test           check every mode against the goldens
+        tests/golden-test -u        rewrite the goldens from the first mode of each family
+
+    modes in the same family must render identical frames. the reference mode is the
+    scalar engine on one thread stepping the rays cell by cell, which is the original
+    renderer. when a frame doesn't match, the frame and a diff against the reference render
+    are written to tests/ as ppm images along with the number of mismatched pixels
+
+    it also checks the integer upscaler against SDL_BlitScaled(), and the map distances
+    MAP_Set_Wall() updates against a full rebuild after every one of a run of random edits
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+#include "vecmat.h"
+#include "threads.h"
+#include "raycast.h"
+#include "map.h"
+#include "sprite.h"
+
+//==================================================================
+//  DEFINES AND CONSTANTS
+//==================================================================
+
+#define RES_W               640
+#define RES_H               400
+
+#define TEXTURE_FILE        "textures/walls.txr"
+#define SPRITE_TEXTURE      3           // the graffiti, mostly transparent
+#define GOLDEN_FILE         "tests/golden.txt"
+
+// the built in map with gaps cut in its border, written out and loaded back as a map file
+#define OPEN_MAP            -1
+#define OPEN_MAP_FILE       "tests/open.map"
+
+// the integer upscaler is checked against SDL_BlitScaled() at each of these window sizes
+#define UPSCALE_MIN         2
+#define UPSCALE_MAX         4
+#define UPSCALE_MODE        3           // packet-threads, so the upscale can be split
+#define UPSCALE_POSE        3
+
+// walls set and cleared at random on an open map and checked against a full rebuild of the
+// distances, the map is wider and taller than MAP_DISTANCE_MAX three times over so its
+// middle is capped, and not a whole number of tiles
+#define EDIT_MAP_W          211
+#define EDIT_MAP_H          205
+#define EDIT_MAP_FILE       "tests/edit.map"
+#define EDIT_COUNT          400
+#define EDIT_SEED           12345
+
+// fnv-1a hash constants
+#define FNV_OFFSET          0xcbf29ce484222325ULL
+#define FNV_PRIME           0x100000001b3ULL
+
+// a camera position and heading to render
+struct pose_s                   {
+                                    float       x;
+                                    float       y;
+                                    float       angle;
+                                };
+typedef struct pose_s pose_type;
+
+// a way of rendering the scene that must give the same frames as its family's goldens
+struct mode_s                   {
+                                    char        *name;
+                                    char        *family;        // goldens to compare with
+                                    int         engine;
+                                    int         skip;           // RAY_SKIP_ mode
+                                    int         threads;
+                                    int         indexed;        // 1 for the 8 bit framebuffer
+                                    int         present;        // GRA_PRESENT_ mode
+                                    int         depth;          // present thread queue
+                                    int         coverage;       // 1 to clear around walls
+                                    int         floors;         // 1 to draw floors
+                                    int         sprites;        // scattered over the map
+                                    int         map_size;       // generated, 0 for built in, or OPEN_MAP
+                                };
+typedef struct mode_s mode_type;
+
+// scripted poses, chosen to cover close walls, long corridors, corners and rays along
+// the cell grid
+const pose_type POSES[] =
+{
+    { 10.0f,  10.0f,   0.0f   },        // player start
+    { 10.0f,  10.0f,   1.57f  },
+    {  7.5f,   7.5f,   0.785f },        // middle of the map, diagonal
+    {  1.5f,   1.5f,   2.356f },        // corner looking down the long room
+    { 14.2f,   8.5f,   4.712f },        // close to the east wall
+    {  3.5f,   4.5f,   3.1416f },       // just below the small block
+    {  8.0f,   8.0f,   0.0f   },        // on a cell corner, rays along the grid
+    { 12.5f,  13.5f,   5.5f   },        // behind the l shaped block
+};
+#define POSE_COUNT          ( (int)( sizeof( POSES ) / sizeof( POSES[0] ) ) )
+
+// the first mode is the reference, the goldens of each family are made from its first mode
+const mode_type MODES[] =
+{
+    { "scalar",             "float",        RAY_ENGINE_SCALAR,  RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "scalar-threads",     "float",        RAY_ENGINE_SCALAR,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "packet",             "float",        RAY_ENGINE_PACKET,  RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "packet-threads",     "float",        RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "scalar-indexed",     "float",        RAY_ENGINE_SCALAR,  RAY_SKIP_PYRAMID,  1,  1,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "packet-indexed",     "float",        RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "packet-direct",      "float",        RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_DIRECT,  0,  0,  0,    0,   0 },
+    { "packet-present",     "float",        RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    2,  0,  0,    0,   0 },
+    { "indexed-present",    "float",        RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  1,  1,  GRA_PRESENT_COPY,    1,  0,  0,    0,   0 },
+    { "scalar-coverage",    "float",        RAY_ENGINE_SCALAR,  RAY_SKIP_PYRAMID,  1,  0,  GRA_PRESENT_COPY,    0,  1,  0,    0,   0 },
+    { "indexed-coverage",   "float",        RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  1,  0,    0,   0 },
+    { "coverage-present",   "float",        RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    2,  1,  0,    0,   0 },
+    { "scalar-distance",    "float",        RAY_ENGINE_SCALAR,  RAY_SKIP_DISTANCE, 1,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "packet-distance",    "float",        RAY_ENGINE_PACKET,  RAY_SKIP_DISTANCE, 4,  0,  GRA_PRESENT_COPY,    0,  1,  0,    0,   0 },
+    { "scalar-floors",      "float-floors", RAY_ENGINE_SCALAR,  RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,   0 },
+    { "packet-floors",      "float-floors", RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,   0 },
+    { "indexed-floors",     "float-floors", RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  0,  1,    0,   0 },
+    { "floors-coverage",    "float-floors", RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    2,  1,  1,    0,   0 },
+    { "scalar-sprites",     "float-sprite", RAY_ENGINE_SCALAR,  RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  0,  300,   0 },
+    { "packet-sprites",     "float-sprite", RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    0,  0,  0,  300,   0 },
+    { "indexed-sprites",    "float-sprite", RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  1,  0,  300,   0 },
+    { "scalar-map",         "float-map",    RAY_ENGINE_SCALAR,  RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,  64 },
+    { "packet-map",         "float-map",    RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,  64 },
+    { "indexed-map",        "float-map",    RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  1,  1,    0,  64 },
+    { "map-distance",       "float-map",    RAY_ENGINE_PACKET,  RAY_SKIP_DISTANCE, 4,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,  64 },
+    { "scalar-open",        "float-open",   RAY_ENGINE_SCALAR,  RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,  OPEN_MAP },
+    { "packet-open",        "float-open",   RAY_ENGINE_PACKET,  RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    0,  1,  0,    0,  OPEN_MAP },
+    { "open-distance",      "float-open",   RAY_ENGINE_PACKET,  RAY_SKIP_DISTANCE, 4,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,  OPEN_MAP },
+    { "fixed",              "fixed",        RAY_ENGINE_FIXED,   RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "fixed-threads",      "fixed",        RAY_ENGINE_FIXED,   RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "fixed-indexed",      "fixed",        RAY_ENGINE_FIXED,   RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "fixed-direct",       "fixed",        RAY_ENGINE_FIXED,   RAY_SKIP_PYRAMID,  1,  0,  GRA_PRESENT_DIRECT,  0,  0,  0,    0,   0 },
+    { "fixed-coverage",     "fixed",        RAY_ENGINE_FIXED,   RAY_SKIP_PYRAMID,  4,  0,  GRA_PRESENT_DIRECT,  0,  1,  0,    0,   0 },
+    { "fixed-distance",     "fixed",        RAY_ENGINE_FIXED,   RAY_SKIP_DISTANCE, 4,  0,  GRA_PRESENT_COPY,    0,  0,  0,    0,   0 },
+    { "fixed-floors",       "fixed-floors", RAY_ENGINE_FIXED,   RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,   0 },
+    { "fixed-floors-cover", "fixed-floors", RAY_ENGINE_FIXED,   RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  1,  1,    0,   0 },
+    { "fixed-sprites",      "fixed-sprite", RAY_ENGINE_FIXED,   RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  0,  300,   0 },
+    { "fixed-sprite-index", "fixed-sprite", RAY_ENGINE_FIXED,   RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  1,  0,  300,   0 },
+    { "fixed-map",          "fixed-map",    RAY_ENGINE_FIXED,   RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,  64 },
+    { "fixed-map-cover",    "fixed-map",    RAY_ENGINE_FIXED,   RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  1,  1,    0,  64 },
+    { "fixed-map-distance", "fixed-map",    RAY_ENGINE_FIXED,   RAY_SKIP_DISTANCE, 1,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,  64 },
+    { "fixed-open",         "fixed-open",   RAY_ENGINE_FIXED,   RAY_SKIP_NONE,     1,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,  OPEN_MAP },
+    { "fixed-open-cover",   "fixed-open",   RAY_ENGINE_FIXED,   RAY_SKIP_PYRAMID,  4,  1,  GRA_PRESENT_COPY,    0,  1,  1,    0,  OPEN_MAP },
+    { "fixed-open-dist",    "fixed-open",   RAY_ENGINE_FIXED,   RAY_SKIP_DISTANCE, 1,  0,  GRA_PRESENT_COPY,    0,  0,  1,    0,  OPEN_MAP },
+};
+#define MODE_COUNT          ( (int)( sizeof( MODES ) / sizeof( MODES[0] ) ) )
+
+// goldens read from file
+#define MAX_GOLDENS         256
+
+struct golden_s                 {
+                                    char        family[32];
+                                    int         pose;
+                                    uint64_t    hash;
+                                };
+typedef struct golden_s golden_type;
+
+//==================================================================
+//  GLOBAL VARIABLES
+//==================================================================
+
+golden_type                     goldens[MAX_GOLDENS];
+int                             golden_count = 0;
+
+// reference render of every pose, used to make diff images
+uint32_t                        *reference[POSE_COUNT];
+
+//==================================================================
+//  FUNCTION PROTOTYPES
+//==================================================================
+
+// renders a pose with the current mode and returns the frame
+const uint32_t *Render_Pose( const pose_type *pose );
+
+// hashes a frame, the alpha channel is ignored as the window surface has none
+uint64_t Hash_Frame( const uint32_t *frame );
+
+// reads the golden hashes, returns 0 if the file can't be read
+int Read_Goldens( char *filename );
+
+// writes the golden hashes of every family, rendered with the first mode of the family
+int Write_Goldens( char *filename );
+
+// looks up the golden hash for a family and pose, returns 0 if there is none
+int Find_Golden( const char *family, int pose, uint64_t *hash );
+
+// counts the pixels that differ between two frames
+int Count_Mismatches( const uint32_t *frame, const uint32_t *expected );
+
+// writes a frame as a ppm image
+int Write_PPM( char *filename, const uint32_t *frame );
+
+// writes an image showing the expected frame dimmed with mismatched pixels in red
+int Write_Diff( char *filename, const uint32_t *frame, const uint32_t *expected );
+
+// loads the built in map with a gap cut in each side of its border
+int Load_Open_Map();
+
+// switches the renderer to a mode
+void Set_Mode( const mode_type *mode );
+
+// upscales the last frame factor times into a window surface with the given red and blue
+// masks, and compares it with SDL_BlitScaled(), returns the number of pixels that differ
+// or -1 if the integer upscaler turned the window down
+int Check_Upscale( int factor, uint32_t r_mask, uint32_t b_mask );
+
+// loads an empty EDIT_MAP_W x EDIT_MAP_H map walled in around its border
+int Load_Edit_Map();
+
+// returns a pseudo random number from 0 up to (but not including) range
+int Next_Random( int range );
+
+// returns a random cell coordinate from 0 up to size, picked next to the edges of the map,
+// next to MAP_DISTANCE_MAX cells in from them, or anywhere
+int Random_Edit_Coordinate( int size );
+
+//==================================================================
+//  MAIN FUNCTION
+//==================================================================
+
+int main( int argc, char *argv[] )
+{
+    int update = ( argc > 1 && strcmp( argv[1], "-u" ) == 0 );
+
+    if( GRA_Create_Headless_Display( RES_W, RES_H ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to create headless display" );
+    }
+
+    if( GRA_Generate_Palette() == 0 )
+    {
+        UTI_Fatal_Error( "Unable to load palette" );
+    }
+
+    if( GRA_Load_Textures( TEXTURE_FILE ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to load textures" );
+    }
+
+    if( RAY_Init( RES_W, RES_H ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set up ray caster" );
+    }
+
+    if( SPR_Init( RES_W, RES_H ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set up sprites" );
+    }
+
+    // render the reference frames first
+    int p, m;
+
+    Set_Mode( &MODES[0] );
+    for( p = 0; p < POSE_COUNT; p++ )
+    {
+        reference[p] = UTI_EC_Malloc( sizeof( uint32_t ) * RES_W * RES_H );
+        memcpy( reference[p], Render_Pose( &POSES[p] ), sizeof( uint32_t ) * RES_W * RES_H );
+    }
+
+    if( update )
+    {
+        if( Write_Goldens( GOLDEN_FILE ) == 0 )
+        {
+            UTI_Fatal_Error( "Unable to write goldens" );
+        }
+
+        printf( "goldens written to %s\n", GOLDEN_FILE );
+        return 0;
+    }
+
+    if( Read_Goldens( GOLDEN_FILE ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to read goldens, run with -u to create them" );
+    }
+
+    // check every mode against its goldens
+    int failures = 0;
+    int checks = 0;
+
+    for( m = 0; m < MODE_COUNT; m++ )
+    {
+        Set_Mode( &MODES[m] );
+
+        for( p = 0; p < POSE_COUNT; p++ )
+        {
+            const uint32_t  *frame = Render_Pose( &POSES[p] );
+            uint64_t        hash = Hash_Frame( frame );
+            uint64_t        expected;
+
+            checks++;
+
+            if( Find_Golden( MODES[m].family, p, &expected ) == 0 )
+            {
+                printf( "FAIL %-20s pose %d: no golden for family %s\n", MODES[m].name, p,
+                        MODES[m].family );
+                failures++;
+                continue;
+            }
+
+            if( hash == expected )
+            {
+                continue;
+            }
+
+            failures++;
+
+            char filename[256];
+            int mismatches = Count_Mismatches( frame, reference[p] );
+
+            printf( "FAIL %-20s pose %d: hash %016llx expected %016llx, %d of %d pixels "
+                    "differ from the reference render\n", MODES[m].name, p,
+                    (unsigned long long)hash, (unsigned long long)expected, mismatches,
+                    RES_W * RES_H );
+
+            sprintf( filename, "tests/fail_%s_pose%d.ppm", MODES[m].name, p );
+            Write_PPM( filename, frame );
+
+            sprintf( filename, "tests/fail_%s_pose%d_diff.ppm", MODES[m].name, p );
+            Write_Diff( filename, frame, reference[p] );
+
+            printf( "     frame and diff written to tests/fail_%s_pose%d*.ppm\n",
+                    MODES[m].name, p );
+        }
+    }
+
+    printf( "%d of %d frames match their goldens\n", checks - failures, checks );
+
+    // the integer upscaler has to match SDL_BlitScaled() pixel for pixel in both window
+    // pixel orders, on the calling thread and split across the pool, and splitting it
+    // mustn't replace the thread statistics of the scene
+    int upscale_checks = 0;
+    int upscale_failures = 0;
+    int factor, order, split;
+
+    Set_Mode( &MODES[UPSCALE_MODE] );
+    Render_Pose( &POSES[UPSCALE_POSE] );
+
+    for( factor = UPSCALE_MIN; factor <= UPSCALE_MAX; factor++ )
+    {
+        for( order = 0; order < 2; order++ )
+        {
+            for( split = 0; split < 2; split++ )
+            {
+                uint32_t r_mask = ( order == 0 ) ? R_MASK : B_MASK;
+                uint32_t b_mask = ( order == 0 ) ? B_MASK : R_MASK;
+                thr_stats_type before, after;
+
+                GRA_Set_Upscale_Threads( split );
+
+                THR_Get_Stats( &before );
+                int mismatches = Check_Upscale( factor, r_mask, b_mask );
+                THR_Get_Stats( &after );
+
+                upscale_checks++;
+
+                if( mismatches < 0 )
+                {
+                    printf( "FAIL upscale %dx %s %s: the integer upscaler turned it down\n",
+                            factor, ( order == 0 ) ? "rgb" : "bgr",
+                            ( split == 0 ) ? "single" : "split" );
+                    upscale_failures++;
+                }
+                else if( mismatches > 0 )
+                {
+                    printf( "FAIL upscale %dx %s %s: %d pixels differ from SDL_BlitScaled()\n",
+                            factor, ( order == 0 ) ? "rgb" : "bgr",
+                            ( split == 0 ) ? "single" : "split", mismatches );
+                    upscale_failures++;
+                }
+                else if( memcmp( &before, &after, sizeof( thr_stats_type ) ) != 0 )
+                {
+                    printf( "FAIL upscale %dx %s %s: the upscale replaced the thread stats\n",
+                            factor, ( order == 0 ) ? "rgb" : "bgr",
+                            ( split == 0 ) ? "single" : "split" );
+                    upscale_failures++;
+                }
+            }
+        }
+    }
+
+    GRA_Set_Upscale_Threads( 0 );
+
+    printf( "%d of %d upscales match SDL_BlitScaled()\n", upscale_checks - upscale_failures,
+            upscale_checks );
+    failures += upscale_failures;
+
+    // every wall set or cleared must leave the distances a full rebuild works out, byte for
+    // byte, around the edges of the map and where they reach the MAP_DISTANCE_MAX cap
+    int edit_failures = 0;
+    int e;
+
+    if( Load_Edit_Map() == 0 )
+    {
+        UTI_Fatal_Error( "Unable to load edit map" );
+    }
+
+    const map_type *world = MAP_Get_Map();
+
+    // half the edits clear a wall set earlier, so the map stays open
+    int *set_cells = UTI_EC_Malloc( sizeof( int ) * EDIT_COUNT );
+    int set_count = 0;
+
+    // the distance layer covers a column and row more than the map, in 8x8 tiles
+    size_t layer_size = (size_t)world->tiles_across[0] *
+                        ( ( world->height + 1 + MAP_TILE_MASK ) >> MAP_TILE_SHIFT ) <<
+                        ( 2 * MAP_TILE_SHIFT );
+    uint8_t *updated = UTI_EC_Malloc( layer_size );
+
+    for( e = 0; e < EDIT_COUNT; e++ )
+    {
+        int x, y, wall;
+
+        if( set_count > 0 && Next_Random( 2 ) == 0 )
+        {
+            int pick = Next_Random( set_count );
+
+            x = set_cells[pick] % world->width;
+            y = set_cells[pick] / world->width;
+            wall = 0;
+            set_cells[pick] = set_cells[--set_count];
+        }
+        else
+        {
+            // cells that are walls already, such as the border, are cleared
+            x = Random_Edit_Coordinate( world->width );
+            y = Random_Edit_Coordinate( world->height );
+            wall = ( MAP_Get_Wall( x, y ) != 0 ) ? 0 : 1 + Next_Random( GRA_Get_Texture_Count() );
+
+            if( wall != 0 )
+            {
+                set_cells[set_count++] = y * world->width + x;
+            }
+        }
+
+        if( MAP_Set_Wall( x, y, wall ) == 0 )
+        {
+            UTI_Fatal_Error( "Unable to edit map" );
+        }
+
+        memcpy( updated, world->distance, layer_size );
+        MAP_Rebuild_Distance();
+
+        if( memcmp( updated, world->distance, layer_size ) != 0 )
+        {
+            printf( "FAIL map edit %d: %s (%d, %d) left distances a rebuild doesn't\n", e,
+                    ( wall == 0 ) ? "clearing" : "setting", x, y );
+            edit_failures++;
+        }
+    }
+
+    UTI_EC_Free( updated );
+    UTI_EC_Free( set_cells );
+
+    printf( "%d of %d map edits match a full distance rebuild\n", EDIT_COUNT - edit_failures,
+            EDIT_COUNT );
+    failures += edit_failures;
+
+    for( p = 0; p < POSE_COUNT; p++ )
+    {
+        UTI_EC_Free( reference[p] );
+    }
+
+    THR_Destroy_Pool();
+
+    SPR_Close();
+
+    MAP_Close();
+
+    GRA_Free_Palette();
+
+    GRA_Free_Textures();
+
+    GRA_Close();
+
+    return ( failures == 0 ) ? 0 : 1;
+}
+
+//==================================================================
+//  FUNCTION BODIES
+//==================================================================
+
+// renders a pose with the current mode and returns the frame
+const uint32_t *Render_Pose( const pose_type *pose )
+{
+    vector2d_type pos = { pose->x, pose->y };
+
+    GRA_Clear_Screen();
+
+    RAY_Draw_Scene( pos, pose->angle );
+
+    SPR_Draw_Sprites();
+
+    GRA_Refresh_Window();
+
+    // the frame is only in the render surface once the present thread has shown it
+    GRA_Flush_Present();
+
+    return GRA_Get_Frame();
+}
+
+
+// hashes a frame, the alpha channel is ignored as the window surface has none
+uint64_t Hash_Frame( const uint32_t *frame )
+{
+    uint64_t hash = FNV_OFFSET;
+    int i, b;
+
+    for( i = 0; i < RES_W * RES_H; i++ )
+    {
+        uint32_t pixel = frame[i] & ~A_MASK;
+
+        for( b = 0; b < 4; b++ )
+        {
+            hash ^= ( pixel >> ( b * 8 ) ) & 0xff;
+            hash *= FNV_PRIME;
+        }
+    }
+
+    return hash;
+}
+
+
+// reads the golden hashes, returns 0 if the file can't be read
+int Read_Goldens( char *filename )
+{
+    FILE *file = fopen( filename, "r" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to open golden file" );
+        return 0;
+    }
+
+    char line[256];
+    golden_count = 0;
+
+    while( fgets( line, sizeof( line ), file ) != NULL && golden_count < MAX_GOLDENS )
+    {
+        unsigned long long hash;
+        golden_type *golden = &goldens[golden_count];
+
+        // skip comments and blank lines
+        if( line[0] == '#' || line[0] == '\n' )
+        {
+            continue;
+        }
+
+        if( sscanf( line, "%31s %d %llx", golden->family, &golden->pose, &hash ) == 3 )
+        {
+            golden->hash = hash;
+            golden_count++;
+        }
+    }
+
+    fclose( file );
+
+    return 1;
+}
+
+
+// writes the golden hashes of every family, rendered with the first mode of the family
+int Write_Goldens( char *filename )
+{
+    FILE *file = fopen( filename, "w" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to open golden file for writing" );
+        return 0;
+    }
+
+    fprintf( file, "# golden frame hashes, family pose hash\n" );
+    fprintf( file, "# rendered at %dx%d by tests/golden-test -u\n", RES_W, RES_H );
+
+    int m, p, earlier;
+    for( m = 0; m < MODE_COUNT; m++ )
+    {
+        // only the first mode of each family makes goldens
+        for( earlier = 0; earlier < m; earlier++ )
+        {
+            if( strcmp( MODES[earlier].family, MODES[m].family ) == 0 )
+            {
+                break;
+            }
+        }
+
+        if( earlier < m )
+        {
+            continue;
+        }
+
+        Set_Mode( &MODES[m] );
+
+        for( p = 0; p < POSE_COUNT; p++ )
+        {
+            fprintf( file, "%s %d %016llx\n", MODES[m].family, p,
+                     (unsigned long long)Hash_Frame( Render_Pose( &POSES[p] ) ) );
+        }
+    }
+
+    fclose( file );
+
+    return 1;
+}
+
+
+// looks up the golden hash for a family and pose, returns 0 if there is none
+int Find_Golden( const char *family, int pose, uint64_t *hash )
+{
+    int i;
+    for( i = 0; i < golden_count; i++ )
+    {
+        if( goldens[i].pose == pose && strcmp( goldens[i].family, family ) == 0 )
+        {
+            *hash = goldens[i].hash;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+
+// counts the pixels that differ between two frames
+int Count_Mismatches( const uint32_t *frame, const uint32_t *expected )
+{
+    int i, count = 0;
+    for( i = 0; i < RES_W * RES_H; i++ )
+    {
+        if( ( frame[i] & ~A_MASK ) != ( expected[i] & ~A_MASK ) )
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+// writes a frame as a ppm image
+int Write_PPM( char *filename, const uint32_t *frame )
+{
+    FILE *file = fopen( filename, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to open image file" );
+        return 0;
+    }
+
+    fprintf( file, "P6\n%d %d\n255\n", RES_W, RES_H );
+
+    int i;
+    for( i = 0; i < RES_W * RES_H; i++ )
+    {
+        fputc( ( frame[i] & R_MASK ) / R_ADJUST, file );
+        fputc( ( frame[i] & G_MASK ) / G_ADJUST, file );
+        fputc( ( frame[i] & B_MASK ) / B_ADJUST, file );
+    }
+
+    fclose( file );
+
+    return 1;
+}
+
+
+// writes an image showing the expected frame dimmed with mismatched pixels in red
+int Write_Diff( char *filename, const uint32_t *frame, const uint32_t *expected )
+{
+    uint32_t *diff = UTI_EC_Malloc( sizeof( uint32_t ) * RES_W * RES_H );
+
+    int i;
+    for( i = 0; i < RES_W * RES_H; i++ )
+    {
+        if( ( frame[i] & ~A_MASK ) != ( expected[i] & ~A_MASK ) )
+        {
+            diff[i] = R_MASK;
+        }
+        else
+        {
+            // quarter brightness so the red stands out
+            diff[i] = ( expected[i] >> 2 ) & 0x3f3f3f3f;
+        }
+    }
+
+    int result = Write_PPM( filename, diff );
+
+    UTI_EC_Free( diff );
+
+    return result;
+}
+
+
+// loads the built in map with a gap cut in each side of its border, so rays leave the map
+// through them. the map module can't change a cell, so the map goes through a file
+int Load_Open_Map()
+{
+    MAP_Build_Default();
+
+    const map_type *world = MAP_Get_Map();
+    int w = world->width;
+    int h = world->height;
+    size_t cells = (size_t)w * h;
+
+    map_cell_type *walls = UTI_EC_Malloc( cells );
+    memcpy( walls, world->walls, cells );
+
+    int i;
+    for( i = 4; i < 10; i++ )
+    {
+        walls[i]                        = 0;        // north
+        walls[( h - 1 ) * w + i - 2]    = 0;        // south
+        walls[( i - 1 ) * w]            = 0;        // west
+        walls[( i + 4 ) * w + w - 1]    = 0;        // east
+    }
+
+    FILE *file = fopen( OPEN_MAP_FILE, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create open map file" );
+        UTI_EC_Free( walls );
+        return 0;
+    }
+
+    uint32_t header[4] = { w, h, world->start_x, world->start_y };
+
+    fwrite( "MAP8", 4, 1, file );
+    fwrite( header, sizeof( uint32_t ), 4, file );
+    fwrite( walls, cells, 1, file );
+    fwrite( world->floors, cells, 1, file );
+    fwrite( world->ceilings, cells, 1, file );
+    fclose( file );
+
+    UTI_EC_Free( walls );
+
+    int result = MAP_Load( OPEN_MAP_FILE );
+
+    remove( OPEN_MAP_FILE );
+
+    return result;
+}
+
+
+// loads an empty EDIT_MAP_W x EDIT_MAP_H map walled in around its border, through a file
+// as Load_Open_Map() does
+int Load_Edit_Map()
+{
+    size_t cells = (size_t)EDIT_MAP_W * EDIT_MAP_H;
+    map_cell_type *layers = UTI_EC_Malloc( cells * 3 );
+    int x, y;
+
+    memset( layers, 0, cells * 3 );
+
+    for( y = 0; y < EDIT_MAP_H; y++ )
+    {
+        for( x = 0; x < EDIT_MAP_W; x++ )
+        {
+            if( x == 0 || y == 0 || x == EDIT_MAP_W - 1 || y == EDIT_MAP_H - 1 )
+            {
+                layers[y * EDIT_MAP_W + x] = 1;
+            }
+        }
+    }
+
+    FILE *file = fopen( EDIT_MAP_FILE, "wb" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to create edit map file" );
+        UTI_EC_Free( layers );
+        return 0;
+    }
+
+    uint32_t header[4] = { EDIT_MAP_W, EDIT_MAP_H, EDIT_MAP_W / 2, EDIT_MAP_H / 2 };
+
+    fwrite( "MAP8", 4, 1, file );
+    fwrite( header, sizeof( uint32_t ), 4, file );
+    fwrite( layers, cells * 3, 1, file );
+    fclose( file );
+
+    UTI_EC_Free( layers );
+
+    int result = MAP_Load( EDIT_MAP_FILE );
+
+    remove( EDIT_MAP_FILE );
+
+    return result;
+}
+
+
+// returns a pseudo random number from 0 up to (but not including) range, the same sequence
+// every run
+int Next_Random( int range )
+{
+    static uint32_t seed = EDIT_SEED;
+
+    seed = seed * 1664525 + 1013904223;
+
+    return (int)( ( seed >> 8 ) % (uint32_t)range );
+}
+
+
+// returns a random cell coordinate from 0 up to size, picked within 2 cells of the edges of
+// the map, within 2 cells of MAP_DISTANCE_MAX in from them, or anywhere
+int Random_Edit_Coordinate( int size )
+{
+    int pick = Next_Random( 3 );
+    int offset = Next_Random( 5 );
+
+    if( pick == 2 )
+    {
+        return Next_Random( size );
+    }
+
+    if( pick == 1 )
+    {
+        offset += MAP_DISTANCE_MAX - 2;
+    }
+
+    return ( Next_Random( 2 ) == 0 ) ? offset : size - 1 - offset;
+}
+
+
+// switches the renderer to a mode
+void Set_Mode( const mode_type *mode )
+{
+    THR_Destroy_Pool();
+
+    if( THR_Create_Pool( mode->threads ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to start render threads" );
+    }
+
+    RAY_Set_Engine( mode->engine );
+
+    RAY_Set_Skip( mode->skip );
+
+    RAY_Set_Floors( mode->floors );
+
+    if( mode->map_size == OPEN_MAP )
+    {
+        if( Load_Open_Map() == 0 )
+        {
+            UTI_Fatal_Error( "Unable to load open map" );
+        }
+    }
+    else if( mode->map_size > 0 )
+    {
+        if( MAP_Generate( mode->map_size, mode->map_size ) == 0 )
+        {
+            UTI_Fatal_Error( "Unable to generate map" );
+        }
+    }
+    else
+    {
+        MAP_Build_Default();
+    }
+
+    // the same sprites in the same places every time
+    SPR_Clear();
+
+    if( SPR_Scatter( mode->sprites, SPRITE_TEXTURE ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to scatter sprites" );
+    }
+
+    GRA_Stop_Present_Thread();
+
+    GRA_Set_Indexed_Mode( mode->indexed );
+
+    if( GRA_Set_Coverage_Clear( mode->coverage ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set coverage clear mode" );
+    }
+
+    if( GRA_Set_Present_Mode( mode->present ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to set present mode" );
+    }
+
+    if( mode->depth > 0 && GRA_Start_Present_Thread( mode->depth ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to start present thread" );
+    }
+
+    return;
+}
+
+
+// upscales the last frame factor times into a window surface with the given red and blue
+// masks, and compares it with SDL_BlitScaled(), returns the number of pixels that differ
+// or -1 if the integer upscaler turned the window down
+int Check_Upscale( int factor, uint32_t r_mask, uint32_t b_mask )
+{
+    int w = RES_W * factor;
+    int h = RES_H * factor;
+    SDL_Rect rect = { 0, 0, w, h };
+
+    // the frame is copied without its alpha so the blit doesn't blend it
+    SDL_Surface *frame  = SDL_CreateRGBSurface( SDL_SWSURFACE, RES_W, RES_H, 32,
+                                                R_MASK, G_MASK, B_MASK, 0 );
+    SDL_Surface *scaled = SDL_CreateRGBSurface( SDL_SWSURFACE, w, h, 32,
+                                                r_mask, G_MASK, b_mask, 0 );
+    SDL_Surface *fast   = SDL_CreateRGBSurface( SDL_SWSURFACE, w, h, 32,
+                                                r_mask, G_MASK, b_mask, 0 );
+    if( frame == NULL || scaled == NULL || fast == NULL )
+    {
+        UTI_Fatal_Error( "Unable to create upscale surfaces" );
+    }
+
+    const uint32_t *pixels = GRA_Get_Frame();
+    int x, y;
+
+    for( y = 0; y < RES_H; y++ )
+    {
+        memcpy( (uint8_t *)frame->pixels + y * frame->pitch, pixels + y * RES_W,
+                sizeof( uint32_t ) * RES_W );
+    }
+
+    SDL_BlitScaled( frame, NULL, scaled, &rect );
+
+    int count = -1;
+
+    if( GRA_Upscale_Frame( fast, &rect ) == 1 )
+    {
+        uint32_t rgb = r_mask | G_MASK | b_mask;
+        count = 0;
+
+        for( y = 0; y < h; y++ )
+        {
+            const uint32_t *a = (uint32_t *)( (uint8_t *)scaled->pixels + y * scaled->pitch );
+            const uint32_t *b = (uint32_t *)( (uint8_t *)fast->pixels + y * fast->pitch );
+
+            for( x = 0; x < w; x++ )
+            {
+                if( ( a[x] & rgb ) != ( b[x] & rgb ) )
+                {
+                    count++;
+                }
+            }
+        }
+    }
+
+    SDL_FreeSurface( frame );
+    SDL_FreeSurface( scaled );
+    SDL_FreeSurface( fast );
+
+    return count;
+}
@@ -0,0 +1,47 @@
+/*
+    texconv.c
+
+    converts a texture file to the 8 bit "TXR8" format, which stores each texel as a single
+    byte palette index instead of a uint32_t. the input can be in either format:
+
+        ./texconv textures/walls.txr textures/walls.tr8
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "graphics.h"
+
+//==================================================================
+//  MAIN FUNCTION
+//==================================================================
+
+int main( int argc, char *argv[] )
+{
+    if( argc != 3 )
+    {
+        printf( "usage: %s input.txr output.tr8\n", argv[0] );
+        return 1;
+    }
+
+    if( GRA_Load_Textures( argv[1] ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to load textures" );
+    }
+
+    if( GRA_Save_Textures( argv[2] ) == 0 )
+    {
+        UTI_Fatal_Error( "Unable to save textures" );
+    }
+
+    int size = GRA_Get_Texture_Size();
+    printf( "%s written, %d bytes of texels\n", argv[2],
+            GRA_Get_Texture_Count() * size * size );
+
+    GRA_Free_Textures();
+
+    return 0;
+}
@@ -0,0 +1,449 @@
+/*
+    threads.c
+    a persistent pool of worker threads used to split the rendering of each frame across
+    all cpu cores. the threads are created once at startup and sleep between frames, the
+    calling thread always takes a share of the work itself.
+
+    each thread owns a deque of column chunks. as the chunks of a job are always a
+    contiguous run, a deque is just the range of chunk numbers [front, back), the owner
+    takes chunks from the front and thieves take them from the back, both under a spinlock
+    that is only ever contested when a steal happens
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "threads.h"
+#include "trace.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// size of a cache line, used to keep each deque on its own line
+#define CACHE_LINE              64
+
+// a threads queue of chunks, padded so threads don't share cache lines
+struct thr_deque_s              {
+                                    // statistics for the current job
+                                    uint64_t        busy;
+                                    int             chunks;
+                                    int             stolen;
+
+                                    SDL_SpinLock    lock;
+                                    int             front;      // next chunk for the owner
+                                    int             back;       // one past the last chunk
+
+                                    char            pad[CACHE_LINE - sizeof( uint64_t ) -
+                                                        5 * sizeof( int )];
+                                };
+typedef struct thr_deque_s thr_deque_type;
+
+static SDL_Thread           *thr_workers[THR_MAX_THREADS];  // index 0 is the calling thread
+static thr_deque_type       thr_deques[THR_MAX_THREADS];
+
+static int                  thr_count           = 1;        // threads sharing the work
+
+static SDL_mutex            *thr_lock           = NULL;
+static SDL_cond             *thr_start          = NULL;     // signalled when a job is ready
+static SDL_cond             *thr_done           = NULL;     // signalled when a job finishes
+
+static int                  thr_generation      = 0;        // incremented for every job
+static int                  thr_pending         = 0;        // workers still running the job
+static int                  thr_quit            = 0;        // tells workers to exit
+
+// current job
+static thr_job_type         thr_job             = NULL;
+static void                 *thr_job_data       = NULL;
+static int                  thr_job_columns     = 0;
+
+// statistics of the last job
+static thr_stats_type       thr_stats;
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// takes the chunk at the front of a threads own deque, returns -1 if it is empty
+int Pop_Chunk( thr_deque_type *deque )
+{
+    int chunk = -1;
+
+    SDL_AtomicLock( &deque->lock );
+    if( deque->front < deque->back )
+    {
+        chunk = deque->front++;
+    }
+    SDL_AtomicUnlock( &deque->lock );
+
+    return chunk;
+}
+
+
+// takes the chunk at the back of another threads deque, returns -1 if it is empty
+int Steal_Chunk( thr_deque_type *deque )
+{
+    int chunk = -1;
+
+    SDL_AtomicLock( &deque->lock );
+    if( deque->front < deque->back )
+    {
+        chunk = --deque->back;
+    }
+    SDL_AtomicUnlock( &deque->lock );
+
+    return chunk;
+}
+
+
+// runs chunks from a threads own deque until it is empty, then steals from the others
+// until every deque is empty
+void Run_Chunks( int index, int columns, thr_job_type job, void *data )
+{
+    thr_deque_type *own = &thr_deques[index];
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    int chunk, victim, i;
+    while( 1 )
+    {
+        chunk = Pop_Chunk( own );
+
+        // own deque is empty, look for work starting with the next thread along
+        if( chunk < 0 )
+        {
+            for( i = 1; i < thr_count && chunk < 0; i++ )
+            {
+                victim = ( index + i ) % thr_count;
+                chunk = Steal_Chunk( &thr_deques[victim] );
+            }
+
+            if( chunk < 0 )
+            {
+                break;
+            }
+
+            own->stolen++;
+        }
+
+        int first   = chunk * THR_CHUNK_COLUMNS;
+        int last    = first + THR_CHUNK_COLUMNS;
+        if( last > columns )
+        {
+            last = columns;
+        }
+
+        job( first, last, data );
+        own->chunks++;
+    }
+
+    own->busy = SDL_GetPerformanceCounter() - start;
+
+    return;
+}
+
+
+// main function of each worker thread, sleeps until a new job is posted, runs chunks
+// until none are left and reports back
+int Worker_Main( void *arg )
+{
+    int index       = (int)(intptr_t)arg;
+    int generation  = 0;
+
+    TRC_THREAD_NAME( "render worker" );
+
+    SDL_LockMutex( thr_lock );
+
+    while( 1 )
+    {
+        // wait for a new job
+        while( thr_generation == generation && thr_quit == 0 )
+        {
+            SDL_CondWait( thr_start, thr_lock );
+        }
+
+        if( thr_quit == 1 )
+        {
+            break;
+        }
+
+        generation = thr_generation;
+
+        // copy the job so the lock can be released while working
+        thr_job_type    job     = thr_job;
+        void            *data   = thr_job_data;
+        int             columns = thr_job_columns;
+
+        SDL_UnlockMutex( thr_lock );
+
+        Run_Chunks( index, columns, job, data );
+
+        SDL_LockMutex( thr_lock );
+
+        // last worker to finish wakes the calling thread
+        thr_pending--;
+        if( thr_pending == 0 )
+        {
+            SDL_CondSignal( thr_done );
+        }
+    }
+
+    SDL_UnlockMutex( thr_lock );
+
+    return 0;
+}
+
+
+// deals the chunks of a job out evenly into the threads deques and clears their stats
+void Fill_Deques( int columns )
+{
+    int chunks = ( columns + THR_CHUNK_COLUMNS - 1 ) / THR_CHUNK_COLUMNS;
+    int i;
+
+    for( i = 0; i < thr_count; i++ )
+    {
+        thr_deques[i].front     = chunks * i / thr_count;
+        thr_deques[i].back      = chunks * ( i + 1 ) / thr_count;
+        thr_deques[i].chunks    = 0;
+        thr_deques[i].stolen    = 0;
+        thr_deques[i].busy      = 0;
+    }
+
+    return;
+}
+
+
+// gathers the per thread counters into thr_stats once a job is finished
+void Collect_Stats( uint64_t job_ticks )
+{
+    double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    int i;
+
+    thr_stats.threads   = thr_count;
+    thr_stats.chunks    = 0;
+    thr_stats.stolen    = 0;
+    thr_stats.job_time  = job_ticks * ms_per_tick;
+
+    for( i = 0; i < thr_count; i++ )
+    {
+        thr_stats.thread_chunks[i]  = thr_deques[i].chunks;
+        thr_stats.thread_stolen[i]  = thr_deques[i].stolen;
+        thr_stats.thread_busy[i]    = thr_deques[i].busy * ms_per_tick;
+
+        thr_stats.chunks    += thr_deques[i].chunks;
+        thr_stats.stolen    += thr_deques[i].stolen;
+    }
+
+    return;
+}
+
+
+// runs a job across the pool for THR_Run_Columns() and THR_Run_Quiet(), returns once
+// every chunk has been run
+void Run_Job( int columns, thr_job_type job, void *data )
+{
+    Fill_Deques( columns );
+
+    if( thr_count == 1 )
+    {
+        Run_Chunks( 0, columns, job, data );
+        return;
+    }
+
+    // post the job and wake the workers
+    SDL_LockMutex( thr_lock );
+
+    thr_job         = job;
+    thr_job_data    = data;
+    thr_job_columns = columns;
+    thr_pending     = thr_count - 1;
+    thr_generation++;
+
+    SDL_CondBroadcast( thr_start );
+    SDL_UnlockMutex( thr_lock );
+
+    // the calling thread works through its own deque like any other
+    Run_Chunks( 0, columns, job, data );
+
+    // wait for every worker to finish before returning
+    SDL_LockMutex( thr_lock );
+
+    while( thr_pending > 0 )
+    {
+        SDL_CondWait( thr_done, thr_lock );
+    }
+
+    SDL_UnlockMutex( thr_lock );
+
+    return;
+}
+
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// starts the worker threads, thread_count includes the calling thread. a thread_count of
+// 0 or less creates one thread per cpu core
+int THR_Create_Pool( int thread_count )
+{
+    if( thread_count <= 0 )
+    {
+        thread_count = SDL_GetCPUCount();
+    }
+
+    if( thread_count > THR_MAX_THREADS )
+    {
+        thread_count = THR_MAX_THREADS;
+    }
+
+    if( thread_count < 1 )
+    {
+        thread_count = 1;
+    }
+
+    thr_count       = 1;
+    thr_generation  = 0;
+    thr_pending     = 0;
+    thr_quit        = 0;
+
+    // a single thread runs every job directly
+    if( thread_count == 1 )
+    {
+        return 1;
+    }
+
+    thr_lock    = SDL_CreateMutex();
+    thr_start   = SDL_CreateCond();
+    thr_done    = SDL_CreateCond();
+
+    if( thr_lock == NULL || thr_start == NULL || thr_done == NULL )
+    {
+        UTI_Print_Error( "Unable to create thread pool locks" );
+        THR_Destroy_Pool();
+        return 0;
+    }
+
+    int i;
+    for( i = 1; i < thread_count; i++ )
+    {
+        thr_workers[i] = SDL_CreateThread( Worker_Main, "render worker", (void *)(intptr_t)i );
+        if( thr_workers[i] == NULL )
+        {
+            UTI_Print_Error( "Unable to create worker thread" );
+            THR_Destroy_Pool();
+            return 0;
+        }
+
+        thr_count++;
+    }
+
+    printf( "%d render threads started\n", thr_count );
+
+    return 1;
+}
+
+
+// stops and frees the worker threads
+void THR_Destroy_Pool()
+{
+    int i;
+
+    if( thr_lock != NULL )
+    {
+        SDL_LockMutex( thr_lock );
+        thr_quit = 1;
+        SDL_CondBroadcast( thr_start );
+        SDL_UnlockMutex( thr_lock );
+    }
+
+    for( i = 1; i < thr_count; i++ )
+    {
+        SDL_WaitThread( thr_workers[i], NULL );
+        thr_workers[i] = NULL;
+    }
+
+    thr_count = 1;
+
+    SDL_DestroyCond( thr_start );
+    thr_start = NULL;
+
+    SDL_DestroyCond( thr_done );
+    thr_done = NULL;
+
+    SDL_DestroyMutex( thr_lock );
+    thr_lock = NULL;
+
+    return;
+}
+
+
+// returns the number of threads sharing the work, including the calling thread
+int THR_Get_Thread_Count()
+{
+    return thr_count;
+}
+
+
+// splits columns 0 to columns-1 into chunks across the pool and runs job on each chunk,
+// does not return until every chunk has been run
+void THR_Run_Columns( int columns, thr_job_type job, void *data )
+{
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    Run_Job( columns, job, data );
+    Collect_Stats( SDL_GetPerformanceCounter() - start );
+
+    return;
+}
+
+
+// runs a job the same way as THR_Run_Columns() but leaves the statistics of the last
+// THR_Run_Columns() job in place
+void THR_Run_Quiet( int columns, thr_job_type job, void *data )
+{
+    Run_Job( columns, job, data );
+
+    return;
+}
+
+
+// copies the scheduling statistics of the most recent THR_Run_Columns() job into stats
+void THR_Get_Stats( thr_stats_type *stats )
+{
+    *stats = thr_stats;
+
+    return;
+}
+
+
+// prints the statistics of the most recent job, busy time spread is the difference
+// between the busiest and least busy thread
+void THR_Print_Stats()
+{
+    double busy_min = thr_stats.thread_busy[0];
+    double busy_max = thr_stats.thread_busy[0];
+    int i;
+
+    for( i = 1; i < thr_stats.threads; i++ )
+    {
+        if( thr_stats.thread_busy[i] < busy_min )   busy_min = thr_stats.thread_busy[i];
+        if( thr_stats.thread_busy[i] > busy_max )   busy_max = thr_stats.thread_busy[i];
+    }
+
+    printf( "threads: %d, job %.3f ms, chunks %d, stolen %d, busy %.3f - %.3f ms "
+            "(spread %.3f ms)\n", thr_stats.threads, thr_stats.job_time, thr_stats.chunks,
+            thr_stats.stolen, busy_min, busy_max, busy_max - busy_min );
+
+    for( i = 0; i < thr_stats.threads; i++ )
+    {
+        printf( "    thread %2d: %4d chunks, %4d stolen, busy %.3f ms\n", i,
+                thr_stats.thread_chunks[i], thr_stats.thread_stolen[i],
+                thr_stats.thread_busy[i] );
+    }
+
+    return;
+}
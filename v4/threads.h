@@ -0,0 +1,93 @@
+/*
+    threads.h
+    a persistent pool of worker threads used to split the rendering of each frame across
+    all cpu cores. the threads are created once at startup and sleep between frames, the
+    calling thread always takes a share of the work itself.
+
+    work is handed out as chunks of screen columns, each column is only ever drawn by one
+    thread so no locking is needed when writing to the screen buffer. every thread starts
+    with an even share of chunks in its own deque and takes chunks from the front of it,
+    a thread that runs out steals chunks from the back of another threads deque, so a
+    thread stuck on expensive columns (long rays) is helped by the others
+*/
+
+#ifndef __threads_h__
+#define __threads_h__
+
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+// upper limit on the number of threads in the pool, including the calling thread
+#define THR_MAX_THREADS             64
+
+// number of columns handed out at a time
+#define THR_CHUNK_COLUMNS           8
+
+
+//===============================================================
+//  STRUCTS AND TYPES
+//===============================================================
+
+// a job run by the pool, called with a range of columns from first up to (but not
+// including) last, data is the pointer passed to THR_Run_Columns()
+typedef void (*thr_job_type)( int first, int last, void *data );
+
+
+// scheduling statistics for the most recent job, times are in milliseconds
+struct thr_stats_s              {
+                                    int         threads;
+
+                                    int         chunks;                     // total chunks
+                                    int         stolen;                     // total stolen
+
+                                    double      job_time;                   // post to finish
+
+                                    int         thread_chunks[THR_MAX_THREADS]; // chunks run
+                                    int         thread_stolen[THR_MAX_THREADS]; // chunks stolen
+                                    double      thread_busy[THR_MAX_THREADS];   // time working
+                                };
+typedef struct thr_stats_s thr_stats_type;
+
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// starts the worker threads, thread_count includes the calling thread. a thread_count of
+// 0 or less creates one thread per cpu core
+int THR_Create_Pool( int thread_count );
+
+
+// stops and frees the worker threads
+void THR_Destroy_Pool();
+
+
+// returns the number of threads sharing the work, including the calling thread
+int THR_Get_Thread_Count();
+
+
+// splits columns 0 to columns-1 into chunks across the pool and runs job on each chunk,
+// does not return until every chunk has been run
+void THR_Run_Columns( int columns, thr_job_type job, void *data );
+
+
+// runs a job the same way as THR_Run_Columns() but leaves the statistics of the last
+// THR_Run_Columns() job in place, for the smaller jobs that follow the scene in a frame
+// (the floors and the upscale) so THR_Print_Stats() keeps describing the scene
+void THR_Run_Quiet( int columns, thr_job_type job, void *data );
+
+
+// copies the scheduling statistics of the most recent THR_Run_Columns() job into stats
+void THR_Get_Stats( thr_stats_type *stats );
+
+
+// prints the statistics of the most recent job, busy time spread is the difference
+// between the busiest and least busy thread
+void THR_Print_Stats();
+
+
+#endif  // __threads_h__
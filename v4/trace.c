@@ -0,0 +1,269 @@
+/*
+    trace.c
+    timeline tracing, each thread gets its own event buffer the first time it records an
+    event and adds blocks to it as it fills. the only shared state is the list of buffers,
+    which is locked when a thread adds its buffer
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <SDL2/SDL.h>
+
+#include "utility.h"
+#include "trace.h"
+
+
+//===============================================================
+//  CONSTANTS AND GLOBALS
+//===============================================================
+
+// a begin or end event
+struct trc_event_s              {
+                                    const char  *name;
+                                    uint64_t    time;           // performance counter ticks
+                                    char        phase;          // 'B' or 'E'
+                                };
+typedef struct trc_event_s trc_event_type;
+
+// blocks needed to hold the most events a thread can keep
+#define TRC_MAX_BLOCKS          ( ( TRC_MAX_EVENTS + TRC_BLOCK_EVENTS - 1 ) / TRC_BLOCK_EVENTS )
+
+// events recorded by one thread
+struct trc_buffer_s             {
+                                    int             tid;        // thread number in the trace
+                                    char            name[32];
+                                    int             count;
+                                    int             dropped;    // events lost to a full buffer
+                                    int             open;       // recorded spans not ended
+                                    int             skipped;    // dropped spans not ended
+                                    trc_event_type  *blocks[TRC_MAX_BLOCKS];
+                                };
+typedef struct trc_buffer_s trc_buffer_type;
+
+static trc_buffer_type      *trc_buffers[TRC_MAX_THREADS];
+static int                  trc_buffer_count    = 0;
+static SDL_SpinLock         trc_lock            = 0;
+
+// the buffer of the calling thread
+static __thread trc_buffer_type *trc_local      = NULL;
+
+//===============================================================
+//  PRIVATE FUNCTIONS
+//===============================================================
+
+// returns the calling threads buffer, creating it on first use, NULL if too many threads
+// have recorded events
+trc_buffer_type *Get_Buffer()
+{
+    if( trc_local != NULL )
+    {
+        return trc_local;
+    }
+
+    trc_buffer_type *buffer = UTI_EC_Malloc( sizeof( trc_buffer_type ) );
+    buffer->count   = 0;
+    buffer->dropped = 0;
+    buffer->open    = 0;
+    buffer->skipped = 0;
+    memset( buffer->blocks, 0, sizeof( buffer->blocks ) );
+    sprintf( buffer->name, "thread" );
+
+    SDL_AtomicLock( &trc_lock );
+    if( trc_buffer_count < TRC_MAX_THREADS )
+    {
+        buffer->tid = trc_buffer_count;
+        trc_buffers[trc_buffer_count++] = buffer;
+        trc_local = buffer;
+    }
+    SDL_AtomicUnlock( &trc_lock );
+
+    if( trc_local == NULL )
+    {
+        UTI_EC_Free( buffer );
+    }
+
+    return trc_local;
+}
+
+
+// writes a string as a json string, quoted with quotes, backslashes and control
+// characters escaped
+void Write_JSON_String( FILE *file, const char *str )
+{
+    fputc( '"', file );
+
+    for( ; *str != '\0'; str++ )
+    {
+        unsigned char c = (unsigned char)*str;
+
+        if( c == '"' || c == '\\' )
+        {
+            fputc( '\\', file );
+            fputc( c, file );
+        }
+        else if( c < 0x20 )
+        {
+            fprintf( file, "\\u%04x", c );
+        }
+        else
+        {
+            fputc( c, file );
+        }
+    }
+
+    fputc( '"', file );
+
+    return;
+}
+
+//===============================================================
+//  FUNCTION BODIES
+//===============================================================
+
+// records an event for the calling thread, phase is 'B' to begin a span or 'E' to end it
+void TRC_Event( const char *name, char phase )
+{
+    trc_buffer_type *buffer = Get_Buffer();
+    if( buffer == NULL )
+    {
+        return;
+    }
+
+    // a span is only begun while there is room left to end it and every span open around
+    // it, and the end of a dropped span is dropped too, so every span written is closed.
+    // spans nest, so once one is dropped every span begun inside it is as well
+    if( phase == 'B' )
+    {
+        if( buffer->skipped > 0 || buffer->count + buffer->open + 2 > TRC_MAX_EVENTS )
+        {
+            buffer->skipped++;
+            buffer->dropped++;
+            return;
+        }
+
+        buffer->open++;
+    }
+    else if( buffer->skipped > 0 )
+    {
+        buffer->skipped--;
+        buffer->dropped++;
+        return;
+    }
+    else if( buffer->open > 0 )
+    {
+        buffer->open--;
+    }
+    else if( buffer->count >= TRC_MAX_EVENTS )
+    {
+        // an end without a begin, there is no room kept for it
+        buffer->dropped++;
+        return;
+    }
+
+    // start a new block when the last one is full
+    int block = buffer->count / TRC_BLOCK_EVENTS;
+    if( buffer->blocks[block] == NULL )
+    {
+        buffer->blocks[block] = UTI_EC_Malloc( sizeof( trc_event_type ) * TRC_BLOCK_EVENTS );
+    }
+
+    trc_event_type *event = &buffer->blocks[block][buffer->count++ % TRC_BLOCK_EVENTS];
+    event->name     = name;
+    event->phase    = phase;
+    event->time     = SDL_GetPerformanceCounter();
+
+    return;
+}
+
+
+// names the calling thread in the trace
+void TRC_Name_Thread( const char *name )
+{
+    trc_buffer_type *buffer = Get_Buffer();
+    if( buffer == NULL )
+    {
+        return;
+    }
+
+    snprintf( buffer->name, sizeof( buffer->name ), "%s", name );
+
+    return;
+}
+
+
+// writes every recorded event to a json file and frees the buffers, every thread that
+// recorded events must have finished
+int TRC_Write( char *filename )
+{
+    FILE *file = fopen( filename, "w" );
+    if( file == NULL )
+    {
+        UTI_Print_Error( "Unable to open trace file" );
+        return 0;
+    }
+
+    // times are written in microseconds from the first event
+    double us_per_tick = 1000000.0 / (double)SDL_GetPerformanceFrequency();
+    uint64_t epoch = UINT64_MAX;
+    int b, e, events = 0, dropped = 0;
+
+    for( b = 0; b < trc_buffer_count; b++ )
+    {
+        if( trc_buffers[b]->count > 0 && trc_buffers[b]->blocks[0][0].time < epoch )
+        {
+            epoch = trc_buffers[b]->blocks[0][0].time;
+        }
+    }
+
+    fprintf( file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" );
+
+    for( b = 0; b < trc_buffer_count; b++ )
+    {
+        trc_buffer_type *buffer = trc_buffers[b];
+
+        // names are escaped, a thread can be given any name
+        fprintf( file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                 "\"args\":{\"name\":", ( b == 0 ) ? "" : ",\n", buffer->tid );
+        Write_JSON_String( file, buffer->name );
+        fprintf( file, "}}" );
+
+        for( e = 0; e < buffer->count; e++ )
+        {
+            trc_event_type *event = &buffer->blocks[e / TRC_BLOCK_EVENTS][e % TRC_BLOCK_EVENTS];
+
+            fprintf( file, ",\n{\"name\":" );
+            Write_JSON_String( file, event->name );
+            fprintf( file, ",\"ph\":\"%c\",\"pid\":1,\"tid\":%d,\"ts\":%.3f}", event->phase,
+                     buffer->tid, ( event->time - epoch ) * us_per_tick );
+        }
+
+        events  += buffer->count;
+        dropped += buffer->dropped;
+
+        for( e = 0; e < TRC_MAX_BLOCKS; e++ )
+        {
+            UTI_EC_Free( buffer->blocks[e] );
+        }
+        UTI_EC_Free( buffer );
+        trc_buffers[b] = NULL;
+    }
+
+    fprintf( file, "\n]}\n" );
+    fclose( file );
+
+    printf( "%d trace events from %d threads written to %s", events, trc_buffer_count,
+            filename );
+    if( dropped > 0 )
+    {
+        printf( ", %d dropped", dropped );
+    }
+    printf( "\n" );
+
+    // the threads buffers are gone, only the calling thread can still be recording
+    trc_buffer_count = 0;
+    trc_local = NULL;
+
+    return 1;
+}
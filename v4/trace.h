@@ -0,0 +1,70 @@
+/*
+    trace.h
+    timeline tracing. begin and end events are recorded into a buffer owned by the thread
+    that records them, so recording never waits on another thread, and are written out as
+    a chrome://tracing / perfetto json file with TRC_WRITE().
+
+    tracing is only compiled in when TRACE is defined (make TRACE=1), otherwise the macros
+    below compile to nothing and cost nothing. event names must be string literals or
+    otherwise live until the trace is written
+*/
+
+#ifndef __trace_h__
+#define __trace_h__
+
+#include <stdint.h>
+
+
+//===============================================================
+//  DEFINE
+//===============================================================
+
+// events kept per thread, later events are dropped and counted. begin and end events are
+// dropped in pairs, so every span in the trace is closed. the events are stored in blocks
+// allocated as a thread needs them, so memory is only used for events recorded. the limit
+// can be set with make TRACE_EVENTS=n
+#ifndef TRC_MAX_EVENTS
+    #define TRC_MAX_EVENTS          ( 1 << 20 )
+#endif
+
+// events in each block of a threads buffer
+#define TRC_BLOCK_EVENTS            4096
+
+// most threads that can record events
+#define TRC_MAX_THREADS             80
+
+#ifdef TRACE
+    #define TRC_BEGIN( name )           TRC_Event( name, 'B' )
+    #define TRC_END( name )             TRC_Event( name, 'E' )
+    #define TRC_THREAD_NAME( name )     TRC_Name_Thread( name )
+    #define TRC_WRITE( filename )       TRC_Write( filename )
+#else
+    #define TRC_BEGIN( name )           ( (void)0 )
+    #define TRC_END( name )             ( (void)0 )
+    #define TRC_THREAD_NAME( name )     ( (void)0 )
+    #define TRC_WRITE( filename )       ( (void)0 )
+#endif
+
+
+//===============================================================
+//  FUNCTION PROTOTYPES
+//===============================================================
+
+// All int returning functions return 1 on success or 0 on failure unless otherwise stated
+
+// use the macros above rather than calling these directly
+
+// records an event for the calling thread, phase is 'B' to begin a span or 'E' to end it
+void TRC_Event( const char *name, char phase );
+
+
+// names the calling thread in the trace
+void TRC_Name_Thread( const char *name );
+
+
+// writes every recorded event to a json file and frees the buffers, every thread that
+// recorded events must have finished
+int TRC_Write( char *filename );
+
+
+#endif  // __trace_h__